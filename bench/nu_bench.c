@@ -0,0 +1,766 @@
+// nuGL benchmark suite
+// Times the library's hot paths on a headless (software) GL context and
+// reports the median and p99 of each, plus a JSON file for tracking.
+//
+// Build with `make bench` (nuGL.c must be compiled with NUGL_HEADLESS), or
+// build and run with `make run-bench`. Run:
+//   ./nu_bench [output.json]     (default output: bench_output.json)
+#include "nuGL.h"
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define NUM_SAMPLES 51
+#define MAX_RESULTS 64
+
+typedef struct {
+  char name[64];
+  size_t param;
+  double median_ns;
+  double p99_ns;
+  // Work done per sample, used to derive throughput
+  double bytes;
+  double ops;
+  // Peak signal to noise ratio in dB, for lossy encoders
+  double psnr;
+} bench_Result;
+
+static bench_Result results[MAX_RESULTS];
+static size_t num_results = 0;
+static char temp_dir[] = "/tmp/nu_bench_XXXXXX";
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+static void report(const char *name, size_t param, double *samples, size_t num_samples, double bytes, double ops) {
+  if(num_results >= MAX_RESULTS) return;
+  qsort(samples, num_samples, sizeof(double), compare_doubles);
+  bench_Result *r = &results[num_results++];
+  snprintf(r->name, sizeof(r->name), "%s", name);
+  r->param = param;
+  r->median_ns = samples[num_samples / 2];
+  r->p99_ns = samples[(size_t)((num_samples - 1) * 0.99)];
+  r->bytes = bytes;
+  r->ops = ops;
+  printf("%-28s %10zu  median %12.0f ns  p99 %12.0f ns", name, param, r->median_ns, r->p99_ns);
+  if(bytes > 0) printf("  %9.1f MB/s", bytes / (r->median_ns * 1e-9) / (1024.0 * 1024.0));
+  if(ops > 0) printf("  %12.0f ops/s", ops / (r->median_ns * 1e-9));
+  printf("\n");
+}
+
+// Attaches an encode quality to the last reported result
+static void report_psnr(double psnr) {
+  if(num_results == 0) return;
+  results[num_results - 1].psnr = psnr;
+  printf("%-28s %10s  psnr %8.2f dB\n", "", "", psnr);
+}
+
+static bool write_json(const char *path) {
+  FILE *file = fopen(path, "w");
+  if(!file) {
+    fprintf(stderr, "(write_json): Couldn't open %s for writing.\n", path);
+    return false;
+  }
+  fprintf(file, "{\n  \"renderer\": \"%s\",\n  \"samples\": %d,\n  \"results\": [\n", (const char *)glGetString(GL_RENDERER), NUM_SAMPLES);
+  for(size_t i = 0; i < num_results; i++) {
+    bench_Result *r = &results[i];
+    fprintf(file, "    {\"name\": \"%s\", \"param\": %zu, \"median_ns\": %.1f, \"p99_ns\": %.1f", r->name, r->param, r->median_ns, r->p99_ns);
+    if(r->bytes > 0) fprintf(file, ", \"bytes_per_sec\": %.1f", r->bytes / (r->median_ns * 1e-9));
+    if(r->ops > 0) fprintf(file, ", \"ops_per_sec\": %.1f", r->ops / (r->median_ns * 1e-9));
+    if(r->psnr > 0) fprintf(file, ", \"psnr_db\": %.2f", r->psnr);
+    fprintf(file, "}%s\n", i + 1 < num_results ? "," : "");
+  }
+  fprintf(file, "  ]\n}\n");
+  fclose(file);
+  return true;
+}
+
+static bool write_text_file(const char *path, const char *text) {
+  FILE *file = fopen(path, "wb");
+  if(!file) return false;
+  fputs(text, file);
+  fclose(file);
+  return true;
+}
+
+// -- PNG WRITING --
+// Minimal RGBA PNG writer (stored deflate blocks), so the texture benchmarks
+// don't depend on any files in the tree
+static uint32_t crc_table[256];
+
+static void crc_init(void) {
+  for(uint32_t n = 0; n < 256; n++) {
+    uint32_t c = n;
+    for(int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+    crc_table[n] = c;
+  }
+}
+
+static uint32_t crc_update(uint32_t crc, const uint8_t *data, size_t len) {
+  for(size_t i = 0; i < len; i++) crc = crc_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  return crc;
+}
+
+static void put_u32(uint8_t *out, uint32_t v) {
+  out[0] = v >> 24; out[1] = v >> 16; out[2] = v >> 8; out[3] = v;
+}
+
+static void write_chunk(FILE *file, const char *type, const uint8_t *data, size_t len) {
+  uint8_t header[8];
+  put_u32(header, (uint32_t)len);
+  memcpy(header + 4, type, 4);
+  fwrite(header, 1, 8, file);
+  if(len) fwrite(data, 1, len, file);
+  uint32_t crc = crc_update(0xFFFFFFFFu, (const uint8_t *)type, 4);
+  crc = crc_update(crc, data, len) ^ 0xFFFFFFFFu;
+  uint8_t crc_bytes[4];
+  put_u32(crc_bytes, crc);
+  fwrite(crc_bytes, 1, 4, file);
+}
+
+static bool write_png(const char *path, size_t width, size_t height, uint32_t seed) {
+  size_t raw_len = (width * 4 + 1) * height;
+  uint8_t *raw = malloc(raw_len);
+  size_t num_blocks = (raw_len + 65534) / 65535;
+  uint8_t *idat = malloc(2 + raw_len + num_blocks * 5 + 4);
+  if(!raw || !idat) {
+    free(raw);
+    free(idat);
+    return false;
+  }
+  // Scanlines with filter type 0 and a seeded pattern
+  uint8_t *p = raw;
+  for(size_t y = 0; y < height; y++) {
+    *p++ = 0;
+    for(size_t x = 0; x < width; x++) {
+      *p++ = (uint8_t)(x * 3 + seed);
+      *p++ = (uint8_t)(y * 5 + seed);
+      *p++ = (uint8_t)((x ^ y) + seed);
+      *p++ = 255;
+    }
+  }
+  // zlib stream of stored blocks
+  size_t o = 0;
+  idat[o++] = 0x78;
+  idat[o++] = 0x01;
+  uint32_t a = 1, b = 0;
+  for(size_t i = 0; i < raw_len; i += 65535) {
+    size_t len = raw_len - i < 65535 ? raw_len - i : 65535;
+    idat[o++] = i + len == raw_len;
+    idat[o++] = len & 0xFF;
+    idat[o++] = len >> 8;
+    idat[o++] = ~len & 0xFF;
+    idat[o++] = (~len >> 8) & 0xFF;
+    memcpy(idat + o, raw + i, len);
+    o += len;
+    for(size_t j = 0; j < len; j++) {
+      a = (a + raw[i + j]) % 65521;
+      b = (b + a) % 65521;
+    }
+  }
+  put_u32(idat + o, (b << 16) | a);
+  o += 4;
+
+  FILE *file = fopen(path, "wb");
+  if(!file) {
+    free(raw);
+    free(idat);
+    return false;
+  }
+  static const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  fwrite(signature, 1, 8, file);
+  uint8_t ihdr[13];
+  put_u32(ihdr, (uint32_t)width);
+  put_u32(ihdr + 4, (uint32_t)height);
+  ihdr[8] = 8;  // bit depth
+  ihdr[9] = 6;  // RGBA
+  ihdr[10] = ihdr[11] = ihdr[12] = 0;
+  write_chunk(file, "IHDR", ihdr, sizeof(ihdr));
+  write_chunk(file, "IDAT", idat, o);
+  write_chunk(file, "IEND", NULL, 0);
+  fclose(file);
+  free(raw);
+  free(idat);
+  return true;
+}
+
+// -- BENCHMARKS --
+static nu_Mesh *create_bench_mesh(void) {
+  size_t sizes[] = {sizeof(GLfloat), sizeof(GLfloat)};
+  size_t counts[] = {3, 2};
+  GLenum types[] = {GL_FLOAT, GL_FLOAT};
+  return nu_create_mesh(2, sizes, counts, types);
+}
+
+static void bench_mesh_add_bytes(void) {
+  const size_t total_bytes = 4 << 20;
+  const size_t append_sizes[] = {4, 20, 64, 256, 1024, 4096, 65536};
+  uint8_t *src = calloc(65536, 1);
+  nu_Mesh *mesh = create_bench_mesh();
+  if(!src || !mesh) goto cleanup;
+  for(size_t s = 0; s < sizeof(append_sizes) / sizeof(append_sizes[0]); s++) {
+    size_t append = append_sizes[s];
+    double samples[NUM_SAMPLES];
+    for(size_t i = 0; i < NUM_SAMPLES; i++) {
+      nu_free_mesh(mesh);
+      double start = now_ns();
+      for(size_t added = 0; added < total_bytes; added += append) {
+        nu_mesh_add_bytes(mesh, append, src);
+      }
+      samples[i] = now_ns() - start;
+    }
+    report("mesh_add_bytes", append, samples, NUM_SAMPLES, (double)total_bytes, (double)(total_bytes / append));
+  }
+cleanup:
+  nu_destroy_mesh(&mesh);
+  free(src);
+}
+
+static void bench_mesh_emit(void) {
+  const size_t total_vertices = (4 << 20) / (5 * sizeof(GLfloat));
+  const size_t batch_sizes[] = {1, 24, 1024};
+  nu_Mesh *mesh = create_bench_mesh();
+  if(!mesh) return;
+  for(int mapped = 0; mapped <= 1; mapped++) {
+    for(size_t s = 0; s < sizeof(batch_sizes) / sizeof(batch_sizes[0]); s++) {
+      size_t batch = batch_sizes[s];
+      double samples[NUM_SAMPLES];
+      for(size_t i = 0; i < NUM_SAMPLES; i++) {
+        nu_free_mesh(mesh);
+        double start = now_ns();
+        if(mapped) nu_mesh_begin_mapped(mesh, total_vertices);
+        for(size_t emitted = 0; emitted + batch <= total_vertices; emitted += batch) {
+          GLfloat *v = nu_mesh_emit_vertices(mesh, batch);
+          for(size_t j = 0; j < batch * 5; j++) v[j] = (GLfloat)j;
+        }
+        if(mapped) {
+          nu_mesh_end_mapped(mesh);
+        } else {
+          nu_send_mesh(mesh);
+        }
+        glFinish();
+        samples[i] = now_ns() - start;
+      }
+      report(mapped ? "mesh_emit_mapped+send" : "mesh_emit+send", batch, samples, NUM_SAMPLES, (double)(total_vertices * 5 * sizeof(GLfloat)), 0);
+    }
+  }
+  nu_destroy_mesh(&mesh);
+}
+
+static void bench_send_mesh(void) {
+  const size_t upload_sizes[] = {64 << 10, 1 << 20, 4 << 20, 16 << 20};
+  nu_Mesh *mesh = create_bench_mesh();
+  if(!mesh) return;
+  for(size_t s = 0; s < sizeof(upload_sizes) / sizeof(upload_sizes[0]); s++) {
+    size_t size = upload_sizes[s];
+    uint8_t *src = calloc(size, 1);
+    if(!src) break;
+    nu_free_mesh(mesh);
+    nu_mesh_add_bytes(mesh, size, src);
+    free(src);
+    double samples[NUM_SAMPLES];
+    for(size_t i = 0; i < NUM_SAMPLES; i++) {
+      // Everything changed, so the whole mesh is uploaded
+      nu_mesh_mark_dirty(mesh, 0, size);
+      double start = now_ns();
+      nu_send_mesh(mesh);
+      glFinish();
+      samples[i] = now_ns() - start;
+    }
+    report("send_mesh", size, samples, NUM_SAMPLES, (double)size, 0);
+  }
+  nu_destroy_mesh(&mesh);
+}
+
+static void bench_mesh_patch(void) {
+  // A few hundred scattered vertex edits in a large mesh, then a send
+  const size_t size = 16 << 20;
+  const size_t patch_counts[] = {16, 256, 4096};
+  nu_Mesh *mesh = create_bench_mesh();
+  if(!mesh) return;
+  void *vertices = nu_mesh_emit_vertices(mesh, size / mesh->stride);
+  if(!vertices) {
+    nu_destroy_mesh(&mesh);
+    return;
+  }
+  memset(vertices, 0, size / mesh->stride * mesh->stride);
+  nu_send_mesh(mesh);
+  size_t num_vertices = mesh->builder_added / mesh->stride;
+  uint32_t rng = 12345;
+  for(size_t p = 0; p < sizeof(patch_counts) / sizeof(patch_counts[0]); p++) {
+    double samples[NUM_SAMPLES];
+    for(size_t i = 0; i < NUM_SAMPLES; i++) {
+      double start = now_ns();
+      for(size_t j = 0; j < patch_counts[p]; j++) {
+        rng = rng * 1664525u + 1013904223u;
+        GLfloat *v = nu_mesh_patch(mesh, (rng % num_vertices) * mesh->stride, mesh->stride);
+        v[0] += 1.0f;
+      }
+      nu_send_mesh(mesh);
+      glFinish();
+      samples[i] = now_ns() - start;
+    }
+    report("mesh_patch+send", patch_counts[p], samples, NUM_SAMPLES, 0, (double)patch_counts[p]);
+  }
+  nu_destroy_mesh(&mesh);
+}
+
+static void bench_mesh_usage(void) {
+  // A mesh rebuilt, sent and drawn every frame, under each usage mode
+  const size_t size = 256 << 10;
+  const size_t frames_per_sample = 16;
+  size_t sizes[] = {sizeof(GLfloat), sizeof(GLfloat)};
+  size_t counts[] = {3, 2};
+  GLenum types[] = {GL_FLOAT, GL_FLOAT};
+  const nu_MeshUsage usages[] = {NU_MESH_STATIC, NU_MESH_DYNAMIC, NU_MESH_STREAM};
+  const char *names[] = {"mesh_per_frame_static", "mesh_per_frame_dynamic", "mesh_per_frame_stream"};
+  for(size_t u = 0; u < 3; u++) {
+    nu_Mesh *mesh = nu_create_mesh_with_usage(usages[u], 2, sizes, counts, types);
+    if(!mesh) return;
+    nu_mesh_set_render_mode(mesh, GL_POINTS);
+    double samples[NUM_SAMPLES];
+    for(size_t i = 0; i < NUM_SAMPLES; i++) {
+      double start = now_ns();
+      for(size_t frame = 0; frame < frames_per_sample; frame++) {
+        mesh->builder_added = 0;
+        memset(nu_mesh_emit_vertices(mesh, size / mesh->stride), (int)frame, size / mesh->stride * mesh->stride);
+        nu_send_mesh(mesh);
+        nu_render_mesh(mesh);
+        glFlush();
+      }
+      glFinish();
+      samples[i] = now_ns() - start;
+    }
+    report(names[u], size, samples, NUM_SAMPLES, (double)(size * frames_per_sample), (double)frames_per_sample);
+    nu_destroy_mesh(&mesh);
+  }
+}
+
+static void bench_quantize_vertices(void) {
+  // Float vertex data converted to compact attributes, alone and interleaved
+  // into a 16 byte vertex (half position, unorm8 color, packed normal)
+  const size_t num_vertices = 256 << 10;
+  const struct {
+    const char *name;
+    GLenum type;
+    bool normalized;
+    size_t count;
+  } formats[] = {
+    {"quantize_half3", GL_HALF_FLOAT, false, 3},
+    {"quantize_snorm16x3", GL_SHORT, true, 3},
+    {"quantize_unorm8x4", GL_UNSIGNED_BYTE, true, 4},
+    {"quantize_snorm10x3_2", GL_INT_2_10_10_10_REV, true, 4}
+  };
+  float *in = malloc(num_vertices * 4 * sizeof(float));
+  uint8_t *out = malloc(num_vertices * 16);
+  if(!in || !out) goto cleanup;
+  for(size_t i = 0; i < num_vertices * 4; i++) in[i] = (float)((i * 2654435761u) % 2001) / 1000.0f - 1.0f;
+  for(size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+    double samples[NUM_SAMPLES];
+    for(size_t i = 0; i < NUM_SAMPLES; i++) {
+      double start = now_ns();
+      nu_quantize_vertices(formats[f].type, formats[f].normalized, formats[f].count, num_vertices, in, out, 0);
+      samples[i] = now_ns() - start;
+    }
+    report(formats[f].name, num_vertices, samples, NUM_SAMPLES, (double)(num_vertices * formats[f].count * sizeof(float)), (double)num_vertices);
+  }
+  double samples[NUM_SAMPLES];
+  for(size_t i = 0; i < NUM_SAMPLES; i++) {
+    double start = now_ns();
+    nu_quantize_vertices(GL_HALF_FLOAT, false, 3, num_vertices, in, out, 16);
+    nu_quantize_vertices(GL_UNSIGNED_BYTE, true, 4, num_vertices, in, out + 6, 16);
+    nu_quantize_vertices(GL_INT_2_10_10_10_REV, true, 4, num_vertices, in, out + 10, 16);
+    samples[i] = now_ns() - start;
+  }
+  report("quantize_interleaved16", num_vertices, samples, NUM_SAMPLES, (double)(num_vertices * 11 * sizeof(float)), (double)num_vertices);
+cleanup:
+  free(in);
+  free(out);
+}
+
+static void bench_set_uniform(void) {
+  const size_t uniform_counts[] = {1, 4, 16, 64};
+  const size_t calls_per_sample = 1000;
+  char vert_path[64], frag_path[64];
+  snprintf(vert_path, sizeof(vert_path), "%s/uniforms.vert", temp_dir);
+  snprintf(frag_path, sizeof(frag_path), "%s/uniforms.frag", temp_dir);
+  if(!write_text_file(frag_path, "#version 330 core\nout vec4 color;\nvoid main() { color = vec4(1.0); }\n")) return;
+
+  for(size_t c = 0; c < sizeof(uniform_counts) / sizeof(uniform_counts[0]); c++) {
+    size_t num_uniforms = uniform_counts[c];
+    // Every uniform is used, so none get optimised out
+    char *source = calloc(num_uniforms * 64 + 256, 1);
+    if(!source) return;
+    char *p = source;
+    p += sprintf(p, "#version 330 core\nlayout(location = 0) in vec3 pos;\n");
+    for(size_t u = 0; u < num_uniforms; u++) p += sprintf(p, "uniform float u%zu;\n", u);
+    p += sprintf(p, "void main() {\n  float s = 0.0;\n");
+    for(size_t u = 0; u < num_uniforms; u++) p += sprintf(p, "  s += u%zu;\n", u);
+    sprintf(p, "  gl_Position = vec4(pos * s, 1.0);\n}\n");
+    bool written = write_text_file(vert_path, source);
+    free(source);
+    if(!written) return;
+
+    nu_Program *program = nu_create_program(2, vert_path, frag_path);
+    if(!program) return;
+    char names[64][16];
+    for(size_t u = 0; u < num_uniforms; u++) {
+      snprintf(names[u], sizeof(names[u]), "u%u", (unsigned)u);
+      nu_register_uniform(program, names[u], GL_FLOAT);
+    }
+    double samples[NUM_SAMPLES];
+    float value = 0.0f;
+    for(size_t i = 0; i < NUM_SAMPLES; i++) {
+      double start = now_ns();
+      for(size_t call = 0; call < calls_per_sample; call++) {
+        // Change the value each call so nothing can be skipped
+        value += 1.0f;
+        nu_set_uniform(program, names[call % num_uniforms], &value);
+      }
+      samples[i] = now_ns() - start;
+    }
+    report("set_uniform", num_uniforms, samples, NUM_SAMPLES, 0, (double)calls_per_sample);
+
+    // Same value every call, so every set after the first is skipped
+    for(size_t i = 0; i < NUM_SAMPLES; i++) {
+      double start = now_ns();
+      for(size_t call = 0; call < calls_per_sample; call++) {
+        nu_set_uniform(program, names[call % num_uniforms], &value);
+      }
+      samples[i] = now_ns() - start;
+    }
+    report("set_uniform_unchanged", num_uniforms, samples, NUM_SAMPLES, 0, (double)calls_per_sample);
+
+    int handles[64];
+    for(size_t u = 0; u < num_uniforms; u++) handles[u] = nu_get_uniform_handle(program, names[u]);
+    for(size_t i = 0; i < NUM_SAMPLES; i++) {
+      double start = now_ns();
+      for(size_t call = 0; call < calls_per_sample; call++) {
+        value += 1.0f;
+        nu_set_uniform_handle(program, handles[call % num_uniforms], &value);
+      }
+      samples[i] = now_ns() - start;
+    }
+    report("set_uniform_handle", num_uniforms, samples, NUM_SAMPLES, 0, (double)calls_per_sample);
+    nu_destroy_program(&program);
+  }
+  unlink(vert_path);
+  unlink(frag_path);
+}
+
+static void bench_create_program(void) {
+  char vert_path[64], frag_path[64], cache_dir[64];
+  snprintf(vert_path, sizeof(vert_path), "%s/program.vert", temp_dir);
+  snprintf(frag_path, sizeof(frag_path), "%s/program.frag", temp_dir);
+  snprintf(cache_dir, sizeof(cache_dir), "%s/program_cache", temp_dir);
+  if(!write_text_file(vert_path, "#version 330 core\nlayout(location = 0) in vec3 pos;\nuniform mat4 mvp;\nvoid main() { gl_Position = mvp * vec4(pos, 1.0); }\n")) return;
+  if(!write_text_file(frag_path, "#version 330 core\nout vec4 color;\nuniform vec4 tint;\nvoid main() { color = tint; }\n")) return;
+  if(mkdir(cache_dir, 0755) != 0) return;
+
+  // Compiled from source every time, then loaded from a warm cache
+  for(int cached = 0; cached < 2; cached++) {
+    nu_set_program_cache_dir(cached ? cache_dir : NULL);
+    if(cached) {
+      nu_Program *warm = nu_create_program(2, vert_path, frag_path);
+      nu_destroy_program(&warm);
+    }
+    double samples[NUM_SAMPLES];
+    for(size_t i = 0; i < NUM_SAMPLES; i++) {
+      double start = now_ns();
+      nu_Program *program = nu_create_program(2, vert_path, frag_path);
+      samples[i] = now_ns() - start;
+      nu_destroy_program(&program);
+    }
+    report(cached ? "create_program_cached" : "create_program", 2, samples, NUM_SAMPLES, 0, 1.0);
+  }
+  nu_set_program_cache_dir(NULL);
+
+  DIR *dir = opendir(cache_dir);
+  if(dir) {
+    struct dirent *entry;
+    while((entry = readdir(dir))) {
+      if(entry->d_name[0] == '.') continue;
+      char path[384];
+      snprintf(path, sizeof(path), "%s/%s", cache_dir, entry->d_name);
+      unlink(path);
+    }
+    closedir(dir);
+  }
+  rmdir(cache_dir);
+  unlink(vert_path);
+  unlink(frag_path);
+}
+
+static void bench_load_texture(void) {
+  const size_t texture_sizes[] = {256, 1024};
+  char path[64], nut_path[64];
+  snprintf(path, sizeof(path), "%s/texture.png", temp_dir);
+  snprintf(nut_path, sizeof(nut_path), "%s/texture.nut", temp_dir);
+  for(size_t s = 0; s < sizeof(texture_sizes) / sizeof(texture_sizes[0]); s++) {
+    size_t size = texture_sizes[s];
+    if(!write_png(path, size, size, (uint32_t)s)) return;
+    double samples[NUM_SAMPLES];
+    for(size_t i = 0; i < NUM_SAMPLES; i++) {
+      double start = now_ns();
+      nu_Texture *texture = nu_load_texture(path);
+      glFinish();
+      samples[i] = now_ns() - start;
+      nu_destroy_texture(&texture);
+    }
+    report("load_texture", size, samples, NUM_SAMPLES, (double)(size * size * 4), 0);
+
+    // The same image as a container, with its whole mip chain
+    const char *image_locs[] = {path};
+    if(!nu_convert_texture(1, image_locs, nut_path, NU_TEXTURE_RGBA8)) return;
+    for(size_t i = 0; i < NUM_SAMPLES; i++) {
+      double start = now_ns();
+      nu_Texture *texture = nu_load_texture(nut_path);
+      glFinish();
+      samples[i] = now_ns() - start;
+      nu_destroy_texture(&texture);
+    }
+    report("load_texture_nut", size, samples, NUM_SAMPLES, (double)(size * size * 4), 0);
+  }
+  unlink(path);
+  unlink(nut_path);
+}
+
+static void bench_load_texture_array(void) {
+  const size_t size = 256;
+  char paths[8][64];
+  for(size_t i = 0; i < 8; i++) {
+    snprintf(paths[i], sizeof(paths[i]), "%s/layer%zu.png", temp_dir, i);
+    if(!write_png(paths[i], size, size, (uint32_t)i)) return;
+  }
+  double samples[NUM_SAMPLES];
+  for(size_t i = 0; i < NUM_SAMPLES; i++) {
+    double start = now_ns();
+    nu_Texture *texture = nu_load_texture_array(8, paths[0], paths[1], paths[2], paths[3], paths[4], paths[5], paths[6], paths[7]);
+    glFinish();
+    samples[i] = now_ns() - start;
+    nu_destroy_texture(&texture);
+  }
+  report("load_texture_array", 8, samples, NUM_SAMPLES, (double)(size * size * 4 * 8), 0);
+
+  // A large array from data, reusing the 8 images
+  const size_t num_layers = 64;
+  const char *layer_paths[64];
+  for(size_t i = 0; i < num_layers; i++) layer_paths[i] = paths[i % 8];
+  for(size_t i = 0; i < NUM_SAMPLES; i++) {
+    double start = now_ns();
+    nu_Texture *texture = nu_load_texture_array_paths(num_layers, layer_paths);
+    glFinish();
+    samples[i] = now_ns() - start;
+    nu_destroy_texture(&texture);
+  }
+  report("load_texture_array_paths", num_layers, samples, NUM_SAMPLES, (double)(size * size * 4 * num_layers), 0);
+  for(size_t i = 0; i < 8; i++) unlink(paths[i]);
+}
+
+static void bench_create_atlas(void) {
+  const size_t num_images = 128;
+  char paths[128][64];
+  const char *image_locs[128];
+  for(size_t i = 0; i < num_images; i++) {
+    snprintf(paths[i], sizeof(paths[i]), "%s/sprite%zu.png", temp_dir, i);
+    image_locs[i] = paths[i];
+    // Mixed sizes from 8 to 71 texels a side
+    if(!write_png(paths[i], 8 + (i * 37) % 64, 8 + (i * 53) % 64, (uint32_t)i)) return;
+  }
+  double samples[NUM_SAMPLES];
+  for(size_t i = 0; i < NUM_SAMPLES; i++) {
+    double start = now_ns();
+    nu_Atlas *atlas = nu_create_atlas(num_images, image_locs, 512, 2, NU_TEXTURE_RGBA8);
+    glFinish();
+    samples[i] = now_ns() - start;
+    nu_destroy_atlas(&atlas);
+  }
+  report("create_atlas", num_images, samples, NUM_SAMPLES, 0, (double)num_images);
+  for(size_t i = 0; i < num_images; i++) unlink(paths[i]);
+}
+
+// Cost of a cache hit with many resources cached, against a fresh load
+static void bench_resource_cache(void) {
+  const size_t num_textures = 256;
+  char path[64];
+  snprintf(path, sizeof(path), "%s/cached.png", temp_dir);
+  if(!write_png(path, 64, 64, 0)) return;
+  // Links to one image, so each is its own cache entry
+  char links[256][64];
+  nu_Texture *textures[256];
+  for(size_t i = 0; i < num_textures; i++) {
+    snprintf(links[i], sizeof(links[i]), "%s/cached%zu.png", temp_dir, i);
+    if(link(path, links[i]) != 0) return;
+    textures[i] = nu_acquire_texture(links[i], NU_TEXTURE_RGBA8);
+  }
+  double samples[NUM_SAMPLES];
+  for(size_t i = 0; i < NUM_SAMPLES; i++) {
+    double start = now_ns();
+    for(size_t j = 0; j < num_textures; j++) {
+      nu_Texture *texture = nu_acquire_texture(links[j], NU_TEXTURE_RGBA8);
+      nu_release_texture(&texture);
+    }
+    samples[i] = now_ns() - start;
+  }
+  report("acquire_texture_hit", num_textures, samples, NUM_SAMPLES, 0, (double)num_textures);
+  for(size_t i = 0; i < num_textures; i++) {
+    nu_release_texture(&textures[i]);
+    unlink(links[i]);
+  }
+  unlink(path);
+}
+
+// How closely the limiter holds a 2 ms frame time, p99 is the jitter
+static void bench_frame_limiter(nu_Window *window) {
+  double samples[NUM_SAMPLES];
+  nu_set_target_fps(window, 500.0);
+  // The first frame only sets the first deadline
+  nu_end_frame(window);
+  double last = now_ns();
+  for(size_t i = 0; i < NUM_SAMPLES; i++) {
+    nu_end_frame(window);
+    double now = now_ns();
+    samples[i] = now - last;
+    last = now;
+  }
+  nu_set_target_fps(window, 0.0);
+  report("frame_limiter_500fps", 500, samples, NUM_SAMPLES, 0, 1);
+}
+
+// Smooth gradients with some texel noise, closer to real textures than
+// write_png's pattern, and alpha/red/green that vary independently
+static void fill_photo(uint8_t *rgba, size_t width, size_t height) {
+  uint32_t seed = 12345;
+  for(size_t y = 0; y < height; y++) {
+    for(size_t x = 0; x < width; x++) {
+      seed = seed * 1664525u + 1013904223u;
+      int noise = (int)(seed >> 28) - 8;
+      float fx = (float)x / width, fy = (float)y / height;
+      int v[4] = {
+        (int)(128 + 100 * sinf(fx * 9.0f) * cosf(fy * 5.0f)) + noise,
+        (int)(128 + 110 * cosf((fx + fy) * 7.0f)) + noise,
+        (int)(255 * fx * fy) + noise,
+        (int)(128 + 127 * sinf(fy * 13.0f))
+      };
+      for(size_t c = 0; c < 4; c++) rgba[(y * width + x) * 4 + c] = (uint8_t)(v[c] < 0 ? 0 : v[c] > 255 ? 255 : v[c]);
+    }
+  }
+}
+
+// Lets the driver decode an encoded image and compares it with the source,
+// over the channels the format keeps
+static double encoded_psnr(nu_TextureFormat format, const uint8_t *encoded, size_t encoded_size, const uint8_t *rgba, size_t width, size_t height) {
+  static const size_t channels[] = {4, 3, 4, 1, 2};
+  GLuint id;
+  glGenTextures(1, &id);
+  glBindTexture(GL_TEXTURE_2D, id);
+  // Bound behind nuGL's back, so its state cache must forget what it knows
+  nu_reset_state_cache();
+  glCompressedTexImage2D(GL_TEXTURE_2D, 0, nu_texture_format_gl(format), (GLsizei)width, (GLsizei)height, 0, (GLsizei)encoded_size, encoded);
+  uint8_t *decoded = malloc(width * height * 4);
+  if(!decoded) {
+    glDeleteTextures(1, &id);
+    return 0.0;
+  }
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, decoded);
+  glDeleteTextures(1, &id);
+  double error = 0.0;
+  for(size_t i = 0; i < width * height; i++) {
+    for(size_t c = 0; c < channels[format]; c++) {
+      double d = (double)decoded[i * 4 + c] - rgba[i * 4 + c];
+      error += d * d;
+    }
+  }
+  free(decoded);
+  double mse = error / (double)(width * height * channels[format]);
+  return mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : 99.0;
+}
+
+static void bench_encode_texture(void) {
+  static const char *names[] = {NULL, "encode_bc1", "encode_bc3", "encode_bc4", "encode_bc5"};
+  const size_t size = 1024;
+  uint8_t *rgba = malloc(size * size * 4);
+  uint8_t *encoded = malloc(nu_encoded_texture_size(NU_TEXTURE_RGBA8, size, size));
+  if(!rgba || !encoded) {
+    free(rgba);
+    free(encoded);
+    return;
+  }
+  fill_photo(rgba, size, size);
+  for(nu_TextureFormat format = NU_TEXTURE_BC1; format <= NU_TEXTURE_BC5; format++) {
+    double samples[NUM_SAMPLES];
+    size_t encoded_size = 0;
+    for(size_t i = 0; i < NUM_SAMPLES; i++) {
+      double start = now_ns();
+      encoded_size = nu_encode_texture(format, rgba, size, size, encoded);
+      samples[i] = now_ns() - start;
+    }
+    report(names[format], size, samples, NUM_SAMPLES, (double)(size * size * 4), 0);
+    report_psnr(encoded_psnr(format, encoded, encoded_size, rgba, size, size));
+  }
+  free(rgba);
+  free(encoded);
+
+  // Load to upload, with the encode on top of the decode
+  char path[64];
+  snprintf(path, sizeof(path), "%s/texture.png", temp_dir);
+  if(!write_png(path, size, size, 0)) return;
+  double samples[NUM_SAMPLES];
+  for(size_t i = 0; i < NUM_SAMPLES; i++) {
+    double start = now_ns();
+    nu_Texture *texture = nu_load_texture_with_format(path, NU_TEXTURE_BC1);
+    glFinish();
+    samples[i] = now_ns() - start;
+    nu_destroy_texture(&texture);
+  }
+  report("load_texture_bc1", size, samples, NUM_SAMPLES, (double)(size * size * 4), 0);
+  unlink(path);
+}
+
+int main(int argc, char **argv) {
+  const char *output_path = argc > 1 ? argv[1] : "bench_output.json";
+  // Default to Mesa's software rasteriser, so results are comparable across machines
+  setenv("LIBGL_ALWAYS_SOFTWARE", "1", 0);
+  nu_Window *window = nu_create_headless_window(256, 256);
+  if(!window) {
+    fprintf(stderr, "(main): Couldn't create a headless window.\n");
+    return 1;
+  }
+  if(!mkdtemp(temp_dir)) {
+    fprintf(stderr, "(main): Couldn't create a temporary directory.\n");
+    nu_destroy_window(&window);
+    return 1;
+  }
+  crc_init();
+  printf("Renderer: %s\n", (const char *)glGetString(GL_RENDERER));
+
+  bench_mesh_add_bytes();
+  bench_mesh_emit();
+  bench_send_mesh();
+  bench_mesh_patch();
+  bench_mesh_usage();
+  bench_quantize_vertices();
+  bench_set_uniform();
+  bench_create_program();
+  bench_load_texture();
+  bench_load_texture_array();
+  bench_encode_texture();
+  bench_create_atlas();
+  bench_resource_cache();
+  bench_frame_limiter(window);
+
+  rmdir(temp_dir);
+  bool written = write_json(output_path);
+  nu_destroy_window(&window);
+  return written ? 0 : 1;
+}
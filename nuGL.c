@@ -3,6 +3,443 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "external/stb/stb_image.h"
 
+#ifdef NUGL_HEADLESS
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include <sys/stat.h>
+#include <time.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <limits.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define NU_SSE2
+#endif
+
+// Renderer counters
+// Counting goes to the frame in progress on whichever window last started a
+// frame, and nowhere before one has
+static nu_RenderCounters nu_unattached_counters;
+static nu_RenderCounters *nu_counters = &nu_unattached_counters;
+// Live objects outlast frames, so they're kept apart from the counters
+static size_t nu_live_objects[NU_GPU_OBJECT_TYPES];
+static size_t nu_live_bytes[NU_GPU_OBJECT_TYPES];
+
+// Accounts for count objects made (or deleted when negative), and storage
+// gained or lost. Only the GL thread may count
+static void nu_count_objects(nu_GpuObjectType type, int count, int64_t bytes) {
+  nu_live_objects[type] += (size_t)(int64_t)count;
+  nu_live_bytes[type] += (size_t)bytes;
+}
+
+// Accounts for a texture nuGL made and filled
+static void nu_count_new_texture(nu_Texture *texture) {
+  size_t bytes = nu_texture_gpu_bytes(texture);
+  nu_count_objects(NU_GPU_TEXTURE, 1, (int64_t)bytes);
+  nu_counters->texture_upload_bytes += bytes;
+}
+
+// GL state cache
+// Shadow copy of the bindings nuGL makes in the current context, so binds
+// that wouldn't change anything are skipped. NU_STATE_UNKNOWN forces the
+// next bind through
+#define NU_STATE_UNKNOWN UINT32_MAX
+#define NU_MAX_TEXTURE_UNITS 32
+
+static struct {
+  GLuint program;
+  GLuint vertex_array;
+  GLuint array_buffer;
+  GLuint active_unit;
+  // Per unit, the GL_TEXTURE_2D and GL_TEXTURE_2D_ARRAY bindings
+  GLuint textures[NU_MAX_TEXTURE_UNITS][2];
+} nu_state;
+
+void nu_reset_state_cache(void) {
+  memset(&nu_state, 0xFF, sizeof(nu_state));
+}
+
+static void nu_state_use_program(GLuint program) {
+  if(nu_state.program == program) return;
+  glUseProgram(program);
+  nu_state.program = program;
+  nu_counters->program_binds++;
+}
+
+static void nu_state_bind_vertex_array(GLuint vertex_array) {
+  if(nu_state.vertex_array == vertex_array) return;
+  glBindVertexArray(vertex_array);
+  nu_state.vertex_array = vertex_array;
+  nu_counters->vertex_array_binds++;
+}
+
+static void nu_state_bind_array_buffer(GLuint buffer) {
+  if(nu_state.array_buffer == buffer) return;
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  nu_state.array_buffer = buffer;
+}
+
+static int nu_state_texture_target_index(GLenum target) {
+  if(target == GL_TEXTURE_2D) return 0;
+  if(target == GL_TEXTURE_2D_ARRAY) return 1;
+  return -1;
+}
+
+static void nu_state_bind_texture(GLuint unit, GLenum target, GLuint texture) {
+  int target_index = nu_state_texture_target_index(target);
+  bool cached = unit < NU_MAX_TEXTURE_UNITS && target_index >= 0;
+  if(cached && nu_state.textures[unit][target_index] == texture) return;
+  if(nu_state.active_unit != unit) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    nu_state.active_unit = unit;
+  }
+  glBindTexture(target, texture);
+  if(cached) nu_state.textures[unit][target_index] = texture;
+  nu_counters->texture_binds++;
+}
+
+// Binds a texture for uploading, on whichever unit is already active
+static void nu_state_bind_texture_for_upload(GLenum target, GLuint texture) {
+  nu_state_bind_texture(nu_state.active_unit == NU_STATE_UNKNOWN ? 0 : nu_state.active_unit, target, texture);
+}
+
+// Deleting a bound object unbinds it, except for the program in use, which
+// stays in use until another one is
+static void nu_state_forget_program(GLuint program) {
+  if(nu_state.program == program) nu_state.program = NU_STATE_UNKNOWN;
+}
+
+static void nu_state_forget_vertex_array(GLuint vertex_array) {
+  if(nu_state.vertex_array == vertex_array) nu_state.vertex_array = 0;
+}
+
+static void nu_state_forget_buffer(GLuint buffer) {
+  if(nu_state.array_buffer == buffer) nu_state.array_buffer = 0;
+}
+
+static void nu_state_forget_texture(GLuint texture) {
+  for(size_t unit = 0; unit < NU_MAX_TEXTURE_UNITS; unit++) {
+    for(size_t target = 0; target < 2; target++) {
+      if(nu_state.textures[unit][target] == texture) nu_state.textures[unit][target] = 0;
+    }
+  }
+}
+
+// Waits for a fence sync to signal, then deletes it
+static void nu_wait_fence(GLsync *fence) {
+  if(!fence || !(*fence)) return;
+  GLenum res;
+  do {
+    res = glClientWaitSync(*fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+  } while(res == GL_TIMEOUT_EXPIRED);
+  glDeleteSync(*fence);
+  *fence = NULL;
+}
+
+uint64_t nu_get_time_ns(void) {
+#ifndef _WIN32
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#else
+  uint64_t value = glfwGetTimerValue(), frequency = glfwGetTimerFrequency();
+  return value / frequency * 1000000000ull + value % frequency * 1000000000ull / frequency;
+#endif
+}
+
+// Profiler
+#ifdef NUGL_PROFILE
+// Zones per frame that get GPU times, the rest are CPU only
+#define NU_PROFILE_MAX_ZONES 256
+#define NU_PROFILE_MAX_EVENTS 65536
+#define NU_PROFILE_MAX_DEPTH 64
+
+typedef struct {
+  const char *name;
+  uint64_t cpu_start, cpu_end;
+  // On the CPU clock, 0 until read back
+  uint64_t gpu_start, gpu_end;
+  uint64_t frame;
+  // First of the zone's two queries in its frame's pool, -1 for none
+  int32_t query;
+  uint32_t depth;
+} nu_ProfileEvent;
+
+typedef struct {
+  GLuint queries[NU_PROFILE_MAX_ZONES * 2];
+  size_t num_queries;
+  // Index of the last query issued, whose result comes after all others
+  int32_t last_query;
+  uint64_t frame;
+  // The frame's events in the event ring
+  uint64_t first_event, num_events;
+  // The CPU and GPU clocks read together, to put GPU times on the CPU's
+  uint64_t sync_cpu;
+  GLint64 sync_gpu;
+} nu_ProfileFrame;
+
+typedef struct {
+  const char *name;
+  uint64_t cpu_start, frame;
+  int32_t query;
+} nu_ProfileZone;
+
+static bool nu_profile_initialised = false;
+static pthread_t nu_profile_thread;
+static nu_ProfileEvent nu_profile_events[NU_PROFILE_MAX_EVENTS];
+static uint64_t nu_profile_num_events = 0;
+static nu_ProfileFrame nu_profile_frames[NU_PROFILE_FRAMES];
+static uint64_t nu_profile_frame = 0;
+static nu_ProfileZone nu_profile_stack[NU_PROFILE_MAX_DEPTH];
+static size_t nu_profile_depth = 0;
+
+// The first thread to profile must be the GL thread, zones on any other are
+// ignored
+static bool nu_profile_ready(void) {
+  if(!nu_profile_initialised) {
+    nu_profile_thread = pthread_self();
+    for(size_t i = 0; i < NU_PROFILE_FRAMES; i++) {
+      glGenQueries(NU_PROFILE_MAX_ZONES * 2, nu_profile_frames[i].queries);
+      nu_profile_frames[i].last_query = -1;
+    }
+    nu_profile_initialised = true;
+  }
+  return pthread_equal(pthread_self(), nu_profile_thread);
+}
+
+int nu_profile_begin(const char *name) {
+  if(!nu_profile_ready()) return 0;
+  // Past the maximum depth zones are only counted, so ends still pair up
+  if(nu_profile_depth++ >= NU_PROFILE_MAX_DEPTH) return 0;
+  nu_ProfileZone *zone = &nu_profile_stack[nu_profile_depth - 1];
+  nu_ProfileFrame *frame = &nu_profile_frames[nu_profile_frame % NU_PROFILE_FRAMES];
+  zone->name = name;
+  zone->frame = nu_profile_frame;
+  zone->query = -1;
+  if(frame->num_queries + 2 <= NU_PROFILE_MAX_ZONES * 2) {
+    zone->query = (int32_t)frame->num_queries;
+    frame->num_queries += 2;
+    glQueryCounter(frame->queries[zone->query], GL_TIMESTAMP);
+    frame->last_query = zone->query;
+  }
+  zone->cpu_start = nu_get_time_ns();
+  return 0;
+}
+
+void nu_profile_end(void) {
+  if(!nu_profile_initialised || !pthread_equal(pthread_self(), nu_profile_thread) || nu_profile_depth == 0) return;
+  if(--nu_profile_depth >= NU_PROFILE_MAX_DEPTH) return;
+  uint64_t cpu_end = nu_get_time_ns();
+  nu_ProfileZone *zone = &nu_profile_stack[nu_profile_depth];
+  nu_ProfileFrame *frame = &nu_profile_frames[nu_profile_frame % NU_PROFILE_FRAMES];
+  // A zone that began in an earlier frame has lost its first query
+  int32_t query = zone->query;
+  if(query >= 0 && zone->frame == nu_profile_frame) {
+    glQueryCounter(frame->queries[query + 1], GL_TIMESTAMP);
+    frame->last_query = query + 1;
+  } else {
+    query = -1;
+  }
+  nu_ProfileEvent *event = &nu_profile_events[nu_profile_num_events++ % NU_PROFILE_MAX_EVENTS];
+  *event = (nu_ProfileEvent){
+    .name = zone->name,
+    .cpu_start = zone->cpu_start,
+    .cpu_end = cpu_end,
+    .frame = nu_profile_frame,
+    .query = query,
+    .depth = (uint32_t)nu_profile_depth
+  };
+  frame->num_events++;
+}
+
+void nu_profile_scope_end(int *scope) {
+  (void)scope;
+  nu_profile_end();
+}
+
+// Reads a frame's GPU times, if the GPU has finished it. Never waits
+static void nu_profile_resolve(nu_ProfileFrame *frame) {
+  if(frame->last_query < 0) return;
+  GLint available = 0;
+  glGetQueryObjectiv(frame->queries[frame->last_query], GL_QUERY_RESULT_AVAILABLE, &available);
+  if(!available) return;
+  for(uint64_t i = frame->first_event; i < frame->first_event + frame->num_events; i++) {
+    // Already overwritten
+    if(nu_profile_num_events - i > NU_PROFILE_MAX_EVENTS) continue;
+    nu_ProfileEvent *event = &nu_profile_events[i % NU_PROFILE_MAX_EVENTS];
+    if(event->frame != frame->frame || event->query < 0) continue;
+    GLuint64 start = 0, end = 0;
+    glGetQueryObjectui64v(frame->queries[event->query], GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(frame->queries[event->query + 1], GL_QUERY_RESULT, &end);
+    event->gpu_start = frame->sync_cpu + (uint64_t)((GLint64)start - frame->sync_gpu);
+    event->gpu_end = frame->sync_cpu + (uint64_t)((GLint64)end - frame->sync_gpu);
+  }
+}
+
+// Moves on to the next frame's queries, reading back the frame that last
+// used them
+static void nu_profile_next_frame(void) {
+  if(!nu_profile_ready()) return;
+  nu_profile_frame++;
+  nu_ProfileFrame *frame = &nu_profile_frames[nu_profile_frame % NU_PROFILE_FRAMES];
+  nu_profile_resolve(frame);
+  frame->num_queries = 0;
+  frame->last_query = -1;
+  frame->frame = nu_profile_frame;
+  frame->first_event = nu_profile_num_events;
+  frame->num_events = 0;
+  glGetInteger64v(GL_TIMESTAMP, &frame->sync_gpu);
+  frame->sync_cpu = nu_get_time_ns();
+}
+
+// Writes a zone name as a JSON string, escaping quotes, backslashes and
+// control characters
+static void nu_write_json_string(FILE *file, const char *string) {
+  fputc('"', file);
+  for(const unsigned char *c = (const unsigned char *)string; *c; c++) {
+    if(*c == '"' || *c == '\\') fprintf(file, "\\%c", *c);
+    else if(*c < 0x20) fprintf(file, "\\u%04x", *c);
+    else fputc(*c, file);
+  }
+  fputc('"', file);
+}
+#endif
+
+bool nu_export_profile(const char *json_loc) {
+  if(!json_loc) return false;
+#ifdef NUGL_PROFILE
+  FILE *file = fopen(json_loc, "w");
+  if(!file) {
+    fprintf(stderr, "(nu_export_profile): Couldn't write %s, fopen returned NULL.\n", json_loc);
+    return false;
+  }
+  // Frames still in flight get whatever GPU times are ready now
+  for(size_t i = 0; i < NU_PROFILE_FRAMES && nu_profile_initialised; i++) nu_profile_resolve(&nu_profile_frames[i]);
+  uint64_t first = nu_profile_num_events > NU_PROFILE_MAX_EVENTS ? nu_profile_num_events - NU_PROFILE_MAX_EVENTS : 0;
+  // Times are in microseconds from the earliest recorded zone
+  uint64_t base = UINT64_MAX;
+  for(uint64_t i = first; i < nu_profile_num_events; i++) {
+    uint64_t start = nu_profile_events[i % NU_PROFILE_MAX_EVENTS].cpu_start;
+    if(start < base) base = start;
+  }
+  fprintf(file, "{\"traceEvents\": [\n");
+  fprintf(file, "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, \"args\": {\"name\": \"CPU\"}},\n");
+  fprintf(file, "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 2, \"args\": {\"name\": \"GPU\"}}");
+  for(uint64_t i = first; i < nu_profile_num_events; i++) {
+    const nu_ProfileEvent *event = &nu_profile_events[i % NU_PROFILE_MAX_EVENTS];
+    fprintf(file, ",\n  {\"name\": ");
+    nu_write_json_string(file, event->name);
+    fprintf(file, ", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"frame\": %llu}}",
+            (event->cpu_start - base) / 1e3, (event->cpu_end - event->cpu_start) / 1e3, (unsigned long long)event->frame);
+    if(event->gpu_end > event->gpu_start) {
+      // Before the earliest zone only if clocks drifted, clamp to it
+      double gpu_start = event->gpu_start > base ? (event->gpu_start - base) / 1e3 : 0.0;
+      fprintf(file, ",\n  {\"name\": ");
+      nu_write_json_string(file, event->name);
+      fprintf(file, ", \"ph\": \"X\", \"pid\": 1, \"tid\": 2, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"frame\": %llu}}",
+              gpu_start, (event->gpu_end - event->gpu_start) / 1e3, (unsigned long long)event->frame);
+    }
+  }
+  fprintf(file, "\n]}\n");
+  if(fclose(file) != 0) {
+    fprintf(stderr, "(nu_export_profile): Couldn't write %s, fclose failed.\n", json_loc);
+    return false;
+  }
+  return true;
+#else
+  fprintf(stderr, "(nu_export_profile): Couldn't export %s, nuGL.c was built without NUGL_PROFILE.\n", json_loc);
+  return false;
+#endif
+}
+
+// Input events
+// GLFW callbacks only stamp events and push them to the window's queue. The
+// thread reading input applies them, so the key and mouse state is only
+// ever touched by one thread
+static void nu_push_input_event(nu_Window *window, nu_InputEvent event) {
+  nu_InputQueue *queue = &window->input_queue;
+  event.time_ns = nu_get_time_ns();
+  size_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+  if(head - tail >= NU_INPUT_QUEUE_SIZE) {
+    atomic_fetch_add_explicit(&queue->dropped, 1, memory_order_relaxed);
+    return;
+  }
+  queue->events[head & (NU_INPUT_QUEUE_SIZE - 1)] = event;
+  atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+}
+
+static void nu_apply_input_event(nu_Window *window, const nu_InputEvent *event) {
+  switch(event->type) {
+    case NU_INPUT_KEY:
+      if(event->code < 0 || event->code >= KEY_COUNT) break;
+      if(event->action == GLFW_PRESS) {
+        window->keys[event->code / 64] |= 1ull << (event->code % 64);
+        window->key_downs[event->code / 64] |= 1ull << (event->code % 64);
+      } else if(event->action == GLFW_RELEASE) {
+        window->keys[event->code / 64] &= ~(1ull << (event->code % 64));
+      }
+      break;
+    case NU_INPUT_MOUSE_BUTTON:
+      if(event->code == GLFW_MOUSE_BUTTON_LEFT) window->mouse_left = event->action == GLFW_PRESS;
+      if(event->code == GLFW_MOUSE_BUTTON_RIGHT) window->mouse_right = event->action == GLFW_PRESS;
+      break;
+    case NU_INPUT_CURSOR:
+      window->mouse_x = event->x;
+      window->mouse_y = event->y;
+      break;
+    case NU_INPUT_FOCUS:
+      break;
+  }
+}
+
+// Applies every queued event, and keeps them for nu_get_input_events
+static void nu_drain_input(nu_Window *window) {
+  nu_InputQueue *queue = &window->input_queue;
+  size_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+  if(tail == head) return;
+  for(; tail != head; tail++) {
+    const nu_InputEvent *event = &queue->events[tail & (NU_INPUT_QUEUE_SIZE - 1)];
+    nu_apply_input_event(window, event);
+    if(window->num_frame_events == window->frame_events_alloced) {
+      size_t alloced = window->frame_events_alloced ? window->frame_events_alloced * 2 : 64;
+      nu_InputEvent *grown = realloc(window->frame_events, alloced * sizeof(nu_InputEvent));
+      // Without room the event still counts towards the input state
+      if(!grown) continue;
+      window->frame_events = grown;
+      window->frame_events_alloced = alloced;
+    }
+    window->frame_events[window->num_frame_events++] = *event;
+  }
+  atomic_store_explicit(&queue->tail, tail, memory_order_release);
+}
+
+static void nu_init_input(nu_Window *window) {
+  atomic_init(&window->input_queue.head, 0);
+  atomic_init(&window->input_queue.tail, 0);
+  atomic_init(&window->input_queue.dropped, 0);
+  atomic_init(&window->input_thread, false);
+  pthread_mutex_init(&window->focus_mutex, NULL);
+  pthread_cond_init(&window->focus_changed, NULL);
+}
+
+// Frame pacing starts from window creation, with a guess at how late sleeps
+// wake that nu_wait_until refines
+static void nu_init_pacing(nu_Window *window) {
+  window->spin_ns = 1000000;
+  window->frame_start_ns = nu_get_time_ns();
+}
+
 // GLFW callbacks
 void framebuffer_size_callback(GLFWwindow *glfw_window, int width, int height) {
   if(!glfw_window) return;
@@ -17,32 +454,33 @@ void key_callback(GLFWwindow *glfw_window, int key, int scancode, int action, in
   if(!glfw_window) return;
   nu_Window *window = glfwGetWindowUserPointer(glfw_window);
   if(!window) return;
-  if(key >= 0 && key <= GLFW_KEY_LAST) {
-    window->keys[key] = (action != GLFW_RELEASE);
-  }
+  nu_push_input_event(window, (nu_InputEvent){.type = NU_INPUT_KEY, .code = key, .action = action, .mods = mods});
 }
 
 void cursor_pos_callback(GLFWwindow *glfw_window, double xpos, double ypos) {
   if(!glfw_window) return;
   nu_Window *window = glfwGetWindowUserPointer(glfw_window);
   if(!window) return;
-  window->mouse_x = xpos;
-  window->mouse_y = ypos;
+  nu_push_input_event(window, (nu_InputEvent){.type = NU_INPUT_CURSOR, .x = xpos, .y = ypos});
 }
 
 void mouse_button_callback(GLFWwindow* glfw_window, int button, int action, int mods) {
   if(!glfw_window) return;
   nu_Window *window = glfwGetWindowUserPointer(glfw_window);
   if(!window) return;
-  if (button == GLFW_MOUSE_BUTTON_LEFT) window->mouse_left = action == GLFW_PRESS; 
-  if (button == GLFW_MOUSE_BUTTON_RIGHT) window->mouse_right = action == GLFW_PRESS; 
+  nu_push_input_event(window, (nu_InputEvent){.type = NU_INPUT_MOUSE_BUTTON, .code = button, .action = action, .mods = mods});
 }
 
 void window_focus_callback(GLFWwindow *glfw_window, int focus) {
   if(!glfw_window) return;
   nu_Window *window = glfwGetWindowUserPointer(glfw_window);
   if(!window) return;
+  // Focus is read by nu_end_frame, which may be waiting on it
+  pthread_mutex_lock(&window->focus_mutex);
   window->focused = focus == GLFW_TRUE;
+  pthread_cond_broadcast(&window->focus_changed);
+  pthread_mutex_unlock(&window->focus_mutex);
+  nu_push_input_event(window, (nu_InputEvent){.type = NU_INPUT_FOCUS, .action = focus});
 }
 
 nu_Window *nu_create_window(size_t width, size_t height, const char *title, bool fullscreen) {
@@ -85,10 +523,14 @@ nu_Window *nu_create_window(size_t width, size_t height, const char *title, bool
     glfwTerminate();
     return NULL;
   }
+  // New context, nothing is known about its bindings
+  nu_reset_state_cache();
   result->glfw_window = glfw_window;
   result->width = width;
   result->height = height;
   result->focused = true;
+  nu_init_input(result);
+  nu_init_pacing(result);
   glfwSetWindowUserPointer(glfw_window, (void*)result);
   // Set window callbacks
   glfwSetFramebufferSizeCallback(result->glfw_window, framebuffer_size_callback);
@@ -99,6 +541,133 @@ nu_Window *nu_create_window(size_t width, size_t height, const char *title, bool
   return result;
 }
 
+#ifdef NUGL_HEADLESS
+static bool nu_create_framebuffer(nu_Window *window) {
+  glGenFramebuffers(1, &window->fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, window->fbo);
+  glGenRenderbuffers(1, &window->fbo_color);
+  glBindRenderbuffer(GL_RENDERBUFFER, window->fbo_color);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, window->width, window->height);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, window->fbo_color);
+  glGenRenderbuffers(1, &window->fbo_depth);
+  glBindRenderbuffer(GL_RENDERBUFFER, window->fbo_depth);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, window->width, window->height);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, window->fbo_depth);
+  glBindRenderbuffer(GL_RENDERBUFFER, 0);
+  // Leave the FBO bound, everything renders into it
+  glViewport(0, 0, window->width, window->height);
+  return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+}
+
+static void nu_destroy_framebuffer(nu_Window *window) {
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  if(window->fbo) glDeleteFramebuffers(1, &window->fbo);
+  if(window->fbo_color) glDeleteRenderbuffers(1, &window->fbo_color);
+  if(window->fbo_depth) glDeleteRenderbuffers(1, &window->fbo_depth);
+  window->fbo = window->fbo_color = window->fbo_depth = 0;
+}
+
+static void nu_destroy_egl_context(EGLDisplay display, EGLContext context) {
+  eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  if(context != EGL_NO_CONTEXT) eglDestroyContext(display, context);
+  eglTerminate(display);
+}
+
+nu_Window *nu_create_headless_window(size_t width, size_t height) {
+  if(width == 0 || height == 0) {
+    fprintf(stderr, "(nu_create_headless_window): Error creating window, size was 0.\n");
+    return NULL;
+  }
+  // Prefer the surfaceless platform, so no X server or GPU is needed
+  EGLDisplay display = EGL_NO_DISPLAY;
+  PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+  if(get_platform_display) display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+  if(display == EGL_NO_DISPLAY) display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  if(display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+    fprintf(stderr, "(nu_create_headless_window): Error creating window, couldn't initialise an EGL display.\n");
+    return NULL;
+  }
+  if(!eglBindAPI(EGL_OPENGL_API)) {
+    fprintf(stderr, "(nu_create_headless_window): Error creating window, EGL doesn't support desktop OpenGL.\n");
+    eglTerminate(display);
+    return NULL;
+  }
+  // Surfaceless displays only expose pbuffer configs, the default is window
+  const EGLint config_attribs[] = {
+    EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_NONE
+  };
+  EGLConfig config;
+  EGLint num_configs = 0;
+  if(!eglChooseConfig(display, config_attribs, &config, 1, &num_configs) || num_configs == 0) {
+    fprintf(stderr, "(nu_create_headless_window): Error creating window, eglChooseConfig() found no config.\n");
+    eglTerminate(display);
+    return NULL;
+  }
+  const EGLint context_attribs[] = {
+    EGL_CONTEXT_MAJOR_VERSION, 3,
+    EGL_CONTEXT_MINOR_VERSION, 3,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+    EGL_NONE
+  };
+  EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+  if(context == EGL_NO_CONTEXT) {
+    fprintf(stderr, "(nu_create_headless_window): Error creating window, eglCreateContext() failed.\n");
+    eglTerminate(display);
+    return NULL;
+  }
+  // Surfaceless: no default framebuffer, we render into our own FBO
+  if(!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+    fprintf(stderr, "(nu_create_headless_window): Error creating window, eglMakeCurrent() failed.\n");
+    nu_destroy_egl_context(display, context);
+    return NULL;
+  }
+
+  // Initialise glew. A GLX-only glew reports no display here, which is fine
+  glewExperimental = GL_TRUE;
+  int glew_res = glewInit();
+  if(glew_res != GLEW_OK && glew_res != GLEW_ERROR_NO_GLX_DISPLAY) {
+    fprintf(stderr, "(nu_create_headless_window): Error creating window, glewInit() did not return GLEW_OK.\n");
+    nu_destroy_egl_context(display, context);
+    return NULL;
+  }
+
+  nu_Window *result = calloc(1, sizeof(nu_Window));
+  if(!result) {
+    fprintf(stderr, "(nu_create_headless_window): Error creating window, calloc() failed.\n");
+    nu_destroy_egl_context(display, context);
+    return NULL;
+  }
+  nu_reset_state_cache();
+  result->glfw_window = NULL;
+  result->width = width;
+  result->height = height;
+  result->focused = true;
+  nu_init_input(result);
+  nu_init_pacing(result);
+  result->headless = true;
+  result->egl_display = display;
+  result->egl_context = context;
+  result->egl_config = config;
+  if(!nu_create_framebuffer(result)) {
+    fprintf(stderr, "(nu_create_headless_window): Error creating window, framebuffer is incomplete.\n");
+    nu_destroy_framebuffer(result);
+    nu_destroy_egl_context(display, context);
+    free(result);
+    return NULL;
+  }
+  return result;
+}
+#else
+nu_Window *nu_create_headless_window(size_t width, size_t height) {
+  (void)width;
+  (void)height;
+  fprintf(stderr, "(nu_create_headless_window): Error creating window, nuGL was built without NUGL_HEADLESS.\n");
+  return NULL;
+}
+#endif
+
 void nu_destroy_window(nu_Window **window) {
   if(!window || !(*window)) return;
   if((*window)->glfw_window) {
@@ -106,10 +675,30 @@ void nu_destroy_window(nu_Window **window) {
     glfwTerminate();
   }
   (*window)->glfw_window = NULL;
+  if((*window)->headless) {
+#ifdef NUGL_HEADLESS
+    nu_destroy_framebuffer(*window);
+    nu_destroy_egl_context((*window)->egl_display, (*window)->egl_context);
+#endif
+    (*window)->egl_display = NULL;
+    (*window)->egl_context = NULL;
+    (*window)->egl_config = NULL;
+  }
+  pthread_mutex_destroy(&(*window)->focus_mutex);
+  pthread_cond_destroy(&(*window)->focus_changed);
+  free((*window)->frame_events);
+  free((*window)->counter_log);
+  if(nu_counters == &(*window)->counters) nu_counters = &nu_unattached_counters;
   free(*window);
   *window = NULL;
 }
 
+void nu_read_pixels(nu_Window *window, void *out) {
+  if(!window || !out) return;
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glReadPixels(0, 0, window->width, window->height, GL_RGBA, GL_UNSIGNED_BYTE, out);
+}
+
 // Shader programs
 static char *nu_read_file(const char *file_loc) {
   if(!file_loc) return NULL;
@@ -175,202 +764,460 @@ static GLenum nu_get_shader_type(const char *filename) {
   return shader_type;
 }
 
-static GLuint nu_compile_shader(const char *shader_loc) {
-  if(!shader_loc) return 0;
+// Shader reloading
+// On Linux, an inotify instance watching the directory of every shader
+// file read. Elsewhere, the modification time of every shader file read
+static bool nu_shader_reload_enabled = false;
+#ifdef __linux__
+static int nu_inotify_fd = -1;
+typedef struct {
+  int wd;
+  char *dir;
+} nu_WatchedDir;
+static nu_WatchedDir *nu_watched_dirs = NULL;
+static size_t nu_num_watched_dirs = 0;
+#else
+typedef struct {
+  char *path;
+  time_t mtime;
+} nu_WatchedFile;
+static nu_WatchedFile *nu_watched_files = NULL;
+static size_t nu_num_watched_files = 0;
+#endif
 
-  // Detect shader type
-  GLenum shader_type = nu_get_shader_type(shader_loc);
-  if(shader_type == 0) {
-    fprintf(stderr, "(nu_compile_shader): Couldn't compile shader \"%s\", invalid filename.\n", shader_loc);
-    return 0;
+// Starts watching a shader file for changes
+static void nu_watch_shader_file(const char *path) {
+#ifdef __linux__
+  // Editors often save by replacing the file, so watch its directory
+  const char *slash = strrchr(path, '/');
+  if(!slash) return;
+  size_t dir_len = slash == path ? 1 : (size_t)(slash - path);
+  for(size_t i = 0; i < nu_num_watched_dirs; i++) {
+    if(strlen(nu_watched_dirs[i].dir) == dir_len && strncmp(nu_watched_dirs[i].dir, path, dir_len) == 0) return;
   }
-
-  // Read the shader's source code
-  char *shader_source = nu_read_file(shader_loc);
-  if(!shader_source) {
-    fprintf(stderr, "(nu_compile_shader): Couldn't compile shader \"%s\", nu_read_file() returned NULL.\n", shader_loc);
-    return 0;
+  nu_WatchedDir *new = realloc(nu_watched_dirs, (nu_num_watched_dirs + 1) * sizeof(nu_WatchedDir));
+  if(!new) return;
+  nu_watched_dirs = new;
+  char *dir = strndup(path, dir_len);
+  if(!dir) return;
+  int wd = inotify_add_watch(nu_inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+  if(wd < 0) {
+    fprintf(stderr, "(nu_watch_shader_file): Couldn't watch directory %s, inotify_add_watch failed.\n", dir);
+    free(dir);
+    return;
+  }
+  nu_watched_dirs[nu_num_watched_dirs++] = (nu_WatchedDir) {.wd = wd, .dir = dir};
+#else
+  for(size_t i = 0; i < nu_num_watched_files; i++) {
+    if(strcmp(nu_watched_files[i].path, path) == 0) return;
   }
+  struct stat st;
+  if(stat(path, &st) != 0) return;
+  nu_WatchedFile *new = realloc(nu_watched_files, (nu_num_watched_files + 1) * sizeof(nu_WatchedFile));
+  if(!new) return;
+  nu_watched_files = new;
+  char *path_copy = strdup(path);
+  if(!path_copy) return;
+  nu_watched_files[nu_num_watched_files++] = (nu_WatchedFile) {.path = path_copy, .mtime = st.st_mtime};
+#endif
+}
 
-  // Create the shader
-  GLuint shader = glCreateShader(shader_type);
-  const GLint source_len = (const GLint) strlen(shader_source);
-  const GLchar *source_ptr = shader_source;
-  glShaderSource(shader, 1, &source_ptr, &source_len);
-  free(shader_source);
+// Shader source cache
+// Shader files with their #includes expanded, kept until one of the files
+// they were built from changes
+typedef struct {
+  char *path;
+  char *source;
+  // Every file the expanded source came from, the shader file first, and a
+  // stamp of each one's size and modification time when it was read
+  size_t num_deps;
+  char **deps;
+  uint64_t *dep_stamps;
+} nu_ShaderSource;
 
-  // Compile, check for errors
-  glCompileShader(shader);
-  GLint success = 0;
-  glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+static nu_ShaderSource *nu_shader_sources = NULL;
+static size_t nu_num_shader_sources = 0, nu_shader_sources_alloced = 0;
 
-  if(success == GL_FALSE) {
-    fprintf(stderr, "(nu_compile_shader): Couldn't compile shader \"%s\", compilation failed.\n", shader_loc);
-    GLint logSize = 0;
-    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logSize);
-    char *err_msg = calloc(logSize, sizeof(char));
-    if(!err_msg) {
-      glDeleteShader(shader);
-      return 0;
-    }
-    glGetShaderInfoLog(shader, logSize, &logSize, err_msg);
-    glDeleteShader(shader);
-    fprintf(stderr, "%s", err_msg);
-    free(err_msg);
-    return 0;
+// Stamp of a file's size and modification time, 0 if it doesn't exist
+static uint64_t nu_file_stamp(const char *path) {
+  struct stat st;
+  if(stat(path, &st) != 0) return 0;
+  uint64_t stamp = (uint64_t)st.st_mtime * 1000000007ull ^ (uint64_t)st.st_size;
+#ifdef __linux__
+  stamp = stamp * 31 + (uint64_t)st.st_mtim.tv_nsec;
+#endif
+  return stamp ? stamp : 1;
+}
+
+// Growable string for expanding sources
+typedef struct {
+  char *data;
+  size_t len, alloced;
+} nu_StringBuilder;
+
+static bool nu_string_append(nu_StringBuilder *string, const char *src, size_t len) {
+  if(string->len + len + 1 > string->alloced) {
+    size_t new_alloced = string->alloced ? string->alloced : 256;
+    while(string->len + len + 1 > new_alloced) new_alloced *= 2;
+    char *new = realloc(string->data, new_alloced);
+    if(!new) return false;
+    string->data = new;
+    string->alloced = new_alloced;
   }
-  return shader;
+  memcpy(string->data + string->len, src, len);
+  string->len += len;
+  string->data[string->len] = '\0';
+  return true;
 }
 
-nu_Program *nu_create_program(size_t num_shaders, ...) {
-  if(num_shaders == 0) return 0;
-  GLuint *shaders = calloc(num_shaders, sizeof(GLuint));
-  if(!shaders) {
-    fprintf(stderr, "(nu_create_program): Couldn't create shader program, calloc failed.\n"); 
-    return 0;
+// Resolves a path to an absolute one without . or .. parts, so every
+// spelling of a file matches. Returns a new string, or NULL
+static char *nu_canonical_path(const char *path) {
+#ifdef _WIN32
+  return _fullpath(NULL, path, 0);
+#else
+  return realpath(path, NULL);
+#endif
+}
+
+// Includes resolve relative to the including file's directory
+static char *nu_include_path(const char *including_path, const char *name, size_t name_len) {
+  const char *slash = strrchr(including_path, '/');
+  size_t dir_len = slash ? (size_t)(slash - including_path) + 1 : 0;
+  char *joined = malloc(dir_len + name_len + 1);
+  if(!joined) return NULL;
+  memcpy(joined, including_path, dir_len);
+  memcpy(joined + dir_len, name, name_len);
+  joined[dir_len + name_len] = '\0';
+  return joined;
+}
+
+#define NU_MAX_INCLUDE_DEPTH 32
+
+// Appends a file to out with its #include "file" lines replaced by the
+// file's contents, recording every file read in deps. Each file is included
+// at most once per shader, so shared headers need no include guards
+static bool nu_expand_shader(const char *path, size_t depth, nu_StringBuilder *out, nu_ShaderSource *entry) {
+  if(depth > NU_MAX_INCLUDE_DEPTH) {
+    fprintf(stderr, "(nu_expand_shader): Couldn't expand \"%s\", #includes are nested more than %d deep.\n", path, NU_MAX_INCLUDE_DEPTH);
+    return false;
   }
-  va_list args;
-  va_start(args, num_shaders);
-  for(size_t i = 0; i < num_shaders; i++) {
-    const char *shader_loc = va_arg(args, const char *);
-    shaders[i] = nu_compile_shader(shader_loc);
-    if(shaders[i] == 0) {
-      fprintf(stderr, "(nu_create_program): Couldn't create shader program, compilation of shader \"%s\" failed.\n", shader_loc);
-      // Free all other shaders on failure to compile
-      for(size_t j = 0; j < i; j++) {
-        glDeleteShader(shaders[j]);
+  char *canonical = nu_canonical_path(path);
+  if(!canonical) {
+    fprintf(stderr, "(nu_expand_shader): Couldn't read file %s, it doesn't exist.\n", path);
+    return false;
+  }
+  for(size_t i = 0; i < entry->num_deps; i++) {
+    if(strcmp(entry->deps[i], canonical) == 0) {
+      free(canonical);
+      return true;
+    }
+  }
+  char **new_deps = realloc(entry->deps, (entry->num_deps + 1) * sizeof(char *));
+  if(new_deps) entry->deps = new_deps;
+  uint64_t *new_stamps = realloc(entry->dep_stamps, (entry->num_deps + 1) * sizeof(uint64_t));
+  if(new_stamps) entry->dep_stamps = new_stamps;
+  if(!new_deps || !new_stamps) {
+    free(canonical);
+    return false;
+  }
+  entry->deps[entry->num_deps] = canonical;
+  entry->dep_stamps[entry->num_deps++] = nu_file_stamp(canonical);
+
+  char *source = nu_read_file(canonical);
+  if(!source) return false;
+  bool expanded = true;
+  size_t line = 1;
+  for(char *p = source; *p && expanded; line++) {
+    char *end = strchr(p, '\n');
+    size_t line_len = end ? (size_t)(end - p) + 1 : strlen(p);
+    char *directive = p;
+    while(*directive == ' ' || *directive == '\t') directive++;
+    if(strncmp(directive, "#include", 8) == 0) {
+      char *name = directive + 8;
+      while(*name == ' ' || *name == '\t') name++;
+      char close = *name == '"' ? '"' : (*name == '<' ? '>' : 0);
+      char *name_end = close ? memchr(name + 1, close, line_len - (name + 1 - p)) : NULL;
+      if(!name_end) {
+        fprintf(stderr, "(nu_expand_shader): Couldn't expand \"%s\", malformed #include on line %zu.\n", canonical, line);
+        expanded = false;
+        break;
       }
-      va_end(args);
-      free(shaders);
-      return NULL;
+      char *include = nu_include_path(canonical, name + 1, name_end - (name + 1));
+      // #line keeps compiler errors pointing at the right line of each file
+      char line_directive[32];
+      expanded = include && nu_string_append(out, "#line 1\n", 8) && nu_expand_shader(include, depth + 1, out, entry);
+      snprintf(line_directive, sizeof(line_directive), "\n#line %zu\n", line + 1);
+      expanded = expanded && nu_string_append(out, line_directive, strlen(line_directive));
+      free(include);
+    } else {
+      expanded = nu_string_append(out, p, line_len);
     }
+    p += line_len;
   }
-  va_end(args);
-  // Create program, attach shaders, link
-  GLuint shader_program = glCreateProgram();
-  for(size_t i = 0; i < num_shaders; i++) {
-    glAttachShader(shader_program, shaders[i]);
+  free(source);
+  return expanded;
+}
+
+static void nu_free_shader_source(nu_ShaderSource *entry) {
+  for(size_t i = 0; i < entry->num_deps; i++) free(entry->deps[i]);
+  free(entry->deps);
+  free(entry->dep_stamps);
+  free(entry->path);
+  free(entry->source);
+}
+
+// Returns a shader file's source with #includes expanded, from the cache if
+// it's there. The source stays owned by the cache
+static const char *nu_get_shader_source(const char *shader_loc) {
+  char *canonical = nu_canonical_path(shader_loc);
+  if(!canonical) {
+    fprintf(stderr, "(nu_get_shader_source): Couldn't read file %s, it doesn't exist.\n", shader_loc);
+    return NULL;
   }
-  glLinkProgram(shader_program);
-  // Detach and delete shaders after linking
-  for(size_t i = 0; i < num_shaders; i++) {
-    glDetachShader(shader_program, shaders[i]);
-    glDeleteShader(shaders[i]);
+  for(size_t i = 0; i < nu_num_shader_sources; i++) {
+    if(strcmp(nu_shader_sources[i].path, canonical) != 0) continue;
+    // Files can change without reloading enabled, so check none has
+    bool stale = false;
+    for(size_t d = 0; d < nu_shader_sources[i].num_deps && !stale; d++) {
+      stale = nu_file_stamp(nu_shader_sources[i].deps[d]) != nu_shader_sources[i].dep_stamps[d];
+    }
+    if(!stale) {
+      free(canonical);
+      return nu_shader_sources[i].source;
+    }
+    nu_free_shader_source(&nu_shader_sources[i]);
+    nu_shader_sources[i] = nu_shader_sources[--nu_num_shader_sources];
+    break;
   }
-  free(shaders);
-  // Check for error
-  GLint success = 0;
-  glGetProgramiv(shader_program, GL_LINK_STATUS, &success);
-  if(success == GL_FALSE) {
-    GLint logSize = 0; 
-    glGetProgramiv(shader_program, GL_INFO_LOG_LENGTH, &logSize);
-    char *err_msg = calloc(logSize, sizeof(char));
-    if(!err_msg) {
-      glDeleteProgram(shader_program);
+  if(nu_num_shader_sources == nu_shader_sources_alloced) {
+    size_t new_alloced = nu_shader_sources_alloced ? nu_shader_sources_alloced * 2 : 16;
+    nu_ShaderSource *new = realloc(nu_shader_sources, new_alloced * sizeof(nu_ShaderSource));
+    if(!new) {
+      fprintf(stderr, "(nu_get_shader_source): Couldn't cache shader %s, realloc failed.\n", shader_loc);
+      free(canonical);
       return NULL;
     }
-    glGetProgramInfoLog(shader_program, logSize, &logSize, err_msg);
-    glDeleteProgram(shader_program);
-    fprintf(stderr, "%s", err_msg);
-    free(err_msg);
-    return NULL;
+    nu_shader_sources = new;
+    nu_shader_sources_alloced = new_alloced;
   }
-  // Create nu_Program
-  nu_Program *program = calloc(1, sizeof(nu_Program));
-  if(!program) {
-    fprintf(stderr, "(nu_create_program): Couldn't create shader program, calloc failed.\n");
-    glDeleteProgram(shader_program);
+  nu_ShaderSource entry = {.path = canonical};
+  nu_StringBuilder out = {0};
+  if(!nu_expand_shader(canonical, 0, &out, &entry) || !out.data) {
+    entry.source = out.data;
+    nu_free_shader_source(&entry);
     return NULL;
   }
-  program->shader_program = shader_program;
-  // Uniforms list
-  program->uniforms = NULL;
-  program->num_uniforms = 0;
-  return program;
+  entry.source = out.data;
+  nu_shader_sources[nu_num_shader_sources++] = entry;
+  if(nu_shader_reload_enabled) {
+    for(size_t i = 0; i < entry.num_deps; i++) nu_watch_shader_file(entry.deps[i]);
+  }
+  return entry.source;
 }
 
-void nu_use_program(nu_Program *program) {
-  if(!program) return;
-  glUseProgram(program->shader_program);
+void nu_clear_shader_sources(void) {
+  for(size_t i = 0; i < nu_num_shader_sources; i++) nu_free_shader_source(&nu_shader_sources[i]);
+  free(nu_shader_sources);
+  nu_shader_sources = NULL;
+  nu_num_shader_sources = 0;
+  nu_shader_sources_alloced = 0;
 }
 
-void nu_register_uniform(nu_Program *program, const char *name, GLenum type) {
-  if(!program || !program->shader_program) return;
-  nu_use_program(program);
-  GLint loc = glGetUniformLocation(program->shader_program, name);
-  if(loc == -1) {
-    fprintf(stderr, "(nu_register_uniform): Uniform \"%s\" not found in shader program.\n", name);
+static void nu_watch_shader_sources(void) {
+  for(size_t i = 0; i < nu_num_shader_sources; i++) {
+    for(size_t d = 0; d < nu_shader_sources[i].num_deps; d++) nu_watch_shader_file(nu_shader_sources[i].deps[d]);
+  }
+}
+
+static void nu_stop_watching_shaders(void) {
+#ifdef __linux__
+  for(size_t i = 0; i < nu_num_watched_dirs; i++) free(nu_watched_dirs[i].dir);
+  free(nu_watched_dirs);
+  nu_watched_dirs = NULL;
+  nu_num_watched_dirs = 0;
+  // Closing the instance removes its watches
+  if(nu_inotify_fd >= 0) close(nu_inotify_fd);
+  nu_inotify_fd = -1;
+#else
+  for(size_t i = 0; i < nu_num_watched_files; i++) free(nu_watched_files[i].path);
+  free(nu_watched_files);
+  nu_watched_files = NULL;
+  nu_num_watched_files = 0;
+#endif
+}
+
+void nu_enable_shader_reload(bool enable) {
+  if(enable == nu_shader_reload_enabled) return;
+  if(!enable) {
+    nu_stop_watching_shaders();
+    nu_shader_reload_enabled = false;
     return;
   }
-  if(program->num_uniforms == 0 || !program->uniforms) {
-    program->num_uniforms = 1;
-    program->uniforms = calloc(program->num_uniforms, sizeof(nu_Uniform)); 
-    if(!program->uniforms) {
-      fprintf(stderr, "(nu_register_uniform): Couldn't register uniform \"%s\", calloc failed.\n", name);
-      return;
-    }
-    program->uniforms[0] = (nu_Uniform) {
-      .name = strdup(name),
-      .location = loc,
-      .type = type
-    };
-  } else {
-    nu_Uniform *new = realloc(program->uniforms, sizeof(nu_Uniform) * (program->num_uniforms + 1));
-    if(!new) {
-      fprintf(stderr, "(nu_register_uniform): Couldn't register uniform \"%s\", realloc failed.\n", name);
+#ifdef __linux__
+  nu_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if(nu_inotify_fd < 0) {
+    fprintf(stderr, "(nu_enable_shader_reload): Couldn't enable shader reloading, inotify_init1 failed.\n");
+    return;
+  }
+#endif
+  nu_shader_reload_enabled = true;
+  nu_watch_shader_sources();
+}
+
+// Adds a path to a list of changed files, if it isn't there already
+static void nu_add_changed_file(char ***changed, size_t *num_changed, char *path) {
+  if(!path) return;
+  for(size_t i = 0; i < *num_changed; i++) {
+    if(strcmp((*changed)[i], path) == 0) {
+      free(path);
       return;
     }
-    program->uniforms = new;
-    program->uniforms[program->num_uniforms++] = (nu_Uniform) {
-      .name = strdup(name),
-      .location = loc,
-      .type = type
-    };
   }
+  char **new = realloc(*changed, (*num_changed + 1) * sizeof(char *));
+  if(!new) {
+    free(path);
+    return;
+  }
+  *changed = new;
+  (*changed)[(*num_changed)++] = path;
 }
 
-static nu_Uniform *nu_get_uniform(nu_Program *program, const char *uniform_name) {
-  if(!program || !uniform_name || !program->uniforms || program->num_uniforms == 0) return NULL;
-  for(size_t i = 0; i < program->num_uniforms; i++) {
-    if(program->uniforms[i].name) {
-      if(strcmp(program->uniforms[i].name, uniform_name) == 0) {
-        return &program->uniforms[i];
+// Collects the canonical paths of watched files changed since the last poll
+static size_t nu_collect_changed_files(char ***changed) {
+  size_t num_changed = 0;
+#ifdef __linux__
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+  while((len = read(nu_inotify_fd, buffer, sizeof(buffer))) > 0) {
+    for(char *p = buffer; p < buffer + len; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+      struct inotify_event *event = (struct inotify_event *)p;
+      if(event->len == 0) continue;
+      for(size_t i = 0; i < nu_num_watched_dirs; i++) {
+        if(nu_watched_dirs[i].wd != event->wd) continue;
+        size_t path_len = strlen(nu_watched_dirs[i].dir) + strlen(event->name) + 2;
+        char *path = malloc(path_len);
+        if(path) {
+          snprintf(path, path_len, "%s/%s", strcmp(nu_watched_dirs[i].dir, "/") == 0 ? "" : nu_watched_dirs[i].dir, event->name);
+          nu_add_changed_file(changed, &num_changed, path);
+        }
+        break;
       }
     }
   }
-  return NULL;
+#else
+  for(size_t i = 0; i < nu_num_watched_files; i++) {
+    struct stat st;
+    if(stat(nu_watched_files[i].path, &st) != 0 || st.st_mtime == nu_watched_files[i].mtime) continue;
+    nu_watched_files[i].mtime = st.st_mtime;
+    nu_add_changed_file(changed, &num_changed, strdup(nu_watched_files[i].path));
+  }
+#endif
+  return num_changed;
 }
 
-void nu_set_uniform(nu_Program *program, const char *uniform_name, void *data) {
-  if(!program || !uniform_name || !data) return;
-  nu_Uniform *uniform = nu_get_uniform(program, uniform_name);
-  if(!uniform) {
-    fprintf(stderr, "(nu_set_uniform): Couldn't set uniform \"%s\", uniform not registered in shader program.\n", uniform_name);
+// FNV-1a, continuing from a previous hash
+static uint64_t nu_hash_continue(uint64_t hash, const uint8_t *data, size_t len) {
+  for(size_t i = 0; i < len; i++) {
+    hash ^= data[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+static uint64_t nu_hash_bytes(const uint8_t *data, size_t len) {
+  return nu_hash_continue(14695981039346656037ull, data, len);
+}
+
+static uint64_t nu_hash_string(const char *string) {
+  return nu_hash_bytes((const uint8_t *)string, strlen(string));
+}
+
+static bool nu_is_sampler_type(GLenum type) {
+  switch(type) {
+    case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE:
+    case GL_SAMPLER_1D_SHADOW: case GL_SAMPLER_2D_SHADOW: case GL_SAMPLER_CUBE_SHADOW:
+    case GL_SAMPLER_1D_ARRAY: case GL_SAMPLER_2D_ARRAY:
+    case GL_SAMPLER_1D_ARRAY_SHADOW: case GL_SAMPLER_2D_ARRAY_SHADOW:
+    case GL_SAMPLER_2D_MULTISAMPLE: case GL_SAMPLER_2D_MULTISAMPLE_ARRAY:
+    case GL_SAMPLER_BUFFER: case GL_SAMPLER_2D_RECT: case GL_SAMPLER_2D_RECT_SHADOW:
+    case GL_INT_SAMPLER_1D: case GL_INT_SAMPLER_2D: case GL_INT_SAMPLER_3D: case GL_INT_SAMPLER_CUBE:
+    case GL_INT_SAMPLER_1D_ARRAY: case GL_INT_SAMPLER_2D_ARRAY:
+    case GL_INT_SAMPLER_2D_MULTISAMPLE: case GL_INT_SAMPLER_2D_MULTISAMPLE_ARRAY:
+    case GL_INT_SAMPLER_BUFFER: case GL_INT_SAMPLER_2D_RECT:
+    case GL_UNSIGNED_INT_SAMPLER_1D: case GL_UNSIGNED_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_3D:
+    case GL_UNSIGNED_INT_SAMPLER_CUBE: case GL_UNSIGNED_INT_SAMPLER_1D_ARRAY: case GL_UNSIGNED_INT_SAMPLER_2D_ARRAY:
+    case GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE: case GL_UNSIGNED_INT_SAMPLER_2D_MULTISAMPLE_ARRAY:
+    case GL_UNSIGNED_INT_SAMPLER_BUFFER: case GL_UNSIGNED_INT_SAMPLER_2D_RECT:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Bytes of data one element of a uniform of a type is set from, 0 if
+// unsupported
+static size_t nu_uniform_type_size(GLenum type) {
+  if(nu_is_sampler_type(type)) return sizeof(GLint);
+  switch(type) {
+    case GL_FLOAT: return sizeof(GLfloat);
+    case GL_FLOAT_VEC2: return 2 * sizeof(GLfloat);
+    case GL_FLOAT_VEC3: return 3 * sizeof(GLfloat);
+    case GL_FLOAT_VEC4: return 4 * sizeof(GLfloat);
+    case GL_INT: case GL_BOOL: return sizeof(GLint);
+    case GL_INT_VEC2: case GL_BOOL_VEC2: return 2 * sizeof(GLint);
+    case GL_INT_VEC3: case GL_BOOL_VEC3: return 3 * sizeof(GLint);
+    case GL_INT_VEC4: case GL_BOOL_VEC4: return 4 * sizeof(GLint);
+    case GL_UNSIGNED_INT: return sizeof(GLuint);
+    case GL_UNSIGNED_INT_VEC2: return 2 * sizeof(GLuint);
+    case GL_UNSIGNED_INT_VEC3: return 3 * sizeof(GLuint);
+    case GL_UNSIGNED_INT_VEC4: return 4 * sizeof(GLuint);
+    case GL_FLOAT_MAT2: return 4 * sizeof(GLfloat);
+    case GL_FLOAT_MAT3: return 9 * sizeof(GLfloat);
+    case GL_FLOAT_MAT4: return 16 * sizeof(GLfloat);
+    case GL_FLOAT_MAT2x3: case GL_FLOAT_MAT3x2: return 6 * sizeof(GLfloat);
+    case GL_FLOAT_MAT2x4: case GL_FLOAT_MAT4x2: return 8 * sizeof(GLfloat);
+    case GL_FLOAT_MAT3x4: case GL_FLOAT_MAT4x3: return 12 * sizeof(GLfloat);
+    default: return 0;
+  }
+}
+
+// Bytes of data a whole uniform (every array element) is set from
+static size_t nu_uniform_value_size(nu_Uniform *uniform) {
+  return nu_uniform_type_size(uniform->type) * (uniform->size > 0 ? uniform->size : 1);
+}
+
+// Uploads a uniform's value, the program must be in use
+static void nu_apply_uniform(nu_Uniform *uniform, void *data) {
+  GLint loc = uniform->location;
+  GLsizei count = uniform->size > 0 ? uniform->size : 1;
+  nu_counters->uniform_sets++;
+  if(nu_is_sampler_type(uniform->type)) {
+    glUniform1iv(loc, count, (GLint*)data);
     return;
   }
-  nu_use_program(program);
   switch (uniform->type) {
-    case GL_INT:
-      glUniform1i(uniform->location, *(int*)data);
-      break;
-    case GL_FLOAT:
-      glUniform1f(uniform->location, *(float*)data);
-      break;
-    case GL_FLOAT_VEC2:
-      glUniform2fv(uniform->location, 1, (float*)data);
-      break;
-    case GL_FLOAT_VEC3:
-      glUniform3fv(uniform->location, 1, (float*)data);
-      break;
-    case GL_FLOAT_VEC4:
-      glUniform4fv(uniform->location, 1, (float*)data);
-      break;
-    case GL_FLOAT_MAT3:
-      glUniformMatrix3fv(uniform->location, 1, GL_FALSE, (float*)data);
-      break;
-    case GL_FLOAT_MAT4:
-      glUniformMatrix4fv(uniform->location, 1, GL_FALSE, (float*)data);
-      break;
+    case GL_FLOAT: glUniform1fv(loc, count, (GLfloat*)data); break;
+    case GL_FLOAT_VEC2: glUniform2fv(loc, count, (GLfloat*)data); break;
+    case GL_FLOAT_VEC3: glUniform3fv(loc, count, (GLfloat*)data); break;
+    case GL_FLOAT_VEC4: glUniform4fv(loc, count, (GLfloat*)data); break;
+    case GL_INT: case GL_BOOL: glUniform1iv(loc, count, (GLint*)data); break;
+    case GL_INT_VEC2: case GL_BOOL_VEC2: glUniform2iv(loc, count, (GLint*)data); break;
+    case GL_INT_VEC3: case GL_BOOL_VEC3: glUniform3iv(loc, count, (GLint*)data); break;
+    case GL_INT_VEC4: case GL_BOOL_VEC4: glUniform4iv(loc, count, (GLint*)data); break;
+    case GL_UNSIGNED_INT: glUniform1uiv(loc, count, (GLuint*)data); break;
+    case GL_UNSIGNED_INT_VEC2: glUniform2uiv(loc, count, (GLuint*)data); break;
+    case GL_UNSIGNED_INT_VEC3: glUniform3uiv(loc, count, (GLuint*)data); break;
+    case GL_UNSIGNED_INT_VEC4: glUniform4uiv(loc, count, (GLuint*)data); break;
+    case GL_FLOAT_MAT2: glUniformMatrix2fv(loc, count, GL_FALSE, (GLfloat*)data); break;
+    case GL_FLOAT_MAT3: glUniformMatrix3fv(loc, count, GL_FALSE, (GLfloat*)data); break;
+    case GL_FLOAT_MAT4: glUniformMatrix4fv(loc, count, GL_FALSE, (GLfloat*)data); break;
+    case GL_FLOAT_MAT2x3: glUniformMatrix2x3fv(loc, count, GL_FALSE, (GLfloat*)data); break;
+    case GL_FLOAT_MAT3x2: glUniformMatrix3x2fv(loc, count, GL_FALSE, (GLfloat*)data); break;
+    case GL_FLOAT_MAT2x4: glUniformMatrix2x4fv(loc, count, GL_FALSE, (GLfloat*)data); break;
+    case GL_FLOAT_MAT4x2: glUniformMatrix4x2fv(loc, count, GL_FALSE, (GLfloat*)data); break;
+    case GL_FLOAT_MAT3x4: glUniformMatrix3x4fv(loc, count, GL_FALSE, (GLfloat*)data); break;
+    case GL_FLOAT_MAT4x3: glUniformMatrix4x3fv(loc, count, GL_FALSE, (GLfloat*)data); break;
     default:
       fprintf(stderr, "(nu_set_uniform): Unsupported uniform type %u\n", uniform->type);
       fprintf(stderr, "Set it yourself by using your (nu_Program *)->shader_program.\n");
@@ -378,327 +1225,4524 @@ void nu_set_uniform(nu_Program *program, const char *uniform_name, void *data) {
   }
 }
 
-void nu_destroy_program(nu_Program **program) {
-  if(!program || !(*program)) return;
-  if((*program)->shader_program) glDeleteProgram((*program)->shader_program);
-  if((*program)->uniforms) {
-    for(size_t i = 0; i < (*program)->num_uniforms; i++) {
-      if((*program)->uniforms[i].name) free((*program)->uniforms[i].name);
-      (*program)->uniforms[i].name = NULL;
-    }
-    free((*program)->uniforms);
+// Rebuilds a programs name -> handle table, kept at most half full
+static bool nu_build_uniform_table(nu_Program *program) {
+  size_t table_size = 8;
+  while(table_size < program->num_uniforms * 2) table_size *= 2;
+  int32_t *table = malloc(table_size * sizeof(int32_t));
+  if(!table) return false;
+  memset(table, 0xFF, table_size * sizeof(int32_t));
+  for(size_t i = 0; i < program->num_uniforms; i++) {
+    size_t slot = program->uniforms[i].hash & (table_size - 1);
+    while(table[slot] >= 0) slot = (slot + 1) & (table_size - 1);
+    table[slot] = (int32_t)i;
   }
+  if(program->uniform_table) free(program->uniform_table);
+  program->uniform_table = table;
+  program->uniform_table_size = table_size;
+  return true;
+}
+
+// Adds a uniform to a programs list, returning its handle or -1
+static int nu_add_uniform(nu_Program *program, const char *name, GLint location, GLenum type, GLint size) {
+  if(program->num_uniforms == program->uniforms_alloced) {
+    size_t new_alloced = program->uniforms_alloced ? program->uniforms_alloced * 2 : 8;
+    nu_Uniform *new = realloc(program->uniforms, new_alloced * sizeof(nu_Uniform));
+    if(!new) return -1;
+    program->uniforms = new;
+    program->uniforms_alloced = new_alloced;
+  }
+  char *name_copy = strdup(name);
+  if(!name_copy) return -1;
+  program->uniforms[program->num_uniforms] = (nu_Uniform) {
+    .name = name_copy,
+    .hash = nu_hash_string(name),
+    .location = location,
+    .type = type,
+    .size = size,
+    .value = NULL
+  };
+  int handle = (int)program->num_uniforms++;
+  if(program->num_uniforms * 2 > program->uniform_table_size) {
+    // Table too full, rebuild it bigger with the new uniform in it
+    if(!nu_build_uniform_table(program)) {
+      free(name_copy);
+      program->num_uniforms--;
+      return -1;
+    }
+    return handle;
+  }
+  size_t mask = program->uniform_table_size - 1;
+  size_t slot = program->uniforms[handle].hash & mask;
+  while(program->uniform_table[slot] >= 0) slot = (slot + 1) & mask;
+  program->uniform_table[slot] = handle;
+  return handle;
+}
+
+// Fills a programs uniform list with every active uniform outside of blocks
+static void nu_reflect_uniforms(nu_Program *program) {
+  GLint num_active = 0, max_name_len = 0;
+  glGetProgramiv(program->shader_program, GL_ACTIVE_UNIFORMS, &num_active);
+  glGetProgramiv(program->shader_program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_name_len);
+  if(num_active <= 0 || max_name_len <= 0) return;
+  char *name = calloc(max_name_len + 1, sizeof(char));
+  if(!name) {
+    fprintf(stderr, "(nu_reflect_uniforms): Couldn't reflect uniforms, calloc failed.\n");
+    return;
+  }
+  for(GLint i = 0; i < num_active; i++) {
+    GLint size = 0;
+    GLenum type = 0;
+    GLsizei name_len = 0;
+    glGetActiveUniform(program->shader_program, i, max_name_len + 1, &name_len, &size, &type, name);
+    // Members of uniform blocks have no location
+    GLint loc = glGetUniformLocation(program->shader_program, name);
+    if(loc == -1) continue;
+    // Arrays are reported as "name[0]", look them up by "name"
+    if(name_len > 3 && strcmp(name + name_len - 3, "[0]") == 0) name[name_len - 3] = '\0';
+    if(nu_add_uniform(program, name, loc, type, size) < 0) {
+      fprintf(stderr, "(nu_reflect_uniforms): Couldn't add uniform \"%s\", allocation failed.\n", name);
+    }
+  }
+  free(name);
+}
+
+// Live programs and uniform blocks, so blocks can be bound to programs
+// whichever is created first. A blocks binding point is its index here
+static nu_Program **nu_programs = NULL;
+static size_t nu_num_programs = 0, nu_programs_alloced = 0;
+static nu_UniformBlock **nu_blocks = NULL;
+static size_t nu_blocks_alloced = 0;
+static bool nu_blocks_dirty = false;
+
+// Points a programs uniform block of the same name at a blocks binding
+static void nu_bind_program_block(nu_Program *program, nu_UniformBlock *block) {
+  GLuint index = glGetUniformBlockIndex(program->shader_program, block->name);
+  if(index == GL_INVALID_INDEX) return;
+  GLint gl_size = 0;
+  glGetActiveUniformBlockiv(program->shader_program, index, GL_UNIFORM_BLOCK_DATA_SIZE, &gl_size);
+  if((size_t)gl_size > block->size) {
+    fprintf(stderr, "(nu_bind_program_block): Uniform block \"%s\" is %d bytes in the shader but %zu declared, is it layout(std140)?\n", block->name, gl_size, block->size);
+    return;
+  }
+  glUniformBlockBinding(program->shader_program, index, block->binding);
+}
+
+static void nu_add_program(nu_Program *program) {
+  if(nu_num_programs == nu_programs_alloced) {
+    size_t new_alloced = nu_programs_alloced ? nu_programs_alloced * 2 : 16;
+    nu_Program **new = realloc(nu_programs, new_alloced * sizeof(nu_Program *));
+    if(!new) {
+      fprintf(stderr, "(nu_add_program): Couldn't track program, realloc failed. Uniform blocks created later won't be bound to it.\n");
+      return;
+    }
+    nu_programs = new;
+    nu_programs_alloced = new_alloced;
+  }
+  nu_programs[nu_num_programs++] = program;
+  for(size_t i = 0; i < nu_blocks_alloced; i++) {
+    if(nu_blocks[i]) nu_bind_program_block(program, nu_blocks[i]);
+  }
+}
+
+static void nu_remove_program(nu_Program *program) {
+  for(size_t i = 0; i < nu_num_programs; i++) {
+    if(nu_programs[i] == program) {
+      nu_programs[i] = nu_programs[--nu_num_programs];
+      return;
+    }
+  }
+}
+
+// Program binary cache, disabled while nu_program_cache_dir is NULL
+static char *nu_program_cache_dir = NULL;
+static nu_ProgramCacheStats nu_program_cache_stats = {0};
+
+// Header of a cached program binary file, followed by length bytes of binary
+typedef struct {
+  char magic[4];
+  uint32_t format;
+  uint64_t key;
+  uint32_t length;
+} nu_ProgramCacheHeader;
+
+void nu_set_program_cache_dir(const char *dir) {
+  if(nu_program_cache_dir) free(nu_program_cache_dir);
+  nu_program_cache_dir = NULL;
+  if(!dir) return;
+  if(!GLEW_ARB_get_program_binary) {
+    fprintf(stderr, "(nu_set_program_cache_dir): Couldn't enable the program cache, ARB_get_program_binary isn't supported.\n");
+    return;
+  }
+  GLint num_formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_formats);
+  if(num_formats <= 0) {
+    fprintf(stderr, "(nu_set_program_cache_dir): Couldn't enable the program cache, the driver has no program binary formats.\n");
+    return;
+  }
+  nu_program_cache_dir = strdup(dir);
+}
+
+nu_ProgramCacheStats nu_get_program_cache_stats(void) {
+  return nu_program_cache_stats;
+}
+
+// Cache key of a program: its stages and sources, and the driver that
+// compiled it, since binaries are only valid for the same driver
+static uint64_t nu_program_cache_key(size_t num_shaders, const GLenum *types, const char **sources) {
+  uint64_t hash = nu_hash_bytes((const uint8_t *)"nuGL program", 12);
+  const GLenum driver_strings[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+  for(size_t i = 0; i < sizeof(driver_strings) / sizeof(driver_strings[0]); i++) {
+    const char *string = (const char *)glGetString(driver_strings[i]);
+    if(string) hash = nu_hash_continue(hash, (const uint8_t *)string, strlen(string) + 1);
+  }
+  for(size_t i = 0; i < num_shaders; i++) {
+    hash = nu_hash_continue(hash, (const uint8_t *)&types[i], sizeof(types[i]));
+    hash = nu_hash_continue(hash, (const uint8_t *)sources[i], strlen(sources[i]) + 1);
+  }
+  return hash;
+}
+
+static void nu_program_cache_path(char *out, size_t out_size, uint64_t key) {
+  snprintf(out, out_size, "%s/%016llx.nubin", nu_program_cache_dir, (unsigned long long)key);
+}
+
+// Creates a program from a cached binary, or returns 0 if there is no
+// usable one
+static GLuint nu_load_cached_program(uint64_t key) {
+  char path[4096];
+  nu_program_cache_path(path, sizeof(path), key);
+  FILE *file = fopen(path, "rb");
+  if(!file) return 0;
+  nu_ProgramCacheHeader header;
+  void *binary = NULL;
+  bool valid = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "NUPB", 4) == 0 && header.key == key && header.length > 0;
+  if(valid) {
+    binary = malloc(header.length);
+    valid = binary && fread(binary, 1, header.length, file) == header.length;
+  }
+  fclose(file);
+  if(!valid) {
+    free(binary);
+    return 0;
+  }
+  GLuint shader_program = glCreateProgram();
+  glProgramBinary(shader_program, header.format, binary, header.length);
+  free(binary);
+  // Drivers reject binaries after an update, or from other hardware
+  GLint success = 0;
+  glGetProgramiv(shader_program, GL_LINK_STATUS, &success);
+  if(success == GL_FALSE) {
+    glDeleteProgram(shader_program);
+    nu_program_cache_stats.rejected++;
+    return 0;
+  }
+  nu_count_objects(NU_GPU_PROGRAM, 1, 0);
+  return shader_program;
+}
+
+static void nu_store_cached_program(uint64_t key, GLuint shader_program) {
+  GLint length = 0;
+  glGetProgramiv(shader_program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if(length <= 0) return;
+  void *binary = malloc(length);
+  if(!binary) return;
+  nu_ProgramCacheHeader header = {.magic = {'N', 'U', 'P', 'B'}, .key = key};
+  GLenum format = 0;
+  GLsizei written = 0;
+  glGetProgramBinary(shader_program, length, &written, &format, binary);
+  header.format = format;
+  header.length = (uint32_t)written;
+  char path[4096];
+  nu_program_cache_path(path, sizeof(path), key);
+  FILE *file = written > 0 ? fopen(path, "wb") : NULL;
+  if(!file) {
+    if(written > 0) fprintf(stderr, "(nu_store_cached_program): Couldn't write program cache file %s, fopen returned NULL.\n", path);
+    free(binary);
+    return;
+  }
+  bool stored = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(binary, 1, written, file) == (size_t)written;
+  // A short file would only be rejected on load, remove it now
+  if(fclose(file) != 0 || !stored) {
+    fprintf(stderr, "(nu_store_cached_program): Couldn't write program cache file %s, fwrite failed.\n", path);
+    remove(path);
+  } else {
+    nu_program_cache_stats.stored++;
+  }
+  free(binary);
+}
+
+// Whether the driver can compile on its own threads, see nu_program_ready
+static bool nu_parallel_compile_enabled = false;
+
+static bool nu_parallel_compile_supported(void) {
+  return GLEW_KHR_parallel_shader_compile || GLEW_ARB_parallel_shader_compile;
+}
+
+// Starts building a programs GL program from its shader_locs, going through
+// the program cache when it's enabled. Shaders are compiled and linked
+// without waiting for the driver, nu_finish_program waits. Returns false if
+// the sources couldn't be read
+static bool nu_submit_program(nu_Program *program) {
+  size_t num_shaders = program->num_shaders;
+  GLenum *types = calloc(num_shaders, sizeof(GLenum));
+  const char **sources = calloc(num_shaders, sizeof(const char *));
+  program->pending_shaders = calloc(num_shaders, sizeof(GLuint));
+  bool submitted = false;
+  if(!types || !sources || !program->pending_shaders) {
+    fprintf(stderr, "(nu_create_program): Couldn't create shader program, calloc failed.\n");
+    goto cleanup;
+  }
+  // Sources are read up front, the cache key needs all of them
+  for(size_t i = 0; i < num_shaders; i++) {
+    types[i] = nu_get_shader_type(program->shader_locs[i]);
+    sources[i] = types[i] ? nu_get_shader_source(program->shader_locs[i]) : NULL;
+    if(!sources[i]) {
+      fprintf(stderr, "(nu_create_program): Couldn't create shader program, reading shader \"%s\" failed.\n", program->shader_locs[i]);
+      goto cleanup;
+    }
+  }
+  submitted = true;
+  program->cache_key = 0;
+  if(nu_program_cache_dir) {
+    program->cache_key = nu_program_cache_key(num_shaders, types, sources);
+    program->shader_program = nu_load_cached_program(program->cache_key);
+    if(program->shader_program) {
+      nu_program_cache_stats.hits++;
+      // Already linked, there are no shaders to wait for
+      free(program->pending_shaders);
+      program->pending_shaders = NULL;
+      program->pending = true;
+      goto cleanup;
+    }
+    nu_program_cache_stats.misses++;
+  }
+  // Create shaders and program, attach shaders, link. Checking any status
+  // here would make the driver finish compiling first
+  for(size_t i = 0; i < num_shaders; i++) {
+    program->pending_shaders[i] = glCreateShader(types[i]);
+    const GLint source_len = (const GLint) strlen(sources[i]);
+    const GLchar *source_ptr = sources[i];
+    glShaderSource(program->pending_shaders[i], 1, &source_ptr, &source_len);
+    glCompileShader(program->pending_shaders[i]);
+  }
+  program->shader_program = glCreateProgram();
+  nu_count_objects(NU_GPU_PROGRAM, 1, 0);
+  if(nu_program_cache_dir) glProgramParameteri(program->shader_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  for(size_t i = 0; i < num_shaders; i++) {
+    glAttachShader(program->shader_program, program->pending_shaders[i]);
+  }
+  glLinkProgram(program->shader_program);
+  program->pending = true;
+
+cleanup:
+  free(types);
+  free(sources);
+  if(!submitted) {
+    free(program->pending_shaders);
+    program->pending_shaders = NULL;
+  }
+  return submitted;
+}
+
+static void nu_print_shader_log(GLuint shader) {
+  GLint logSize = 0;
+  glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logSize);
+  if(logSize <= 0) return;
+  char *err_msg = calloc(logSize, sizeof(char));
+  if(!err_msg) return;
+  glGetShaderInfoLog(shader, logSize, &logSize, err_msg);
+  fprintf(stderr, "%s", err_msg);
+  free(err_msg);
+}
+
+// Waits for a submitted program to finish compiling and linking, then
+// reflects its uniforms, or marks it failed
+static void nu_finish_program(nu_Program *program) {
+  if(!program->pending) return;
+  program->pending = false;
+  bool compiled = true;
+  for(size_t i = 0; program->pending_shaders && i < program->num_shaders; i++) {
+    GLint success = 0;
+    glGetShaderiv(program->pending_shaders[i], GL_COMPILE_STATUS, &success);
+    if(success == GL_FALSE) {
+      fprintf(stderr, "(nu_create_program): Couldn't compile shader \"%s\", compilation failed.\n", program->shader_locs[i]);
+      nu_print_shader_log(program->pending_shaders[i]);
+      compiled = false;
+    }
+  }
+  GLint success = GL_FALSE;
+  if(compiled) {
+    glGetProgramiv(program->shader_program, GL_LINK_STATUS, &success);
+    if(success == GL_FALSE) {
+      GLint logSize = 0;
+      glGetProgramiv(program->shader_program, GL_INFO_LOG_LENGTH, &logSize);
+      char *err_msg = calloc(logSize > 0 ? logSize : 1, sizeof(char));
+      if(err_msg) {
+        glGetProgramInfoLog(program->shader_program, logSize, &logSize, err_msg);
+        fprintf(stderr, "%s", err_msg);
+        free(err_msg);
+      }
+    }
+  }
+  if(program->pending_shaders) {
+    // Detach and delete shaders after linking
+    for(size_t i = 0; i < program->num_shaders; i++) {
+      glDetachShader(program->shader_program, program->pending_shaders[i]);
+      glDeleteShader(program->pending_shaders[i]);
+    }
+    free(program->pending_shaders);
+    program->pending_shaders = NULL;
+    if(success == GL_TRUE && nu_program_cache_dir && program->cache_key) nu_store_cached_program(program->cache_key, program->shader_program);
+  }
+  if(success == GL_FALSE) {
+    glDeleteProgram(program->shader_program);
+    nu_count_objects(NU_GPU_PROGRAM, -1, 0);
+    program->shader_program = 0;
+    program->failed = true;
+    return;
+  }
+  nu_reflect_uniforms(program);
+  nu_add_program(program);
+}
+
+// Creates a nu_Program and submits it, see nu_submit_program
+static nu_Program *nu_create_program_from_locs(size_t num_shaders, const char **shader_locs) {
+  // Create nu_Program
+  nu_Program *program = calloc(1, sizeof(nu_Program));
+  if(!program) {
+    fprintf(stderr, "(nu_create_program): Couldn't create shader program, calloc failed.\n");
+    return NULL;
+  }
+  program->num_shaders = num_shaders;
+  program->shader_locs = calloc(num_shaders, sizeof(char *));
+  if(!program->shader_locs) {
+    fprintf(stderr, "(nu_create_program): Couldn't create shader program, calloc failed.\n");
+    free(program);
+    return NULL;
+  }
+  for(size_t i = 0; i < num_shaders; i++) {
+    program->shader_locs[i] = shader_locs[i] ? strdup(shader_locs[i]) : NULL;
+    if(!program->shader_locs[i]) {
+      fprintf(stderr, "(nu_create_program): Couldn't create shader program, shader %zu has no file name.\n", i);
+      nu_destroy_program(&program);
+      return NULL;
+    }
+  }
+  // Uniforms list, filled in from the linked program
+  program->uniforms = NULL;
+  program->num_uniforms = 0;
+  program->uniforms_alloced = 0;
+  program->uniform_table = NULL;
+  program->uniform_table_size = 0;
+  if(!nu_submit_program(program)) {
+    nu_destroy_program(&program);
+    return NULL;
+  }
+  return program;
+}
+
+// Collects the const char * shader locations of a variadic create call
+static const char **nu_collect_shader_locs(size_t num_shaders, va_list args) {
+  const char **shader_locs = calloc(num_shaders, sizeof(const char *));
+  if(!shader_locs) {
+    fprintf(stderr, "(nu_create_program): Couldn't create shader program, calloc failed.\n"); 
+    return NULL;
+  }
+  for(size_t i = 0; i < num_shaders; i++) {
+    shader_locs[i] = va_arg(args, const char *);
+  }
+  return shader_locs;
+}
+
+// Creates a program and waits for it, NULL if it failed
+static nu_Program *nu_build_program(size_t num_shaders, const char **shader_locs) {
+  nu_Program *program = nu_create_program_from_locs(num_shaders, shader_locs);
+  if(!program) return NULL;
+  nu_finish_program(program);
+  if(program->failed) {
+    nu_destroy_program(&program);
+    return NULL;
+  }
+  return program;
+}
+
+nu_Program *nu_create_program(size_t num_shaders, ...) {
+  NU_PROFILE_FUNCTION();
+  if(num_shaders == 0) return 0;
+  va_list args;
+  va_start(args, num_shaders);
+  const char **shader_locs = nu_collect_shader_locs(num_shaders, args);
+  va_end(args);
+  if(!shader_locs) return NULL;
+  nu_Program *program = nu_build_program(num_shaders, shader_locs);
+  free(shader_locs);
+  return program;
+}
+
+nu_Program *nu_create_program_async(size_t num_shaders, ...) {
+  NU_PROFILE_FUNCTION();
+  if(num_shaders == 0) return 0;
+  // Let the driver use as many compiler threads as it likes
+  if(!nu_parallel_compile_enabled && nu_parallel_compile_supported()) {
+    if(GLEW_KHR_parallel_shader_compile) {
+      glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+    } else {
+      glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+    }
+    nu_parallel_compile_enabled = true;
+  }
+  va_list args;
+  va_start(args, num_shaders);
+  const char **shader_locs = nu_collect_shader_locs(num_shaders, args);
+  va_end(args);
+  if(!shader_locs) return NULL;
+  nu_Program *program = nu_create_program_from_locs(num_shaders, shader_locs);
+  free(shader_locs);
+  return program;
+}
+
+bool nu_program_ready(nu_Program *program) {
+  if(!program) return false;
+  if(program->pending && nu_parallel_compile_supported()) {
+    GLint done = GL_FALSE;
+    glGetProgramiv(program->shader_program, GL_COMPLETION_STATUS_KHR, &done);
+    if(done == GL_FALSE) return false;
+  }
+  nu_finish_program(program);
+  return true;
+}
+
+bool nu_program_failed(nu_Program *program) {
+  if(!program) return true;
+  nu_finish_program(program);
+  return program->failed;
+}
+
+// Points a programs uniforms at its rebuilt GL program, whose uniforms
+// fresh reflected. Uniforms keep their handles, and the last value set is
+// set again unless the type or array size changed. Uniforms the new program
+// lacks get location -1, which GL ignores, and new ones are added at the end
+static void nu_carry_uniforms(nu_Program *program, nu_Program *fresh) {
+  nu_state_use_program(program->shader_program);
+  for(size_t i = 0; i < program->num_uniforms; i++) {
+    nu_Uniform *uniform = &program->uniforms[i];
+    int handle = nu_get_uniform_handle(fresh, uniform->name);
+    GLint location = uniform->location;
+    GLenum type = uniform->type;
+    GLint size = uniform->size;
+    if(handle >= 0) {
+      location = fresh->uniforms[handle].location;
+      type = fresh->uniforms[handle].type;
+      size = fresh->uniforms[handle].size;
+    } else {
+      // Uniforms from nu_register_uniform aren't reflected
+      location = glGetUniformLocation(program->shader_program, uniform->name);
+    }
+    if(type != uniform->type || size != uniform->size) {
+      free(uniform->value);
+      uniform->value = NULL;
+    }
+    uniform->location = location;
+    uniform->type = type;
+    uniform->size = size;
+    if(uniform->value && location != -1) nu_apply_uniform(uniform, uniform->value);
+  }
+  for(size_t i = 0; i < fresh->num_uniforms; i++) {
+    const nu_Uniform *uniform = &fresh->uniforms[i];
+    if(nu_get_uniform_handle(program, uniform->name) >= 0) continue;
+    if(nu_add_uniform(program, uniform->name, uniform->location, uniform->type, uniform->size) < 0) {
+      fprintf(stderr, "(nu_poll_shader_reload): Couldn't add uniform \"%s\", allocation failed.\n", uniform->name);
+    }
+  }
+}
+
+// Rebuilds a program from its shader files, swapping the new GL program in
+// only if it compiles and links
+static bool nu_reload_program(nu_Program *program) {
+  nu_Program *fresh = nu_create_program_from_locs(program->num_shaders, (const char **)program->shader_locs);
+  if(fresh) nu_finish_program(fresh);
+  if(!fresh || fresh->failed) {
+    fprintf(stderr, "(nu_poll_shader_reload): Couldn't reload program of \"%s\", keeping the old one.\n", program->shader_locs[0]);
+    nu_destroy_program(&fresh);
+    return false;
+  }
+  // Swap the GL program, the old one goes with fresh
+  GLuint shader_program = program->shader_program;
+  program->shader_program = fresh->shader_program;
+  fresh->shader_program = shader_program;
+  nu_carry_uniforms(program, fresh);
+  program->cache_key = fresh->cache_key;
+  nu_destroy_program(&fresh);
+  return true;
+}
+
+size_t nu_poll_shader_reload(void) {
+  if(!nu_shader_reload_enabled) return 0;
+  char **changed = NULL;
+  size_t num_changed = nu_collect_changed_files(&changed);
+  if(num_changed == 0) return 0;
+
+  // Drop every cached source built from a changed file, remembering which
+  // shader files they were
+  char **stale = NULL;
+  size_t num_stale = 0;
+  for(size_t i = 0; i < nu_num_shader_sources;) {
+    bool depends = false;
+    for(size_t d = 0; d < nu_shader_sources[i].num_deps && !depends; d++) {
+      for(size_t c = 0; c < num_changed && !depends; c++) depends = strcmp(nu_shader_sources[i].deps[d], changed[c]) == 0;
+    }
+    if(!depends) {
+      i++;
+      continue;
+    }
+    nu_add_changed_file(&stale, &num_stale, strdup(nu_shader_sources[i].path));
+    nu_free_shader_source(&nu_shader_sources[i]);
+    nu_shader_sources[i] = nu_shader_sources[--nu_num_shader_sources];
+  }
+  for(size_t c = 0; c < num_changed; c++) free(changed[c]);
+  free(changed);
+
+  // Reloading adds and removes programs, so pick them out first
+  nu_Program **reload = num_stale ? malloc(nu_num_programs * sizeof(nu_Program *)) : NULL;
+  size_t num_reload = 0;
+  for(size_t p = 0; reload && p < nu_num_programs; p++) {
+    bool depends = false;
+    for(size_t i = 0; i < nu_programs[p]->num_shaders && !depends; i++) {
+      char *canonical = nu_canonical_path(nu_programs[p]->shader_locs[i]);
+      for(size_t s = 0; canonical && s < num_stale && !depends; s++) depends = strcmp(canonical, stale[s]) == 0;
+      free(canonical);
+    }
+    if(depends) reload[num_reload++] = nu_programs[p];
+  }
+  size_t num_reloaded = 0;
+  for(size_t i = 0; i < num_reload; i++) num_reloaded += nu_reload_program(reload[i]);
+  free(reload);
+  for(size_t s = 0; s < num_stale; s++) free(stale[s]);
+  free(stale);
+  // Programs that failed to reload read their sources again, so watch any
+  // newly included files
+  nu_watch_shader_sources();
+  return num_reloaded;
+}
+
+void nu_use_program(nu_Program *program) {
+  if(!program) return;
+  nu_finish_program(program);
+  nu_state_use_program(program->shader_program);
+}
+
+void nu_register_uniform(nu_Program *program, const char *name, GLenum type) {
+  if(!program || !name) return;
+  nu_finish_program(program);
+  if(!program->shader_program) return;
+  // Active uniforms are already known from reflection, with their real type
+  if(nu_get_uniform_handle(program, name) >= 0) return;
+  GLint loc = glGetUniformLocation(program->shader_program, name);
+  if(loc == -1) {
+    fprintf(stderr, "(nu_register_uniform): Uniform \"%s\" not found in shader program.\n", name);
+    return;
+  }
+  if(nu_add_uniform(program, name, loc, type, 1) < 0) {
+    fprintf(stderr, "(nu_register_uniform): Couldn't register uniform \"%s\", allocation failed.\n", name);
+  }
+}
+
+int nu_get_uniform_handle(nu_Program *program, const char *name) {
+  if(!program || !name) return -1;
+  nu_finish_program(program);
+  if(!program->uniform_table) return -1;
+  uint64_t hash = nu_hash_string(name);
+  size_t mask = program->uniform_table_size - 1;
+  for(size_t slot = hash & mask; program->uniform_table[slot] >= 0; slot = (slot + 1) & mask) {
+    nu_Uniform *uniform = &program->uniforms[program->uniform_table[slot]];
+    // Only a matching hash needs a string compare
+    if(uniform->hash == hash && strcmp(uniform->name, name) == 0) return program->uniform_table[slot];
+  }
+  return -1;
+}
+
+static nu_Uniform *nu_get_uniform(nu_Program *program, const char *uniform_name) {
+  int handle = nu_get_uniform_handle(program, uniform_name);
+  return handle >= 0 ? &program->uniforms[handle] : NULL;
+}
+
+// Makes the program current and sets a uniform from data, skipping the
+// upload when the value is the same as the last one set
+static void nu_set_uniform_value(nu_Program *program, nu_Uniform *uniform, void *data) {
+  nu_use_program(program);
+  size_t size = nu_uniform_value_size(uniform);
+  if(size == 0) {
+    fprintf(stderr, "(nu_set_uniform): Unsupported uniform type %u\n", uniform->type);
+    fprintf(stderr, "Set it yourself by using your (nu_Program *)->shader_program.\n");
+    return;
+  }
+  if(uniform->value) {
+    if(memcmp(uniform->value, data, size) == 0) return;
+  } else {
+    uniform->value = malloc(size);
+  }
+  if(uniform->value) memcpy(uniform->value, data, size);
+  nu_apply_uniform(uniform, data);
+}
+
+void nu_set_uniform(nu_Program *program, const char *uniform_name, void *data) {
+  if(!program || !uniform_name || !data) return;
+  nu_Uniform *uniform = nu_get_uniform(program, uniform_name);
+  if(!uniform) {
+    fprintf(stderr, "(nu_set_uniform): Couldn't set uniform \"%s\", uniform not registered in shader program.\n", uniform_name);
+    return;
+  }
+  nu_set_uniform_value(program, uniform, data);
+}
+
+void nu_set_uniform_handle(nu_Program *program, int handle, void *data) {
+  if(!program || !data) return;
+  nu_finish_program(program);
+  if(handle < 0 || (size_t)handle >= program->num_uniforms) {
+    fprintf(stderr, "(nu_set_uniform_handle): Couldn't set uniform, invalid handle %d.\n", handle);
+    return;
+  }
+  nu_set_uniform_value(program, &program->uniforms[handle], data);
+}
+
+static void nu_free_uniforms(nu_Program *program) {
+  if(program->uniforms) {
+    for(size_t i = 0; i < program->num_uniforms; i++) {
+      if(program->uniforms[i].name) free(program->uniforms[i].name);
+      if(program->uniforms[i].value) free(program->uniforms[i].value);
+    }
+    free(program->uniforms);
+  }
+  if(program->uniform_table) free(program->uniform_table);
+  program->uniforms = NULL;
+  program->num_uniforms = 0;
+  program->uniforms_alloced = 0;
+  program->uniform_table = NULL;
+  program->uniform_table_size = 0;
+}
+
+void nu_destroy_program(nu_Program **program) {
+  if(!program || !(*program)) return;
+  if((*program)->pending_shaders) {
+    for(size_t i = 0; i < (*program)->num_shaders; i++) {
+      if((*program)->pending_shaders[i]) glDeleteShader((*program)->pending_shaders[i]);
+    }
+    free((*program)->pending_shaders);
+  }
+  if((*program)->shader_locs) {
+    for(size_t i = 0; i < (*program)->num_shaders; i++) {
+      if((*program)->shader_locs[i]) free((*program)->shader_locs[i]);
+    }
+    free((*program)->shader_locs);
+  }
+  if((*program)->shader_program) {
+    glDeleteProgram((*program)->shader_program);
+    nu_state_forget_program((*program)->shader_program);
+    nu_count_objects(NU_GPU_PROGRAM, -1, 0);
+  }
+  nu_free_uniforms(*program);
+  nu_remove_program(*program);
   free(*program);
   *program = NULL;
 }
 
-static size_t nu_define_layout(GLuint *VAO, GLuint *VBO, size_t num_components, size_t *component_sizes, size_t *component_counts, GLenum *component_types) {
-  // Clear whatever might exist in the VAO and VBO
-  glDeleteVertexArrays(1, VAO);
-  glGenVertexArrays(1, VAO);
-  glBindVertexArray(*VAO);
+// Uniform blocks
+// Columns and rows of a block field type, 0 columns if unsupported
+static void nu_block_type_shape(GLenum type, size_t *cols, size_t *rows) {
+  *cols = 1;
+  switch(type) {
+    case GL_FLOAT: case GL_INT: case GL_UNSIGNED_INT: case GL_BOOL: *rows = 1; break;
+    case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_UNSIGNED_INT_VEC2: case GL_BOOL_VEC2: *rows = 2; break;
+    case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_UNSIGNED_INT_VEC3: case GL_BOOL_VEC3: *rows = 3; break;
+    case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_UNSIGNED_INT_VEC4: case GL_BOOL_VEC4: *rows = 4; break;
+    case GL_FLOAT_MAT2: *cols = 2; *rows = 2; break;
+    case GL_FLOAT_MAT3: *cols = 3; *rows = 3; break;
+    case GL_FLOAT_MAT4: *cols = 4; *rows = 4; break;
+    case GL_FLOAT_MAT2x3: *cols = 2; *rows = 3; break;
+    case GL_FLOAT_MAT2x4: *cols = 2; *rows = 4; break;
+    case GL_FLOAT_MAT3x2: *cols = 3; *rows = 2; break;
+    case GL_FLOAT_MAT3x4: *cols = 3; *rows = 4; break;
+    case GL_FLOAT_MAT4x2: *cols = 4; *rows = 2; break;
+    case GL_FLOAT_MAT4x3: *cols = 4; *rows = 3; break;
+    default: *cols = 0; *rows = 0; break;
+  }
+}
 
-  glDeleteBuffers(1, VBO);
-  glGenBuffers(1, VBO);
-  glBindBuffer(GL_ARRAY_BUFFER, *VBO);
+static size_t nu_align_up(size_t value, size_t alignment) {
+  return (value + alignment - 1) / alignment * alignment;
+}
 
-  // Calculate stride
-  size_t stride = 0;
-  for (size_t i = 0; i < num_components; i++) {
-    stride += component_sizes[i] * component_counts[i];
-  }
-  // Attrib pointer to each component
+// Lays out a blocks members with std140 rules, returning the block size or 0
+static size_t nu_layout_std140(size_t num_members, nu_BlockMember *members) {
   size_t offset = 0;
-  for (size_t i = 0; i < num_components; i++) {
-    if(component_types[i] != GL_INT) {
-      glVertexAttribPointer(i, component_counts[i], component_types[i], GL_FALSE,
-      stride, (GLvoid *)(intptr_t)offset);
-    } else {
-      glVertexAttribIPointer(i, component_counts[i], component_types[i],
-      stride, (GLvoid *)(intptr_t)offset);
+  for(size_t i = 0; i < num_members; i++) {
+    nu_BlockMember *member = &members[i];
+    size_t cols, rows;
+    nu_block_type_shape(member->type, &cols, &rows);
+    if(cols == 0) {
+      fprintf(stderr, "(nu_layout_std140): Unsupported type %u for block field \"%s\".\n", member->type, member->name);
+      return 0;
+    }
+    // A vector aligns to 2 or 4 components. Matrix columns and array
+    // elements are vectors padded out to vec4
+    size_t align = rows == 1 ? 4 : (rows == 2 ? 8 : 16);
+    size_t size = rows * 4;
+    member->matrix_stride = 0;
+    if(cols > 1) {
+      member->matrix_stride = 16;
+      align = 16;
+      size = cols * 16;
     }
-    glEnableVertexAttribArray(i);
-    offset += component_sizes[i] * component_counts[i];
+    member->array_stride = 0;
+    if(member->count > 1) {
+      align = 16;
+      member->array_stride = nu_align_up(size, 16);
+      size = member->array_stride * member->count;
+    }
+    member->offset = nu_align_up(offset, align);
+    offset = member->offset + size;
   }
-  return stride;
+  // The block is padded to a vec4
+  return nu_align_up(offset, 16);
 }
 
-nu_Mesh *nu_create_mesh(size_t num_components, size_t *component_sizes, size_t *component_counts, GLenum *component_types) {
-  if(num_components == 0) {
-    fprintf(stderr, "(nu_create_mesh): Couldn't create mesh, mesh has 0 components.\n");
+static void nu_block_delete_ring(nu_UniformBlock *block) {
+  for(size_t i = 0; i < NU_BLOCK_RING_SEGMENTS; i++) {
+    if(block->ring_fences[i]) glDeleteSync(block->ring_fences[i]);
+    block->ring_fences[i] = NULL;
+  }
+  block->ring_data = NULL;
+  block->ring_index = 0;
+}
+
+nu_UniformBlock *nu_create_uniform_block(const char *name, size_t num_fields, const nu_BlockField *fields) {
+  if(!name || num_fields == 0 || !fields) return NULL;
+  // Take the first free binding point
+  GLint max_bindings = 0;
+  glGetIntegerv(GL_MAX_UNIFORM_BUFFER_BINDINGS, &max_bindings);
+  size_t binding = 0;
+  while(binding < nu_blocks_alloced && nu_blocks[binding]) binding++;
+  if(binding >= (size_t)max_bindings) {
+    fprintf(stderr, "(nu_create_uniform_block): Couldn't create uniform block \"%s\", all %d binding points are in use.\n", name, max_bindings);
     return NULL;
   }
-  nu_Mesh *out = calloc(1, sizeof(nu_Mesh));  
-  if(!out) {
-    fprintf(stderr, "(nu_create_mesh): Couldn't create mesh, calloc failed.\n)");
+  if(binding == nu_blocks_alloced) {
+    size_t new_alloced = nu_blocks_alloced ? nu_blocks_alloced * 2 : 8;
+    nu_UniformBlock **new = realloc(nu_blocks, new_alloced * sizeof(nu_UniformBlock *));
+    if(!new) {
+      fprintf(stderr, "(nu_create_uniform_block): Couldn't create uniform block \"%s\", realloc failed.\n", name);
+      return NULL;
+    }
+    memset(new + nu_blocks_alloced, 0, (new_alloced - nu_blocks_alloced) * sizeof(nu_UniformBlock *));
+    nu_blocks = new;
+    nu_blocks_alloced = new_alloced;
+  }
+
+  nu_UniformBlock *block = calloc(1, sizeof(nu_UniformBlock));
+  if(!block) {
+    fprintf(stderr, "(nu_create_uniform_block): Couldn't create uniform block \"%s\", calloc failed.\n", name);
+    return NULL;
+  }
+  block->name = strdup(name);
+  block->members = calloc(num_fields, sizeof(nu_BlockMember));
+  if(!block->name || !block->members) {
+    fprintf(stderr, "(nu_create_uniform_block): Couldn't create uniform block \"%s\", allocation failed.\n", name);
+    nu_destroy_uniform_block(&block);
+    return NULL;
+  }
+  block->num_members = num_fields;
+  for(size_t i = 0; i < num_fields; i++) {
+    block->members[i].name = fields[i].name ? strdup(fields[i].name) : NULL;
+    block->members[i].type = fields[i].type;
+    block->members[i].count = fields[i].count > 1 ? fields[i].count : 1;
+    if(!block->members[i].name) {
+      fprintf(stderr, "(nu_create_uniform_block): Couldn't create uniform block \"%s\", field %zu has no name.\n", name, i);
+      nu_destroy_uniform_block(&block);
+      return NULL;
+    }
+  }
+  block->size = nu_layout_std140(block->num_members, block->members);
+  if(block->size == 0) {
+    nu_destroy_uniform_block(&block);
+    return NULL;
+  }
+  block->data = calloc(block->size, 1);
+  if(!block->data) {
+    fprintf(stderr, "(nu_create_uniform_block): Couldn't create uniform block \"%s\", calloc failed.\n", name);
+    nu_destroy_uniform_block(&block);
+    return NULL;
+  }
+
+  // Every segment has to start on an offset glBindBufferRange accepts
+  GLint offset_alignment = 256;
+  glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &offset_alignment);
+  block->segment_size = nu_align_up(block->size, offset_alignment > 0 ? offset_alignment : 256);
+  size_t ring_size = block->segment_size * NU_BLOCK_RING_SEGMENTS;
+  glGenBuffers(1, &block->UBO);
+  glBindBuffer(GL_UNIFORM_BUFFER, block->UBO);
+  nu_count_objects(NU_GPU_BUFFER, 1, (int64_t)ring_size);
+  if(GLEW_ARB_buffer_storage) {
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_UNIFORM_BUFFER, ring_size, NULL, flags);
+    block->ring_data = glMapBufferRange(GL_UNIFORM_BUFFER, 0, ring_size, flags);
+  } else {
+    glBufferData(GL_UNIFORM_BUFFER, ring_size, NULL, GL_DYNAMIC_DRAW);
+  }
+
+  block->binding = (GLuint)binding;
+  nu_blocks[binding] = block;
+  for(size_t i = 0; i < nu_num_programs; i++) nu_bind_program_block(nu_programs[i], block);
+  // Upload the zeroed block, so programs never read an unbound binding
+  block->dirty = true;
+  nu_blocks_dirty = true;
+  return block;
+}
+
+void nu_destroy_uniform_block(nu_UniformBlock **block) {
+  if(!block || !(*block)) return;
+  if((*block)->UBO) {
+    nu_block_delete_ring(*block);
+    // Deleting the UBO unmaps it
+    glDeleteBuffers(1, &(*block)->UBO);
+    nu_count_objects(NU_GPU_BUFFER, -1, -(int64_t)((*block)->segment_size * NU_BLOCK_RING_SEGMENTS));
+    if((*block)->binding < nu_blocks_alloced && nu_blocks[(*block)->binding] == *block) nu_blocks[(*block)->binding] = NULL;
+  }
+  if((*block)->members) {
+    for(size_t i = 0; i < (*block)->num_members; i++) {
+      if((*block)->members[i].name) free((*block)->members[i].name);
+    }
+    free((*block)->members);
+  }
+  if((*block)->name) free((*block)->name);
+  if((*block)->data) free((*block)->data);
+  free(*block);
+  *block = NULL;
+}
+
+void nu_set_block_field(nu_UniformBlock *block, const char *field_name, const void *data) {
+  if(!block || !field_name || !data) return;
+  nu_BlockMember *member = NULL;
+  for(size_t i = 0; i < block->num_members; i++) {
+    if(strcmp(block->members[i].name, field_name) == 0) {
+      member = &block->members[i];
+      break;
+    }
+  }
+  if(!member) {
+    fprintf(stderr, "(nu_set_block_field): Couldn't set field \"%s\", not in uniform block \"%s\".\n", field_name, block->name);
+    return;
+  }
+  // Spread the packed columns out to their std140 strides
+  size_t cols, rows;
+  nu_block_type_shape(member->type, &cols, &rows);
+  const uint8_t *src = data;
+  for(GLint e = 0; e < member->count; e++) {
+    uint8_t *element = block->data + member->offset + e * member->array_stride;
+    for(size_t c = 0; c < cols; c++) {
+      uint8_t *column = element + c * member->matrix_stride;
+      if(memcmp(column, src, rows * 4) != 0) {
+        memcpy(column, src, rows * 4);
+        block->dirty = true;
+      }
+      src += rows * 4;
+    }
+  }
+  if(block->dirty) nu_blocks_dirty = true;
+}
+
+void nu_upload_uniform_block(nu_UniformBlock *block) {
+  if(!block || !block->dirty) return;
+  block->dirty = false;
+  // Fence the segment draws have been reading, then move on to the next,
+  // waiting if the GPU is still reading it from NU_BLOCK_RING_SEGMENTS uploads ago
+  if(block->ring_fences[block->ring_index]) glDeleteSync(block->ring_fences[block->ring_index]);
+  block->ring_fences[block->ring_index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  block->ring_index = (block->ring_index + 1) % NU_BLOCK_RING_SEGMENTS;
+  nu_wait_fence(&block->ring_fences[block->ring_index]);
+  size_t offset = block->ring_index * block->segment_size;
+  if(block->ring_data) {
+    memcpy(block->ring_data + offset, block->data, block->size);
+  } else {
+    glBindBuffer(GL_UNIFORM_BUFFER, block->UBO);
+    glBufferSubData(GL_UNIFORM_BUFFER, offset, block->size, block->data);
+  }
+  nu_counters->buffer_upload_bytes += block->size;
+  glBindBufferRange(GL_UNIFORM_BUFFER, block->binding, block->UBO, offset, block->size);
+}
+
+// Uploads every block changed since the last draw
+static void nu_upload_uniform_blocks(void) {
+  if(!nu_blocks_dirty) return;
+  nu_blocks_dirty = false;
+  for(size_t i = 0; i < nu_blocks_alloced; i++) {
+    if(nu_blocks[i]) nu_upload_uniform_block(nu_blocks[i]);
+  }
+}
+
+// Types glVertexAttribIPointer can pass to the shader as ints
+static bool nu_is_integer_type(GLenum type) {
+  switch(type) {
+    case GL_BYTE: case GL_UNSIGNED_BYTE:
+    case GL_SHORT: case GL_UNSIGNED_SHORT:
+    case GL_INT: case GL_UNSIGNED_INT:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Types packing a whole 4 value attribute into 32 bits
+static bool nu_is_packed_type(GLenum type) {
+  return type == GL_INT_2_10_10_10_REV || type == GL_UNSIGNED_INT_2_10_10_10_REV;
+}
+
+// Bytes a component takes in a vertex, 0 if it isn't a usable attribute
+static size_t nu_component_bytes(const nu_MeshComponent *component) {
+  if(nu_is_packed_type(component->type)) return component->count == 4 ? sizeof(GLuint) : 0;
+  return component->size * component->count;
+}
+
+// Point attributes from first_location on at the bound GL_ARRAY_BUFFER, for
+// the bound VAO. Returns the location after the last one used
+static GLuint nu_apply_components(GLuint first_location, size_t num_components, nu_MeshComponent *components, size_t stride, GLuint divisor) {
+  GLuint location = first_location;
+  size_t offset = 0;
+  for (size_t i = 0; i < num_components; i++) {
+    nu_MeshComponent *component = &components[i];
+    // Attributes hold at most 4 values, larger components (matrices) are
+    // split over consecutive locations
+    for(size_t done = 0; done < component->count; done += 4) {
+      size_t count = component->count - done < 4 ? component->count - done : 4;
+      // Unnormalized integers reach the shader as ints, everything else as
+      // floats
+      if(nu_is_integer_type(component->type) && !component->normalized) {
+        glVertexAttribIPointer(location, count, component->type,
+        stride, (GLvoid *)(intptr_t)offset);
+      } else {
+        glVertexAttribPointer(location, count, component->type, component->normalized ? GL_TRUE : GL_FALSE,
+        stride, (GLvoid *)(intptr_t)offset);
+      }
+      glEnableVertexAttribArray(location);
+      glVertexAttribDivisor(location, divisor);
+      offset += nu_is_packed_type(component->type) ? sizeof(GLuint) : component->size * count;
+      location++;
+    }
+  }
+  return location;
+}
+
+// Point the bound VAO's vertex attributes at the bound GL_ARRAY_BUFFER
+static GLuint nu_apply_layout(nu_Mesh *mesh) {
+  return nu_apply_components(0, mesh->num_components, mesh->components, mesh->stride, 0);
+}
+
+// Binds a meshes VAO and VBO, for changing its layout
+static void nu_bind_mesh(nu_Mesh *mesh) {
+  if(!mesh) return;
+  nu_state_bind_vertex_array(mesh->VAO);
+  nu_state_bind_array_buffer(mesh->VBO);
+}
+
+static size_t nu_define_layout(nu_Mesh *mesh) {
+  // Clear whatever might exist in the VAO and VBO
+  if(mesh->VAO) nu_count_objects(NU_GPU_VERTEX_ARRAY, -1, 0);
+  glDeleteVertexArrays(1, &mesh->VAO);
+  nu_state_forget_vertex_array(mesh->VAO);
+  glGenVertexArrays(1, &mesh->VAO);
+  nu_count_objects(NU_GPU_VERTEX_ARRAY, 1, 0);
+
+  if(mesh->VBO) nu_count_objects(NU_GPU_BUFFER, -1, -(int64_t)mesh->gpu_alloced);
+  glDeleteBuffers(1, &mesh->VBO);
+  nu_state_forget_buffer(mesh->VBO);
+  glGenBuffers(1, &mesh->VBO);
+  nu_count_objects(NU_GPU_BUFFER, 1, 0);
+  mesh->gpu_alloced = 0;
+  nu_bind_mesh(mesh);
+
+  // Calculate stride
+  size_t stride = 0;
+  for (size_t i = 0; i < mesh->num_components; i++) {
+    stride += nu_component_bytes(&mesh->components[i]);
+  }
+  mesh->stride = stride;
+  // Attrib pointer to each component
+  nu_apply_layout(mesh);
+  return stride;
+}
+
+nu_Mesh *nu_create_mesh_with_layout(nu_MeshUsage usage, size_t num_components, const nu_MeshComponent *components) {
+  if(num_components == 0 || !components) {
+    fprintf(stderr, "(nu_create_mesh): Couldn't create mesh, mesh has 0 components.\n");
+    return NULL;
+  }
+  for(size_t i = 0; i < num_components; i++) {
+    if(nu_component_bytes(&components[i]) == 0) {
+      fprintf(stderr, "(nu_create_mesh): Couldn't create mesh, component %zu is empty, or packed without 4 values.\n", i);
+      return NULL;
+    }
+  }
+  nu_Mesh *out = calloc(1, sizeof(nu_Mesh));  
+  if(!out) {
+    fprintf(stderr, "(nu_create_mesh): Couldn't create mesh, calloc failed.\n)");
+    return NULL;
+  }
+  out->components = calloc(num_components, sizeof(nu_MeshComponent));
+  if(!out->components) {
+    fprintf(stderr, "(nu_create_mesh): Couldn't create mesh, calloc failed.\n)");
+    free(out);
+    return NULL;
+  }
+  out->num_components = num_components;
+  memcpy(out->components, components, num_components * sizeof(nu_MeshComponent));
+  // Generate VAO and VBO
+  out->stride = nu_define_layout(out);
+  if(out->stride == 0) {
+    fprintf(stderr, "(nu_create_mesh): Couldn't create mesh, stride was 0.\n");
+    glDeleteVertexArrays(1, &out->VAO);
+    glDeleteBuffers(1, &out->VBO);
+    nu_state_forget_vertex_array(out->VAO);
+    nu_state_forget_buffer(out->VBO);
+    nu_count_objects(NU_GPU_VERTEX_ARRAY, -1, 0);
+    nu_count_objects(NU_GPU_BUFFER, -1, 0);
+    free(out->components);
+    free(out);
+    return NULL;
+  }
+  if(usage == NU_MESH_STREAM && !GLEW_ARB_buffer_storage) {
+    fprintf(stderr, "(nu_create_mesh): ARB_buffer_storage is not supported, streaming mesh will use NU_MESH_DYNAMIC.\n");
+    usage = NU_MESH_DYNAMIC;
+  }
+  out->usage = usage;
+  out->builder_data = NULL;
+  out->builder_alloced = 0;
+  out->builder_added = 0;
+  out->mapped_data = NULL;
+  out->mapped_alloced = 0;
+  out->mapped_added = 0;
+  out->num_dirty_ranges = 0;
+  out->builder_indices = NULL;
+  out->builder_indices_alloced = 0;
+  out->builder_indices_added = 0;
+  out->indices_dirty = false;
+  out->EBO = 0;
+  out->index_count = 0;
+  out->num_instance_components = 0;
+  out->instance_components = NULL;
+  out->instance_stride = 0;
+  out->instance_alloced = 0;
+  out->instance_count = 0;
+  out->instance_VBO = 0;
+  out->last_send_size = 0;
+  out->gpu_alloced = 0;
+  out->index_alloced = 0;
+  out->draw_first = 0;
+  out->render_mode = GL_TRIANGLES;
+  return out;
+} 
+
+// Copies separate size, count and type arrays into components
+static nu_MeshComponent *nu_make_components(size_t num_components, size_t *component_sizes, size_t *component_counts, GLenum *component_types) {
+  if(num_components == 0) return NULL;
+  nu_MeshComponent *components = calloc(num_components, sizeof(nu_MeshComponent));
+  if(!components) return NULL;
+  for(size_t i = 0; i < num_components; i++) {
+    components[i] = (nu_MeshComponent) {
+      .size = component_sizes[i],
+      .count = component_counts[i],
+      .type = component_types[i]
+    };
+  }
+  return components;
+}
+
+nu_Mesh *nu_create_mesh_with_usage(nu_MeshUsage usage, size_t num_components, size_t *component_sizes, size_t *component_counts, GLenum *component_types) {
+  nu_MeshComponent *components = nu_make_components(num_components, component_sizes, component_counts, component_types);
+  if(num_components > 0 && !components) {
+    fprintf(stderr, "(nu_create_mesh): Couldn't create mesh, calloc failed.\n");
+    return NULL;
+  }
+  nu_Mesh *out = nu_create_mesh_with_layout(usage, num_components, components);
+  free(components);
+  return out;
+}
+
+nu_Mesh *nu_create_mesh(size_t num_components, size_t *component_sizes, size_t *component_counts, GLenum *component_types) {
+  return nu_create_mesh_with_usage(NU_MESH_STATIC, num_components, component_sizes, component_counts, component_types);
+}
+
+// Vertex quantization
+// The range a type's values are clamped to, in the type's own units once
+// multiplied by scale
+typedef struct {
+  float scale, lo, hi;
+  size_t bytes;
+} nu_QuantizeRange;
+
+static bool nu_quantize_range(GLenum type, bool normalized, nu_QuantizeRange *range) {
+  // Signed normalized values map -1 to -max, leaving the minimum unused
+  switch(type) {
+    case GL_BYTE: *range = normalized ? (nu_QuantizeRange){127.0f, -127.0f, 127.0f, 1} : (nu_QuantizeRange){1.0f, -128.0f, 127.0f, 1}; return true;
+    case GL_UNSIGNED_BYTE: *range = (nu_QuantizeRange){normalized ? 255.0f : 1.0f, 0.0f, 255.0f, 1}; return true;
+    case GL_SHORT: *range = normalized ? (nu_QuantizeRange){32767.0f, -32767.0f, 32767.0f, 2} : (nu_QuantizeRange){1.0f, -32768.0f, 32767.0f, 2}; return true;
+    case GL_UNSIGNED_SHORT: *range = (nu_QuantizeRange){normalized ? 65535.0f : 1.0f, 0.0f, 65535.0f, 2}; return true;
+    // The largest floats below 2^31 and 2^32
+    case GL_INT: *range = normalized ? (nu_QuantizeRange){2147483520.0f, -2147483520.0f, 2147483520.0f, 4} : (nu_QuantizeRange){1.0f, -2147483648.0f, 2147483520.0f, 4}; return true;
+    case GL_UNSIGNED_INT: *range = (nu_QuantizeRange){normalized ? 4294967040.0f : 1.0f, 0.0f, 4294967040.0f, 4}; return true;
+    default: return false;
+  }
+}
+
+// Scales and clamps a value, NaN becomes lo
+static float nu_quantize_clamp(float value, float scale, float lo, float hi) {
+  value *= scale;
+  value = value > lo ? value : lo;
+  return value < hi ? value : hi;
+}
+
+static void nu_quantize_integers(GLenum type, const nu_QuantizeRange *range, size_t num_values, const float *in, void *out) {
+  size_t i = 0;
+#ifdef NU_SSE2
+  // 8 values at a time, rounded to nearest like the scalar llrintf
+  if(range->bytes < 4) {
+    __m128 scale = _mm_set1_ps(range->scale), lo = _mm_set1_ps(range->lo), hi = _mm_set1_ps(range->hi);
+    for(; i + 8 <= num_values; i += 8) {
+      __m128i a = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i), scale), lo), hi));
+      __m128i b = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4), scale), lo), hi));
+      switch(type) {
+        case GL_BYTE: {
+          __m128i words = _mm_packs_epi32(a, b);
+          _mm_storel_epi64((__m128i *)((int8_t *)out + i), _mm_packs_epi16(words, words));
+          break;
+        }
+        case GL_UNSIGNED_BYTE: {
+          __m128i words = _mm_packs_epi32(a, b);
+          _mm_storel_epi64((__m128i *)((uint8_t *)out + i), _mm_packus_epi16(words, words));
+          break;
+        }
+        case GL_SHORT:
+          _mm_storeu_si128((__m128i *)((int16_t *)out + i), _mm_packs_epi32(a, b));
+          break;
+        case GL_UNSIGNED_SHORT: {
+          // SSE2 only packs signed, so shift into the signed range and back
+          __m128i bias = _mm_set1_epi32(32768);
+          __m128i words = _mm_packs_epi32(_mm_sub_epi32(a, bias), _mm_sub_epi32(b, bias));
+          _mm_storeu_si128((__m128i *)((uint16_t *)out + i), _mm_xor_si128(words, _mm_set1_epi16((short)0x8000)));
+          break;
+        }
+      }
+    }
+  }
+#endif
+  for(; i < num_values; i++) {
+    long long value = llrintf(nu_quantize_clamp(in[i], range->scale, range->lo, range->hi));
+    switch(type) {
+      case GL_BYTE: ((int8_t *)out)[i] = (int8_t)value; break;
+      case GL_UNSIGNED_BYTE: ((uint8_t *)out)[i] = (uint8_t)value; break;
+      case GL_SHORT: ((int16_t *)out)[i] = (int16_t)value; break;
+      case GL_UNSIGNED_SHORT: ((uint16_t *)out)[i] = (uint16_t)value; break;
+      case GL_INT: ((int32_t *)out)[i] = (int32_t)value; break;
+      case GL_UNSIGNED_INT: ((uint32_t *)out)[i] = (uint32_t)value; break;
+    }
+  }
+}
+
+// Rounds to the nearest half, to even on ties. Out of range values become
+// infinity, NaN stays NaN
+static uint16_t nu_float_to_half(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint32_t sign = bits & 0x80000000u;
+  bits ^= sign;
+  uint16_t half;
+  if(bits >= 0x47800000u) {
+    half = bits > 0x7F800000u ? 0x7E00 : 0x7C00;
+  } else if(bits < 0x38800000u) {
+    // Subnormal, adding a magic number lines the mantissa up and rounds it
+    uint32_t magic_bits = 126u << 23;
+    float magic, sum;
+    memcpy(&magic, &magic_bits, sizeof(magic));
+    memcpy(&sum, &bits, sizeof(sum));
+    sum += magic;
+    memcpy(&bits, &sum, sizeof(bits));
+    half = (uint16_t)(bits - magic_bits);
+  } else {
+    uint32_t odd = (bits >> 13) & 1;
+    bits += 0xC8000FFFu + odd;
+    half = (uint16_t)(bits >> 13);
+  }
+  return half | (uint16_t)(sign >> 16);
+}
+
+#ifdef NU_SSE2
+// nu_float_to_half on 4 values, leaving each sign extended in its 32 bits
+// so they pack with _mm_packs_epi32
+static __m128i nu_float_to_half_sse2(__m128 value) {
+  __m128 sign = _mm_and_ps(value, _mm_castsi128_ps(_mm_set1_epi32((int)0x80000000u)));
+  __m128 abs = _mm_xor_ps(value, sign);
+  __m128i abs_bits = _mm_castps_si128(abs);
+  __m128i nan = _mm_castps_si128(_mm_cmpunord_ps(abs, abs));
+  __m128i regular = _mm_cmpgt_epi32(_mm_set1_epi32(0x47800000), abs_bits);
+  __m128i special = _mm_or_si128(_mm_and_si128(nan, _mm_set1_epi32(0x200)), _mm_set1_epi32(0x7C00));
+  __m128i subnormal = _mm_cmpgt_epi32(_mm_set1_epi32(0x38800000), abs_bits);
+  __m128i magic = _mm_set1_epi32(126 << 23);
+  __m128i subnormal_half = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(abs, _mm_castsi128_ps(magic))), magic);
+  __m128i odd = _mm_srai_epi32(_mm_slli_epi32(abs_bits, 18), 31);
+  __m128i normal_half = _mm_srli_epi32(_mm_sub_epi32(_mm_add_epi32(abs_bits, _mm_set1_epi32((int)0xC8000FFFu)), odd), 13);
+  __m128i half = _mm_or_si128(_mm_and_si128(subnormal, subnormal_half), _mm_andnot_si128(subnormal, normal_half));
+  half = _mm_or_si128(_mm_and_si128(regular, half), _mm_andnot_si128(regular, special));
+  return _mm_or_si128(half, _mm_srai_epi32(_mm_castps_si128(sign), 16));
+}
+#endif
+
+static void nu_quantize_halves(size_t num_values, const float *in, uint16_t *out) {
+  size_t i = 0;
+#ifdef NU_SSE2
+  for(; i + 8 <= num_values; i += 8) {
+    __m128i a = nu_float_to_half_sse2(_mm_loadu_ps(in + i));
+    __m128i b = nu_float_to_half_sse2(_mm_loadu_ps(in + i + 4));
+    _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(a, b));
+  }
+#endif
+  for(; i < num_values; i++) out[i] = nu_float_to_half(in[i]);
+}
+
+// Packs each x, y, z, w into 10, 10, 10 and 2 bits, x lowest
+static void nu_quantize_packed(GLenum type, bool normalized, size_t num_packed, const float *in, uint32_t *out) {
+  bool is_signed = type == GL_INT_2_10_10_10_REV;
+  float scale[4], lo[4], hi[4];
+  for(size_t c = 0; c < 4; c++) {
+    float max = is_signed ? (c < 3 ? 511.0f : 1.0f) : (c < 3 ? 1023.0f : 3.0f);
+    scale[c] = normalized ? max : 1.0f;
+    hi[c] = max;
+    lo[c] = is_signed ? (normalized ? -max : -max - 1.0f) : 0.0f;
+  }
+  size_t i = 0;
+#ifdef NU_SSE2
+  // A vertex per vector, only joining the fields up is scalar
+  __m128 scale_v = _mm_loadu_ps(scale), lo_v = _mm_loadu_ps(lo), hi_v = _mm_loadu_ps(hi);
+  __m128i mask = _mm_setr_epi32(0x3FF, 0x3FF, 0x3FF, 0x3);
+  for(; i < num_packed; i++) {
+    __m128i fields = _mm_and_si128(_mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(in + i * 4), scale_v), lo_v), hi_v)), mask);
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, fields);
+    out[i] = lanes[0] | lanes[1] << 10 | lanes[2] << 20 | lanes[3] << 30;
+  }
+#endif
+  for(; i < num_packed; i++) {
+    uint32_t packed = 0;
+    for(size_t c = 0; c < 4; c++) {
+      uint32_t value = (uint32_t)(int32_t)lrintf(nu_quantize_clamp(in[i * 4 + c], scale[c], lo[c], hi[c]));
+      packed |= (value & (c < 3 ? 0x3FFu : 0x3u)) << (c * 10);
+    }
+    out[i] = packed;
+  }
+}
+
+// Converts values packed together
+static void nu_quantize_values(GLenum type, bool normalized, size_t count, size_t num_vertices, const float *in, void *out) {
+  size_t num_values = count * num_vertices;
+  nu_QuantizeRange range;
+  if(type == GL_FLOAT) {
+    memcpy(out, in, num_values * sizeof(float));
+  } else if(type == GL_HALF_FLOAT) {
+    nu_quantize_halves(num_values, in, out);
+  } else if(nu_is_packed_type(type)) {
+    nu_quantize_packed(type, normalized, num_vertices, in, out);
+  } else if(nu_quantize_range(type, normalized, &range)) {
+    nu_quantize_integers(type, &range, num_values, in, out);
+  }
+}
+
+bool nu_quantize_vertices(GLenum type, bool normalized, size_t count, size_t num_vertices, const float *in, void *out, size_t out_stride) {
+  if(!in || !out || count == 0) return false;
+  nu_QuantizeRange range;
+  size_t value_size;
+  if(type == GL_FLOAT) {
+    value_size = sizeof(float);
+  } else if(type == GL_HALF_FLOAT) {
+    value_size = sizeof(uint16_t);
+  } else if(nu_is_packed_type(type) && count == 4) {
+    value_size = sizeof(uint32_t) / 4;
+  } else if(nu_quantize_range(type, normalized, &range)) {
+    value_size = range.bytes;
+  } else {
+    fprintf(stderr, "(nu_quantize_vertices): Couldn't quantize vertices, can't convert %zu values to type %u.\n", count, type);
+    return false;
+  }
+  size_t vertex_size = value_size * count;
+  if(out_stride == 0 || out_stride == vertex_size) {
+    nu_quantize_values(type, normalized, count, num_vertices, in, out);
+    return true;
+  }
+  // Interleaved output is converted a chunk at a time, then scattered
+  uint8_t chunk[4096];
+  size_t chunk_vertices = sizeof(chunk) / vertex_size;
+  if(chunk_vertices == 0) {
+    fprintf(stderr, "(nu_quantize_vertices): Couldn't quantize vertices, %zu values don't fit a chunk.\n", count);
+    return false;
+  }
+  for(size_t first = 0; first < num_vertices; first += chunk_vertices) {
+    size_t n = num_vertices - first < chunk_vertices ? num_vertices - first : chunk_vertices;
+    nu_quantize_values(type, normalized, count, n, in + first * count, chunk);
+    uint8_t *dst = (uint8_t *)out + first * out_stride;
+    // Constant sizes let the copies inline, a libc call per vertex costs
+    // more than the conversion
+    switch(vertex_size) {
+      case 4: for(size_t i = 0; i < n; i++, dst += out_stride) memcpy(dst, chunk + i * 4, 4); break;
+      case 6: for(size_t i = 0; i < n; i++, dst += out_stride) memcpy(dst, chunk + i * 6, 6); break;
+      case 8: for(size_t i = 0; i < n; i++, dst += out_stride) memcpy(dst, chunk + i * 8, 8); break;
+      default: for(size_t i = 0; i < n; i++, dst += out_stride) memcpy(dst, chunk + i * vertex_size, vertex_size); break;
+    }
+  }
+  return true;
+}
+
+// Refuses changes to a mesh a nu_Loader is uploading, its thread reads the
+// builder data and indices until the job is published
+static bool nu_mesh_check_loading(nu_Mesh *mesh, const char *func) {
+  if(!mesh->loading) return true;
+  fprintf(stderr, "(%s): Couldn't change mesh, a nu_Loader is still uploading it.\n", func);
+  return false;
+}
+
+bool nu_mesh_reserve(nu_Mesh *mesh, size_t num_bytes) {
+  if(!mesh) return false;
+  if(!nu_mesh_check_loading(mesh, "nu_mesh_reserve")) return false;
+  if(num_bytes <= mesh->builder_alloced) return true;
+  // realloc rather than calloc, every byte gets written before it is sent
+  uint8_t *new = realloc(mesh->builder_data, num_bytes);
+  if(!new) {
+    fprintf(stderr, "(nu_mesh_reserve): Couldn't reserve %zu bytes, realloc failed.\n", num_bytes);
+    return false;
+  }
+  mesh->builder_data = new;
+  mesh->builder_alloced = num_bytes;
+  return true;
+}
+
+// Adds [start, end) to the meshes dirty ranges, merging it with any ranges
+// it overlaps or touches
+static void nu_mesh_add_dirty_range(nu_Mesh *mesh, size_t start, size_t end) {
+  if(start >= end) return;
+  nu_MeshRange *ranges = mesh->dirty_ranges;
+  size_t n = mesh->num_dirty_ranges;
+  // First range ending at or after start
+  size_t first = 0, hi = n;
+  while(first < hi) {
+    size_t mid = (first + hi) / 2;
+    if(ranges[mid].end < start) first = mid + 1;
+    else hi = mid;
+  }
+  // One past the last range starting at or before end
+  size_t last = first;
+  while(last < n && ranges[last].start <= end) last++;
+
+  if(last > first) {
+    // Merge [first, last) and the new range into ranges[first]
+    if(ranges[first].start < start) start = ranges[first].start;
+    if(ranges[last - 1].end > end) end = ranges[last - 1].end;
+    ranges[first] = (nu_MeshRange) {start, end};
+    memmove(&ranges[first + 1], &ranges[last], (n - last) * sizeof(nu_MeshRange));
+    mesh->num_dirty_ranges = n - (last - first) + 1;
+    return;
+  }
+  if(n == NU_MESH_MAX_DIRTY_RANGES) {
+    // Out of ranges: merge the two closest, re-uploading the gap is cheaper
+    // than many tiny uploads
+    size_t closest = 0;
+    for(size_t i = 1; i + 1 < n; i++) {
+      if(ranges[i + 1].start - ranges[i].end < ranges[closest + 1].start - ranges[closest].end) closest = i;
+    }
+    ranges[closest].end = ranges[closest + 1].end;
+    memmove(&ranges[closest + 1], &ranges[closest + 2], (n - closest - 2) * sizeof(nu_MeshRange));
+    mesh->num_dirty_ranges--;
+    nu_mesh_add_dirty_range(mesh, start, end);
+    return;
+  }
+  memmove(&ranges[first + 1], &ranges[first], (n - first) * sizeof(nu_MeshRange));
+  ranges[first] = (nu_MeshRange) {start, end};
+  mesh->num_dirty_ranges++;
+}
+
+void nu_mesh_mark_dirty(nu_Mesh *mesh, size_t offset, size_t num_bytes) {
+  if(!mesh || num_bytes == 0) return;
+  nu_mesh_add_dirty_range(mesh, offset, offset + num_bytes);
+}
+
+void *nu_mesh_patch(nu_Mesh *mesh, size_t offset, size_t num_bytes) {
+  if(!mesh || num_bytes == 0) return NULL;
+  if(!nu_mesh_check_loading(mesh, "nu_mesh_patch")) return NULL;
+  if(!mesh->builder_data || offset + num_bytes > mesh->builder_added) {
+    fprintf(stderr, "(nu_mesh_patch): Couldn't patch bytes %zu-%zu, mesh only has %zu bytes.\n", offset, offset + num_bytes, mesh->builder_added);
+    return NULL;
+  }
+  nu_mesh_add_dirty_range(mesh, offset, offset + num_bytes);
+  return mesh->builder_data + offset;
+}
+
+void nu_mesh_write_bytes(nu_Mesh *mesh, size_t offset, size_t num_bytes, void *src) {
+  if(!mesh || !src || num_bytes == 0) return;
+  uint8_t *dst = nu_mesh_patch(mesh, offset, num_bytes);
+  if(!dst) return;
+  memcpy(dst, src, num_bytes);
+}
+
+// Returns a pointer to num_bytes of space at the end of the mesh, growing the
+// builder if needed
+static uint8_t *nu_mesh_push(nu_Mesh *mesh, size_t num_bytes) {
+  if(mesh->mapped_data) {
+    if(mesh->mapped_added + num_bytes > mesh->mapped_alloced) return NULL;
+    uint8_t *out = mesh->mapped_data + mesh->mapped_added;
+    mesh->mapped_added += num_bytes;
+    return out;
+  }
+  size_t required = mesh->builder_added + num_bytes;
+  if(required > mesh->builder_alloced) {
+    size_t new_alloced = mesh->builder_alloced ? mesh->builder_alloced : num_bytes;
+    while(required > new_alloced) {
+      new_alloced *= 2;
+    }
+    if(!nu_mesh_reserve(mesh, new_alloced)) return NULL;
+  }
+  uint8_t *out = mesh->builder_data + mesh->builder_added;
+  nu_mesh_add_dirty_range(mesh, mesh->builder_added, required);
+  mesh->builder_added += num_bytes;
+  return out;
+}
+
+void nu_mesh_add_bytes(nu_Mesh *mesh, size_t num_bytes, void *src) {
+  if(!mesh || !src || num_bytes == 0) return;
+  if(!nu_mesh_check_loading(mesh, "nu_mesh_add_bytes")) return;
+  uint8_t *dst = nu_mesh_push(mesh, num_bytes);
+  if(!dst) {
+    fprintf(stderr, "(nu_mesh_add_bytes): Error adding bytes to mesh, %s.\n", mesh->mapped_data ? "mapped buffer is full" : "reallocation failed");
+    return;
+  }
+  memcpy(dst, src, num_bytes);
+}
+
+void *nu_mesh_emit_vertices(nu_Mesh *mesh, size_t num_vertices) {
+  if(!mesh || num_vertices == 0) return NULL;
+  if(!nu_mesh_check_loading(mesh, "nu_mesh_emit_vertices")) return NULL;
+  uint8_t *dst = nu_mesh_push(mesh, num_vertices * mesh->stride);
+  if(!dst) {
+    fprintf(stderr, "(nu_mesh_emit_vertices): Couldn't emit %zu vertices, %s.\n", num_vertices, mesh->mapped_data ? "mapped buffer is full" : "reallocation failed");
+  }
+  return dst;
+}
+
+// Deletes a streaming mesh's ring fences and forgets its mapping
+static void nu_mesh_delete_ring(nu_Mesh *mesh) {
+  for(size_t i = 0; i < NU_MESH_RING_SEGMENTS; i++) {
+    if(mesh->ring_fences[i]) glDeleteSync(mesh->ring_fences[i]);
+    mesh->ring_fences[i] = NULL;
+  }
+  // Deleting the VBO unmaps it
+  mesh->ring_data = NULL;
+  mesh->ring_segment_size = 0;
+  mesh->ring_index = 0;
+}
+
+// Indexed meshes
+void nu_mesh_add_indices(nu_Mesh *mesh, size_t num_indices, const uint32_t *indices) {
+  if(!mesh || !indices || num_indices == 0) return;
+  if(!nu_mesh_check_loading(mesh, "nu_mesh_add_indices")) return;
+  size_t required = mesh->builder_indices_added + num_indices;
+  if(required > mesh->builder_indices_alloced) {
+    size_t new_alloced = mesh->builder_indices_alloced ? mesh->builder_indices_alloced : num_indices;
+    while(required > new_alloced) {
+      new_alloced *= 2;
+    }
+    uint32_t *new = realloc(mesh->builder_indices, new_alloced * sizeof(uint32_t));
+    if(!new) {
+      fprintf(stderr, "(nu_mesh_add_indices): Error adding indices to mesh, realloc failed.\n");
+      return;
+    }
+    mesh->builder_indices = new;
+    mesh->builder_indices_alloced = new_alloced;
+  }
+  memcpy(mesh->builder_indices + mesh->builder_indices_added, indices, num_indices * sizeof(uint32_t));
+  mesh->builder_indices_added += num_indices;
+  mesh->indices_dirty = true;
+}
+
+// Finds the first index past the last of num_vertices vertices, or returns
+// builder_indices_added if there are none
+static size_t nu_mesh_find_bad_index(nu_Mesh *mesh, size_t num_vertices) {
+  size_t i = 0;
+  while(i < mesh->builder_indices_added && mesh->builder_indices[i] < num_vertices) i++;
+  return i;
+}
+
+bool nu_mesh_weld(nu_Mesh *mesh) {
+  if(!mesh || !mesh->builder_data || mesh->stride == 0) return false;
+  if(!nu_mesh_check_loading(mesh, "nu_mesh_weld")) return false;
+  size_t stride = mesh->stride;
+  size_t num_vertices = mesh->builder_added / stride;
+  if(num_vertices == 0) return false;
+  // Everything that can fail is checked or allocated before the vertices
+  // are touched, so failing leaves the mesh as it was
+  size_t bad = nu_mesh_find_bad_index(mesh, num_vertices);
+  if(bad < mesh->builder_indices_added) {
+    fprintf(stderr, "(nu_mesh_weld): Couldn't weld mesh, index %zu is %u but the mesh has %zu vertices.\n", bad, mesh->builder_indices[bad], num_vertices);
+    return false;
+  }
+  if(mesh->builder_indices_added == 0 && mesh->builder_indices_alloced < num_vertices) {
+    uint32_t *indices = realloc(mesh->builder_indices, num_vertices * sizeof(uint32_t));
+    if(!indices) {
+      fprintf(stderr, "(nu_mesh_weld): Couldn't weld mesh, realloc failed.\n");
+      return false;
+    }
+    mesh->builder_indices = indices;
+    mesh->builder_indices_alloced = num_vertices;
+  }
+  // Open addressing table of compacted vertex indices, at most half full
+  size_t table_size = 1;
+  while(table_size < num_vertices * 2) table_size *= 2;
+  uint32_t *table = malloc(table_size * sizeof(uint32_t));
+  uint32_t *remap = malloc(num_vertices * sizeof(uint32_t));
+  if(!table || !remap) {
+    fprintf(stderr, "(nu_mesh_weld): Couldn't weld mesh, malloc failed.\n");
+    free(table);
+    free(remap);
+    return false;
+  }
+  memset(table, 0xFF, table_size * sizeof(uint32_t));
+
+  // Compact unique vertices to the front in place. A vertex only ever moves
+  // backwards, onto one that has already been visited
+  size_t num_unique = 0;
+  for(size_t i = 0; i < num_vertices; i++) {
+    uint8_t *vertex = mesh->builder_data + i * stride;
+    size_t slot = nu_hash_bytes(vertex, stride) & (table_size - 1);
+    while(table[slot] != UINT32_MAX) {
+      if(memcmp(mesh->builder_data + (size_t)table[slot] * stride, vertex, stride) == 0) break;
+      slot = (slot + 1) & (table_size - 1);
+    }
+    if(table[slot] == UINT32_MAX) {
+      if(num_unique != i) memcpy(mesh->builder_data + num_unique * stride, vertex, stride);
+      table[slot] = (uint32_t)num_unique++;
+    }
+    remap[i] = table[slot];
+  }
+  free(table);
+
+  if(mesh->builder_indices_added > 0) {
+    // Already indexed, point the indices at the welded vertices
+    for(size_t i = 0; i < mesh->builder_indices_added; i++) {
+      mesh->builder_indices[i] = remap[mesh->builder_indices[i]];
+    }
+    mesh->indices_dirty = true;
+  } else {
+    // The old vertex order becomes the index list, into the space made above
+    nu_mesh_add_indices(mesh, num_vertices, remap);
+  }
+  free(remap);
+  mesh->builder_added = num_unique * stride;
+  mesh->num_dirty_ranges = 0;
+  nu_mesh_mark_dirty(mesh, 0, mesh->builder_added);
+  return true;
+}
+
+// Forsyth's "Linear-Speed Vertex Cache Optimisation" scoring
+#define NU_VCACHE_SIZE 32
+
+static float nu_vcache_score(int cache_position, uint32_t remaining) {
+  if(remaining == 0) return -1.0f;
+  float score = 0.0f;
+  if(cache_position >= 0) {
+    // The last triangle's vertices get a fixed score, so strips don't win
+    if(cache_position < 3) {
+      score = 0.75f;
+    } else {
+      float x = 1.0f - (float)(cache_position - 3) / (NU_VCACHE_SIZE - 3);
+      score = x * sqrtf(x);
+    }
+  }
+  // Boost vertices with few triangles left, so they get finished off
+  return score + 2.0f / sqrtf((float)remaining);
+}
+
+void nu_mesh_optimize_vertex_cache(nu_Mesh *mesh) {
+  if(!mesh || mesh->builder_indices_added < 3 || mesh->stride == 0) return;
+  if(!nu_mesh_check_loading(mesh, "nu_mesh_optimize_vertex_cache")) return;
+  if(mesh->render_mode != GL_TRIANGLES || mesh->builder_indices_added % 3 != 0) {
+    fprintf(stderr, "(nu_mesh_optimize_vertex_cache): Only indexed GL_TRIANGLES meshes can be optimised.\n");
+    return;
+  }
+  uint32_t *indices = mesh->builder_indices;
+  size_t num_indices = mesh->builder_indices_added;
+  size_t num_triangles = num_indices / 3;
+  size_t num_vertices = 0;
+  for(size_t i = 0; i < num_indices; i++) {
+    if(indices[i] >= num_vertices) num_vertices = (size_t)indices[i] + 1;
+  }
+
+  // Per vertex: triangles using it (offsets into adjacency), remaining count,
+  // cache position and score. Per triangle: score and whether it was emitted
+  uint32_t *offsets = calloc(num_vertices + 1, sizeof(uint32_t));
+  uint32_t *remaining = calloc(num_vertices, sizeof(uint32_t));
+  uint32_t *adjacency = malloc(num_indices * sizeof(uint32_t));
+  int *cache_position = malloc(num_vertices * sizeof(int));
+  float *vertex_score = malloc(num_vertices * sizeof(float));
+  float *triangle_score = malloc(num_triangles * sizeof(float));
+  bool *emitted = calloc(num_triangles, sizeof(bool));
+  uint32_t *out = malloc(num_indices * sizeof(uint32_t));
+  if(!offsets || !remaining || !adjacency || !cache_position || !vertex_score || !triangle_score || !emitted || !out) {
+    fprintf(stderr, "(nu_mesh_optimize_vertex_cache): Couldn't optimise mesh, allocation failed.\n");
+    goto cleanup;
+  }
+  for(size_t i = 0; i < num_indices; i++) remaining[indices[i]]++;
+  for(size_t v = 0; v < num_vertices; v++) offsets[v + 1] = offsets[v] + remaining[v];
+  {
+    uint32_t *fill = calloc(num_vertices, sizeof(uint32_t));
+    if(!fill) {
+      fprintf(stderr, "(nu_mesh_optimize_vertex_cache): Couldn't optimise mesh, allocation failed.\n");
+      goto cleanup;
+    }
+    for(size_t i = 0; i < num_indices; i++) {
+      uint32_t v = indices[i];
+      adjacency[offsets[v] + fill[v]++] = (uint32_t)(i / 3);
+    }
+    free(fill);
+  }
+  for(size_t v = 0; v < num_vertices; v++) {
+    cache_position[v] = -1;
+    vertex_score[v] = nu_vcache_score(-1, remaining[v]);
+  }
+  for(size_t t = 0; t < num_triangles; t++) {
+    triangle_score[t] = vertex_score[indices[t * 3]] + vertex_score[indices[t * 3 + 1]] + vertex_score[indices[t * 3 + 2]];
+  }
+
+  // Simulated LRU cache, with room for the 3 vertices pushed in each step
+  uint32_t cache[NU_VCACHE_SIZE + 3];
+  size_t cache_count = 0;
+  size_t scan_cursor = 0;
+  size_t best = 0;
+  for(size_t t = 1; t < num_triangles; t++) {
+    if(triangle_score[t] > triangle_score[best]) best = t;
+  }
+  for(size_t emitted_count = 0; emitted_count < num_triangles; emitted_count++) {
+    if(best == SIZE_MAX) {
+      // Nothing in the cache touches an unemitted triangle, take the next one
+      while(emitted[scan_cursor]) scan_cursor++;
+      best = scan_cursor;
+    }
+    emitted[best] = true;
+    memcpy(out + emitted_count * 3, indices + best * 3, 3 * sizeof(uint32_t));
+
+    // Push the triangle's vertices to the front of the cache
+    uint32_t new_cache[NU_VCACHE_SIZE + 3];
+    size_t new_count = 0;
+    for(size_t k = 0; k < 3; k++) {
+      uint32_t v = indices[best * 3 + k];
+      new_cache[new_count++] = v;
+      // Remove the triangle from the vertex's remaining list
+      uint32_t *tris = adjacency + offsets[v];
+      for(uint32_t j = 0; j < remaining[v]; j++) {
+        if(tris[j] == best) {
+          tris[j] = tris[remaining[v] - 1];
+          remaining[v]--;
+          break;
+        }
+      }
+    }
+    for(size_t i = 0; i < cache_count; i++) {
+      uint32_t v = cache[i];
+      if(v != new_cache[0] && v != new_cache[1] && v != new_cache[2]) new_cache[new_count++] = v;
+    }
+    // Rescore everything that was in the cache, including what fell out
+    for(size_t i = 0; i < new_count; i++) {
+      uint32_t v = new_cache[i];
+      cache_position[v] = i < NU_VCACHE_SIZE ? (int)i : -1;
+      vertex_score[v] = nu_vcache_score(cache_position[v], remaining[v]);
+    }
+    // The next triangle is the best one touching the cache
+    best = SIZE_MAX;
+    float best_score = -1.0f;
+    for(size_t i = 0; i < new_count; i++) {
+      uint32_t v = new_cache[i];
+      for(uint32_t j = 0; j < remaining[v]; j++) {
+        uint32_t tri = adjacency[offsets[v] + j];
+        float score = vertex_score[indices[tri * 3]] + vertex_score[indices[tri * 3 + 1]] + vertex_score[indices[tri * 3 + 2]];
+        triangle_score[tri] = score;
+        if(score > best_score) {
+          best_score = score;
+          best = tri;
+        }
+      }
+    }
+    cache_count = new_count < NU_VCACHE_SIZE ? new_count : NU_VCACHE_SIZE;
+    memcpy(cache, new_cache, cache_count * sizeof(uint32_t));
+  }
+  memcpy(indices, out, num_indices * sizeof(uint32_t));
+  mesh->indices_dirty = true;
+
+cleanup:
+  free(offsets);
+  free(remaining);
+  free(adjacency);
+  free(cache_position);
+  free(vertex_score);
+  free(triangle_score);
+  free(emitted);
+  free(out);
+}
+
+void nu_mesh_optimize_vertex_fetch(nu_Mesh *mesh) {
+  if(!mesh || !mesh->builder_data || mesh->builder_indices_added == 0 || mesh->stride == 0) return;
+  if(!nu_mesh_check_loading(mesh, "nu_mesh_optimize_vertex_fetch")) return;
+  size_t stride = mesh->stride;
+  size_t num_vertices = mesh->builder_added / stride;
+  size_t bad = nu_mesh_find_bad_index(mesh, num_vertices);
+  if(bad < mesh->builder_indices_added) {
+    fprintf(stderr, "(nu_mesh_optimize_vertex_fetch): Couldn't optimise mesh, index %zu is %u but the mesh has %zu vertices.\n", bad, mesh->builder_indices[bad], num_vertices);
+    return;
+  }
+  uint32_t *remap = malloc(num_vertices * sizeof(uint32_t));
+  uint8_t *new_data = malloc(mesh->builder_alloced);
+  if(!remap || !new_data) {
+    fprintf(stderr, "(nu_mesh_optimize_vertex_fetch): Couldn't optimise mesh, malloc failed.\n");
+    free(remap);
+    free(new_data);
+    return;
+  }
+  memset(remap, 0xFF, num_vertices * sizeof(uint32_t));
+  // Vertices are numbered in the order the indices first reach them
+  size_t num_used = 0;
+  for(size_t i = 0; i < mesh->builder_indices_added; i++) {
+    uint32_t index = mesh->builder_indices[i];
+    if(remap[index] == UINT32_MAX) {
+      memcpy(new_data + num_used * stride, mesh->builder_data + (size_t)index * stride, stride);
+      remap[index] = (uint32_t)num_used++;
+    }
+    mesh->builder_indices[i] = remap[index];
+  }
+  free(remap);
+  free(mesh->builder_data);
+  mesh->builder_data = new_data;
+  mesh->builder_added = num_used * stride;
+  mesh->num_dirty_ranges = 0;
+  nu_mesh_mark_dirty(mesh, 0, mesh->builder_added);
+  mesh->indices_dirty = true;
+}
+
+// Instancing
+// Attribute locations a layout takes, components over 4 values take several
+static GLuint nu_count_locations(size_t num_components, const nu_MeshComponent *components) {
+  GLuint locations = 0;
+  for(size_t i = 0; i < num_components; i++) {
+    locations += (components[i].count + 3) / 4;
+  }
+  return locations;
+}
+
+bool nu_mesh_set_instance_components(nu_Mesh *mesh, size_t num_components, const nu_MeshComponent *instance_components) {
+  if(!mesh || !mesh->VAO) return false;
+  if(num_components == 0 || !instance_components) {
+    fprintf(stderr, "(nu_mesh_set_instance_components): Couldn't set instance layout, layout has 0 components.\n");
+    return false;
+  }
+  size_t stride = 0;
+  for(size_t i = 0; i < num_components; i++) {
+    size_t bytes = nu_component_bytes(&instance_components[i]);
+    if(bytes == 0) {
+      fprintf(stderr, "(nu_mesh_set_instance_components): Couldn't set instance layout, component %zu is empty, or packed without 4 values.\n", i);
+      return false;
+    }
+    stride += bytes;
+  }
+  nu_MeshComponent *components = calloc(num_components, sizeof(nu_MeshComponent));
+  if(!components) {
+    fprintf(stderr, "(nu_mesh_set_instance_components): Couldn't set instance layout, calloc failed.\n");
+    return false;
+  }
+  memcpy(components, instance_components, num_components * sizeof(nu_MeshComponent));
+
+  if(!mesh->instance_VBO) {
+    glGenBuffers(1, &mesh->instance_VBO);
+    nu_count_objects(NU_GPU_BUFFER, 1, 0);
+  }
+  nu_state_bind_vertex_array(mesh->VAO);
+  nu_state_bind_array_buffer(mesh->instance_VBO);
+  // Instance attributes go after however many locations the vertices use.
+  // Turn off the old layout's, so a smaller layout doesn't leave stale
+  // attributes enabled
+  GLuint first_location = nu_count_locations(mesh->num_components, mesh->components);
+  GLuint old_locations = nu_count_locations(mesh->num_instance_components, mesh->instance_components);
+  for(GLuint i = 0; i < old_locations; i++) {
+    glDisableVertexAttribArray(first_location + i);
+  }
+  if(mesh->instance_components) free(mesh->instance_components);
+  mesh->instance_components = components;
+  mesh->num_instance_components = num_components;
+  mesh->instance_stride = stride;
+  // The old store stays alive, and counted, until the next
+  // nu_mesh_set_instances replaces it
+  mesh->instance_count = 0;
+  nu_apply_components(first_location, num_components, components, stride, 1);
+  return true;
+}
+
+bool nu_mesh_set_instance_layout(nu_Mesh *mesh, size_t num_components, size_t *component_sizes, size_t *component_counts, GLenum *component_types) {
+  nu_MeshComponent *components = nu_make_components(num_components, component_sizes, component_counts, component_types);
+  if(num_components > 0 && !components) {
+    fprintf(stderr, "(nu_mesh_set_instance_layout): Couldn't set instance layout, calloc failed.\n");
+    return false;
+  }
+  bool result = nu_mesh_set_instance_components(mesh, num_components, components);
+  free(components);
+  return result;
+}
+
+void nu_mesh_set_instances(nu_Mesh *mesh, size_t num_instances, void *data) {
+  if(!mesh || !mesh->instance_VBO) return;
+  mesh->instance_count = 0;
+  if(num_instances == 0 || !data) return;
+  size_t size = num_instances * mesh->instance_stride;
+  nu_state_bind_array_buffer(mesh->instance_VBO);
+  // Orphan the old store and upload into a fresh one, keeping the largest
+  // size seen so the driver can recycle stores
+  size_t alloced = size > mesh->instance_alloced ? size : mesh->instance_alloced;
+  glBufferData(GL_ARRAY_BUFFER, alloced, NULL, GL_STREAM_DRAW);
+  nu_count_objects(NU_GPU_BUFFER, 0, (int64_t)alloced - (int64_t)mesh->instance_alloced);
+  mesh->instance_alloced = alloced;
+  glBufferSubData(GL_ARRAY_BUFFER, 0, size, data);
+  nu_counters->buffer_upload_bytes += size;
+  mesh->instance_count = num_instances;
+}
+
+void nu_destroy_mesh(nu_Mesh **mesh) {
+  if(!mesh || !(*mesh)) return;
+  // The loader still holds the mesh, and publishes into it
+  if(!nu_mesh_check_loading(*mesh, "nu_destroy_mesh")) return;
+  if((*mesh)->builder_data) free((*mesh)->builder_data);
+  if((*mesh)->mapped_data) nu_mesh_end_mapped(*mesh);
+  nu_mesh_delete_ring(*mesh);
+  if((*mesh)->VAO) glDeleteVertexArrays(1, &(*mesh)->VAO);
+  if((*mesh)->VBO) glDeleteBuffers(1, &(*mesh)->VBO);
+  if((*mesh)->EBO) glDeleteBuffers(1, &(*mesh)->EBO);
+  if((*mesh)->instance_VBO) glDeleteBuffers(1, &(*mesh)->instance_VBO);
+  nu_state_forget_vertex_array((*mesh)->VAO);
+  nu_state_forget_buffer((*mesh)->VBO);
+  nu_state_forget_buffer((*mesh)->instance_VBO);
+  if((*mesh)->VAO) nu_count_objects(NU_GPU_VERTEX_ARRAY, -1, 0);
+  if((*mesh)->VBO) nu_count_objects(NU_GPU_BUFFER, -1, -(int64_t)(*mesh)->gpu_alloced);
+  if((*mesh)->EBO) nu_count_objects(NU_GPU_BUFFER, -1, -(int64_t)(*mesh)->index_alloced);
+  if((*mesh)->instance_VBO) nu_count_objects(NU_GPU_BUFFER, -1, -(int64_t)(*mesh)->instance_alloced);
+  if((*mesh)->instance_components) free((*mesh)->instance_components);
+  if((*mesh)->builder_indices) free((*mesh)->builder_indices);
+  if((*mesh)->components) free((*mesh)->components);
+  free(*mesh);
+  *mesh = NULL;
+}
+
+void nu_free_mesh(nu_Mesh *mesh) {
+  if(!mesh) return;
+  if(!nu_mesh_check_loading(mesh, "nu_free_mesh")) return;
+  if(mesh->builder_data) free(mesh->builder_data);
+  mesh->builder_data = NULL;
+  mesh->builder_added = 0;
+  mesh->builder_alloced = 0;
+  mesh->num_dirty_ranges = 0;
+  if(mesh->builder_indices) free(mesh->builder_indices);
+  mesh->builder_indices = NULL;
+  mesh->builder_indices_added = 0;
+  mesh->builder_indices_alloced = 0;
+  mesh->indices_dirty = false;
+}
+
+void nu_mesh_set_render_mode(nu_Mesh *mesh, GLenum render_mode) {
+  if(!mesh) return;
+  mesh->render_mode = render_mode;
+}
+
+static GLenum nu_mesh_gl_usage(nu_Mesh *mesh) {
+  return mesh->usage == NU_MESH_STATIC ? GL_STATIC_DRAW : GL_DYNAMIC_DRAW;
+}
+
+// Moves a streaming mesh on to its next ring segment, making sure segments
+// hold at least size bytes. Returns a pointer to the segment, or NULL
+static uint8_t *nu_mesh_next_segment(nu_Mesh *mesh, size_t size) {
+  if(!mesh->ring_data || size > mesh->ring_segment_size) {
+    // Immutable storage can't be resized, so the VBO is replaced and the VAO
+    // pointed at the new one. Segments hold whole vertices, so a segment
+    // starts at a vertex index
+    size_t segment_size = mesh->ring_segment_size * 2;
+    if(segment_size < size) segment_size = size;
+    segment_size = (segment_size + mesh->stride - 1) / mesh->stride * mesh->stride;
+    nu_mesh_delete_ring(mesh);
+    glDeleteBuffers(1, &mesh->VBO);
+    nu_state_forget_buffer(mesh->VBO);
+    glGenBuffers(1, &mesh->VBO);
+    nu_bind_mesh(mesh);
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glBufferStorage(GL_ARRAY_BUFFER, segment_size * NU_MESH_RING_SEGMENTS, NULL, flags);
+    nu_count_objects(NU_GPU_BUFFER, 0, (int64_t)(segment_size * NU_MESH_RING_SEGMENTS) - (int64_t)mesh->gpu_alloced);
+    mesh->gpu_alloced = segment_size * NU_MESH_RING_SEGMENTS;
+    mesh->ring_data = glMapBufferRange(GL_ARRAY_BUFFER, 0, segment_size * NU_MESH_RING_SEGMENTS, flags);
+    nu_apply_layout(mesh);
+    if(!mesh->ring_data) {
+      fprintf(stderr, "(nu_mesh_next_segment): Couldn't map streaming buffer, glMapBufferRange() returned NULL.\n");
+      return NULL;
+    }
+    mesh->ring_segment_size = segment_size;
+    mesh->ring_index = 0;
+  } else {
+    // Fence the segment draws have been reading, then move on to the next,
+    // waiting if the GPU is still reading it from NU_MESH_RING_SEGMENTS sends ago
+    if(mesh->ring_fences[mesh->ring_index]) glDeleteSync(mesh->ring_fences[mesh->ring_index]);
+    mesh->ring_fences[mesh->ring_index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    mesh->ring_index = (mesh->ring_index + 1) % NU_MESH_RING_SEGMENTS;
+    nu_wait_fence(&mesh->ring_fences[mesh->ring_index]);
+  }
+  mesh->draw_first = mesh->ring_index * mesh->ring_segment_size / mesh->stride;
+  return mesh->ring_data + mesh->ring_index * mesh->ring_segment_size;
+}
+
+// Packs a meshes indices for upload, halving the index buffer whenever every
+// index fits in 16 bits. Returns the data to upload, which *short_indices
+// owns if it had to be converted
+static void *nu_pack_indices(nu_Mesh *mesh, GLenum *index_type, size_t *index_size, uint16_t **short_indices) {
+  uint32_t max_index = 0;
+  for(size_t i = 0; i < mesh->builder_indices_added; i++) {
+    if(mesh->builder_indices[i] > max_index) max_index = mesh->builder_indices[i];
+  }
+  *index_type = GL_UNSIGNED_INT;
+  *index_size = sizeof(uint32_t);
+  *short_indices = NULL;
+  if(max_index <= UINT16_MAX) {
+    *short_indices = malloc(mesh->builder_indices_added * sizeof(uint16_t));
+    if(*short_indices) {
+      for(size_t i = 0; i < mesh->builder_indices_added; i++) (*short_indices)[i] = (uint16_t)mesh->builder_indices[i];
+      *index_type = GL_UNSIGNED_SHORT;
+      *index_size = sizeof(uint16_t);
+      return *short_indices;
+    }
+  }
+  return mesh->builder_indices;
+}
+
+static void nu_send_mesh_indices(nu_Mesh *mesh) {
+  mesh->indices_dirty = false;
+  mesh->index_count = 0;
+  if(mesh->builder_indices_added == 0) return;
+  size_t index_size;
+  uint16_t *short_indices;
+  void *data = nu_pack_indices(mesh, &mesh->index_type, &index_size, &short_indices);
+  // The element buffer binding is VAO state, so it's set up with the VAO bound
+  nu_state_bind_vertex_array(mesh->VAO);
+  if(!mesh->EBO) {
+    glGenBuffers(1, &mesh->EBO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->EBO);
+    nu_count_objects(NU_GPU_BUFFER, 1, 0);
+  }
+  size_t size = mesh->builder_indices_added * index_size;
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, nu_mesh_gl_usage(mesh));
+  free(short_indices);
+  nu_count_objects(NU_GPU_BUFFER, 0, (int64_t)size - (int64_t)mesh->index_alloced);
+  mesh->index_alloced = size;
+  nu_counters->buffer_upload_bytes += size;
+  mesh->index_count = mesh->builder_indices_added;
+}
+
+bool nu_mesh_begin_mapped(nu_Mesh *mesh, size_t max_vertices) {
+  if(!mesh || max_vertices == 0) return false;
+  if(!mesh->VAO || !mesh->VBO) return false;
+  if(!nu_mesh_check_loading(mesh, "nu_mesh_begin_mapped")) return false;
+  if(mesh->mapped_data) {
+    fprintf(stderr, "(nu_mesh_begin_mapped): Mesh is already mapped.\n");
+    return false;
+  }
+  size_t size = max_vertices * mesh->stride;
+  if(mesh->usage == NU_MESH_STREAM) {
+    // The ring is always mapped, just write into the next segment
+    mesh->mapped_data = nu_mesh_next_segment(mesh, size);
+  } else {
+    nu_state_bind_array_buffer(mesh->VBO);
+    // Orphan the old store, the mapping never has to wait on previous draws
+    glBufferData(GL_ARRAY_BUFFER, size, NULL, nu_mesh_gl_usage(mesh));
+    mesh->mapped_data = glMapBufferRange(GL_ARRAY_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_FLUSH_EXPLICIT_BIT);
+    nu_count_objects(NU_GPU_BUFFER, 0, (int64_t)size - (int64_t)mesh->gpu_alloced);
+    mesh->gpu_alloced = size;
+    mesh->draw_first = 0;
+  }
+  if(!mesh->mapped_data) {
+    fprintf(stderr, "(nu_mesh_begin_mapped): Couldn't map mesh buffer of %zu bytes, glMapBufferRange() returned NULL.\n", size);
+    mesh->last_send_size = 0;
+    return false;
+  }
+  mesh->mapped_alloced = size;
+  mesh->mapped_added = 0;
+  return true;
+}
+
+void nu_mesh_end_mapped(nu_Mesh *mesh) {
+  if(!mesh || !mesh->mapped_data) return;
+  GLboolean intact = GL_TRUE;
+  // Streaming rings are coherent and stay mapped
+  if(mesh->usage != NU_MESH_STREAM) {
+    nu_state_bind_array_buffer(mesh->VBO);
+    // Only the part that was written needs to reach the GPU
+    if(mesh->mapped_added > 0) glFlushMappedBufferRange(GL_ARRAY_BUFFER, 0, mesh->mapped_added);
+    intact = glUnmapBuffer(GL_ARRAY_BUFFER);
+  }
+  mesh->last_send_size = intact ? mesh->mapped_added : 0;
+  nu_counters->buffer_upload_bytes += mesh->mapped_added;
+  if(mesh->indices_dirty) nu_send_mesh_indices(mesh);
+  // The GPU copy no longer matches the builder, the next send must be whole
+  nu_mesh_mark_dirty(mesh, 0, mesh->builder_added);
+  if(!intact) {
+    fprintf(stderr, "(nu_mesh_end_mapped): Mesh buffer contents were lost while mapped, rebuild the mesh.\n");
+  }
+  mesh->mapped_data = NULL;
+  mesh->mapped_alloced = 0;
+  mesh->mapped_added = 0;
+}
+
+void nu_send_mesh(nu_Mesh *mesh) {
+  NU_PROFILE_FUNCTION();
+  if(!mesh) return;
+  if(!mesh->builder_data) return;
+  if(!mesh->VAO || !mesh->VBO) return;
+  if(mesh->loading) {
+    fprintf(stderr, "(nu_send_mesh): Couldn't send mesh, a nu_Loader is still uploading it.\n");
+    return;
+  }
+  if(mesh->mapped_data) {
+    fprintf(stderr, "(nu_send_mesh): Couldn't send mesh, it is mapped. Use nu_mesh_end_mapped().\n");
+    return;
+  }
+  switch(mesh->usage) {
+    case NU_MESH_STREAM: {
+      uint8_t *segment = nu_mesh_next_segment(mesh, mesh->builder_added);
+      if(!segment) {
+        mesh->last_send_size = 0;
+        return;
+      }
+      memcpy(segment, mesh->builder_data, mesh->builder_added);
+      nu_counters->buffer_upload_bytes += mesh->builder_added;
+      break;
+    }
+    case NU_MESH_DYNAMIC:
+      nu_state_bind_array_buffer(mesh->VBO);
+      // Orphan the old store instead of waiting for draws still reading it.
+      // Keeping the allocation size lets the driver recycle stores
+      if(mesh->builder_added > mesh->gpu_alloced) {
+        nu_count_objects(NU_GPU_BUFFER, 0, (int64_t)mesh->builder_added - (int64_t)mesh->gpu_alloced);
+        mesh->gpu_alloced = mesh->builder_added;
+      }
+      glBufferData(GL_ARRAY_BUFFER, mesh->gpu_alloced, NULL, GL_DYNAMIC_DRAW);
+      glBufferSubData(GL_ARRAY_BUFFER, 0, mesh->builder_added, mesh->builder_data);
+      nu_counters->buffer_upload_bytes += mesh->builder_added;
+      break;
+    case NU_MESH_STATIC:
+    default:
+      nu_state_bind_array_buffer(mesh->VBO);
+      if(mesh->builder_added > mesh->gpu_alloced) {
+        // Grow geometrically, so meshes that keep growing don't reallocate on
+        // every send. A new store needs everything uploaded
+        size_t new_alloced = mesh->gpu_alloced * 2;
+        if(new_alloced < mesh->builder_added) new_alloced = mesh->builder_added;
+        if(new_alloced == mesh->builder_added) {
+          glBufferData(GL_ARRAY_BUFFER, new_alloced, mesh->builder_data, GL_STATIC_DRAW);
+        } else {
+          glBufferData(GL_ARRAY_BUFFER, new_alloced, NULL, GL_STATIC_DRAW);
+          glBufferSubData(GL_ARRAY_BUFFER, 0, mesh->builder_added, mesh->builder_data);
+        }
+        nu_count_objects(NU_GPU_BUFFER, 0, (int64_t)new_alloced - (int64_t)mesh->gpu_alloced);
+        mesh->gpu_alloced = new_alloced;
+        nu_counters->buffer_upload_bytes += mesh->builder_added;
+      } else {
+        // Only upload what changed since the last send
+        for(size_t i = 0; i < mesh->num_dirty_ranges; i++) {
+          nu_MeshRange range = mesh->dirty_ranges[i];
+          if(range.start >= mesh->builder_added) break;
+          if(range.end > mesh->builder_added) range.end = mesh->builder_added;
+          glBufferSubData(GL_ARRAY_BUFFER, range.start, range.end - range.start, mesh->builder_data + range.start);
+          nu_counters->buffer_upload_bytes += range.end - range.start;
+        }
+      }
+      break;
+  }
+  mesh->num_dirty_ranges = 0;
+  mesh->last_send_size = mesh->builder_added;
+  if(mesh->indices_dirty) nu_send_mesh_indices(mesh);
+}
+
+// Issues the draw call for a bound mesh. instances is 0 for a non-instanced draw
+static void nu_draw_mesh(nu_Mesh *mesh, size_t instances) {
+  nu_upload_uniform_blocks();
+  size_t copies = instances > 0 ? instances : 1;
+  nu_counters->draw_calls++;
+  nu_counters->instances += copies;
+  nu_counters->vertices += (mesh->index_count > 0 ? mesh->index_count : mesh->last_send_size / mesh->stride) * copies;
+  // draw_first offsets the indices into the current streaming ring segment
+  if(mesh->index_count > 0) {
+    if(instances > 0) {
+      glDrawElementsInstancedBaseVertex(mesh->render_mode, mesh->index_count, mesh->index_type, NULL, instances, mesh->draw_first);
+    } else {
+      glDrawElementsBaseVertex(mesh->render_mode, mesh->index_count, mesh->index_type, NULL, mesh->draw_first);
+    }
+  } else {
+    if(instances > 0) {
+      glDrawArraysInstanced(mesh->render_mode, mesh->draw_first, mesh->last_send_size / mesh->stride, instances);
+    } else {
+      glDrawArrays(mesh->render_mode, mesh->draw_first, mesh->last_send_size / mesh->stride);
+    }
+  }
+}
+
+void nu_render_mesh_instanced(nu_Mesh *mesh, size_t count) {
+  NU_PROFILE_FUNCTION();
+  if(!mesh || count == 0) return;
+  if(mesh->last_send_size == 0 || mesh->mapped_data || mesh->loading) return;
+  if(mesh->instance_VBO && count > mesh->instance_count) {
+    fprintf(stderr, "(nu_render_mesh_instanced): Couldn't render %zu instances, mesh only has data for %zu.\n", count, mesh->instance_count);
+    return;
+  }
+  nu_state_bind_vertex_array(mesh->VAO);
+  nu_draw_mesh(mesh, count);
+}
+
+void nu_render_mesh(nu_Mesh *mesh) {
+  NU_PROFILE_FUNCTION();
+  if(!mesh) return;
+  if(mesh->last_send_size == 0 || mesh->mapped_data || mesh->loading) return;
+  nu_state_bind_vertex_array(mesh->VAO);
+  nu_draw_mesh(mesh, 0);
+}
+
+void nu_update_input(nu_Window *window) {
+  if(!window) return;
+  // Apply this frame's events before they become the previous input
+  nu_drain_input(window);
+  // Update previous input
+  memcpy(window->last_keys, window->keys, sizeof(window->keys));
+  memset(window->key_downs, 0, sizeof(window->key_downs));
+  window->num_frame_events = 0;
+  window->last_mouse_x = window->mouse_x;
+  window->last_mouse_y = window->mouse_y;
+  window->last_mouse_left = window->mouse_left;
+  window->last_mouse_right = window->mouse_right;
+}
+
+// Renderer counters
+nu_RenderCounters nu_get_render_counters(nu_Window *window) {
+  nu_RenderCounters counters = {0};
+  if(!window) return counters;
+  counters = window->counters;
+  memcpy(counters.live_objects, nu_live_objects, sizeof(nu_live_objects));
+  memcpy(counters.live_bytes, nu_live_bytes, sizeof(nu_live_bytes));
+  return counters;
+}
+
+bool nu_log_render_counters(nu_Window *window, size_t num_frames) {
+  if(!window) return false;
+  free(window->counter_log);
+  window->counter_log = NULL;
+  window->counter_log_size = 0;
+  window->num_logged_frames = 0;
+  if(num_frames == 0) return true;
+  window->counter_log = calloc(num_frames, sizeof(nu_RenderCounters));
+  if(!window->counter_log) {
+    fprintf(stderr, "(nu_log_render_counters): Couldn't log %zu frames, calloc failed.\n", num_frames);
+    return false;
+  }
+  window->counter_log_size = num_frames;
+  return true;
+}
+
+bool nu_export_render_counters(nu_Window *window, const char *csv_loc) {
+  if(!window || !csv_loc) return false;
+  FILE *file = fopen(csv_loc, "w");
+  if(!file) {
+    fprintf(stderr, "(nu_export_render_counters): Couldn't write %s, fopen returned NULL.\n", csv_loc);
+    return false;
+  }
+  fprintf(file, "frame,draw_calls,vertices,instances,buffer_upload_bytes,texture_upload_bytes,program_binds,vertex_array_binds,texture_binds,uniform_sets,"
+                "buffers,buffer_bytes,textures,texture_bytes,vertex_arrays,programs\n");
+  size_t logged = window->num_logged_frames < window->counter_log_size ? window->num_logged_frames : window->counter_log_size;
+  for(size_t i = window->num_logged_frames - logged; i < window->num_logged_frames; i++) {
+    const nu_RenderCounters *c = &window->counter_log[i % window->counter_log_size];
+    fprintf(file, "%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu,%zu\n", i,
+            c->draw_calls, c->vertices, c->instances, c->buffer_upload_bytes, c->texture_upload_bytes,
+            c->program_binds, c->vertex_array_binds, c->texture_binds, c->uniform_sets,
+            c->live_objects[NU_GPU_BUFFER], c->live_bytes[NU_GPU_BUFFER], c->live_objects[NU_GPU_TEXTURE], c->live_bytes[NU_GPU_TEXTURE],
+            c->live_objects[NU_GPU_VERTEX_ARRAY], c->live_objects[NU_GPU_PROGRAM]);
+  }
+  if(fclose(file) != 0) {
+    fprintf(stderr, "(nu_export_render_counters): Couldn't write %s, fclose failed.\n", csv_loc);
+    return false;
+  }
+  return true;
+}
+
+// Logs the frame the window just finished, if it was the one counting, then
+// starts counting the next on it
+static void nu_next_counter_frame(nu_Window *window) {
+  if(window->counter_log && nu_counters == &window->counters) {
+    window->counter_log[window->num_logged_frames++ % window->counter_log_size] = nu_get_render_counters(window);
+  }
+  memset(&window->counters, 0, sizeof(window->counters));
+  nu_counters = &window->counters;
+}
+
+void nu_start_frame(nu_Window *window) {
+#ifdef NUGL_PROFILE
+  nu_profile_next_frame();
+#endif
+  if(window) nu_next_counter_frame(window);
+  // Keep the public input fields current even if nothing is queried
+  if(window) nu_drain_input(window);
+  if(!window || (!window->glfw_window && !window->headless) || !window->focused) return;
+  // Clear screen
+  glClearColor(0, 0, 0, 1);
+  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+// Frame pacing
+void nu_set_swap_interval(nu_Window *window, int interval) {
+  if(!window) return;
+  window->swap_interval = interval;
+  // A surfaceless headless context has nothing to swap
+  if(window->glfw_window) glfwSwapInterval(interval);
+}
+
+void nu_set_target_fps(nu_Window *window, double fps) {
+  if(!window) return;
+  window->target_frame_ns = fps > 0.0 ? (uint64_t)(1e9 / fps) : 0;
+  window->next_frame_ns = 0;
+}
+
+// Sleeps until spin_ns before the deadline, then spins the rest of the way,
+// as sleeps wake late by up to a scheduler tick
+static void nu_wait_until(nu_Window *window, uint64_t deadline) {
+  uint64_t now = nu_get_time_ns();
+  if(now + window->spin_ns < deadline) {
+    uint64_t wake = deadline - window->spin_ns;
+    uint64_t sleep_ns = wake - now;
+    struct timespec ts = {(time_t)(sleep_ns / 1000000000ull), (long)(sleep_ns % 1000000000ull)};
+    nanosleep(&ts, NULL);
+    now = nu_get_time_ns();
+    // Follow how late sleeps wake, with some headroom
+    uint64_t late = now > wake ? now - wake : 0;
+    uint64_t spin = (window->spin_ns * 7 + late * 2) / 8;
+    window->spin_ns = spin < 100000 ? 100000 : spin > 4000000 ? 4000000 : spin;
+  }
+  while(nu_get_time_ns() < deadline);
+}
+
+// Holds the frame back for the target frame rate, returns the time waited
+static uint64_t nu_limit_frame(nu_Window *window) {
+  if(window->target_frame_ns == 0) return 0;
+  uint64_t now = nu_get_time_ns();
+  // Deadlines step by whole frames, so one slow frame doesn't make the next
+  // ones run short. A frame more than a whole period late starts over
+  if(window->next_frame_ns == 0 || now > window->next_frame_ns + window->target_frame_ns) {
+    window->next_frame_ns = now + window->target_frame_ns;
+    return 0;
+  }
+  uint64_t deadline = window->next_frame_ns;
+  window->next_frame_ns += window->target_frame_ns;
+  if(now >= deadline) return 0;
+  nu_wait_until(window, deadline);
+  return nu_get_time_ns() - now;
+}
+
+static void nu_record_frame(nu_Window *window, uint64_t work_end, uint64_t swap_ns, uint64_t wait_ns) {
+  uint64_t now = nu_get_time_ns();
+  nu_FrameTiming *timing = &window->frame_history[window->num_frames++ % NU_FRAME_HISTORY];
+  timing->frame_ns = now - window->frame_start_ns;
+  timing->cpu_ns = work_end - window->frame_start_ns;
+  timing->swap_ns = swap_ns;
+  timing->wait_ns = wait_ns;
+  window->frame_start_ns = now;
+}
+
+static int nu_compare_u64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+nu_FrameStats nu_get_frame_stats(nu_Window *window) {
+  nu_FrameStats stats = {0};
+  if(!window || window->num_frames == 0) return stats;
+  size_t frames = window->num_frames < NU_FRAME_HISTORY ? window->num_frames : NU_FRAME_HISTORY;
+  // Limited frames land a little either side of the target, so only ones
+  // 10% over it count
+  uint64_t budget = window->target_frame_ns ? window->target_frame_ns : 1000000000ull / 60;
+  budget += budget / 10;
+  uint64_t sorted[NU_FRAME_HISTORY];
+  uint64_t total = 0, cpu = 0, swap = 0, wait = 0;
+  for(size_t i = 0; i < frames; i++) {
+    const nu_FrameTiming *timing = &window->frame_history[i];
+    sorted[i] = timing->frame_ns;
+    total += timing->frame_ns;
+    cpu += timing->cpu_ns;
+    swap += timing->swap_ns;
+    wait += timing->wait_ns;
+    if(timing->frame_ns > budget) stats.over_budget++;
+    size_t bucket = timing->frame_ns / 2000000;
+    stats.histogram[bucket < NU_FRAME_HISTOGRAM_BUCKETS ? bucket : NU_FRAME_HISTOGRAM_BUCKETS - 1]++;
+  }
+  qsort(sorted, frames, sizeof(uint64_t), nu_compare_u64);
+  stats.frames = frames;
+  stats.avg_ms = total / 1e6 / frames;
+  stats.p50_ms = sorted[frames / 2] / 1e6;
+  stats.p99_ms = sorted[(frames - 1) * 99 / 100] / 1e6;
+  stats.max_ms = sorted[frames - 1] / 1e6;
+  stats.cpu_ms = cpu / 1e6 / frames;
+  stats.swap_ms = swap / 1e6 / frames;
+  stats.wait_ms = wait / 1e6 / frames;
+  return stats;
+}
+
+void nu_end_frame(nu_Window *window) {
+  if(!window) return;
+  uint64_t work_end = nu_get_time_ns();
+  if(window->headless) {
+    // Nothing to present, just make sure the frame is submitted
+    glFlush();
+    uint64_t swap_ns = nu_get_time_ns() - work_end;
+    nu_record_frame(window, work_end, swap_ns, nu_limit_frame(window));
+    return;
+  }
+  if(!window->glfw_window) return;
+  if(window->input_thread) {
+    // The main thread takes the events, this one only presents, or waits
+    // for focus to come back
+    if(window->focused) {
+      glfwSwapBuffers(window->glfw_window);
+      uint64_t swap_ns = nu_get_time_ns() - work_end;
+      nu_record_frame(window, work_end, swap_ns, nu_limit_frame(window));
+      return;
+    }
+    pthread_mutex_lock(&window->focus_mutex);
+    while(!window->focused) pthread_cond_wait(&window->focus_changed, &window->focus_mutex);
+    pthread_mutex_unlock(&window->focus_mutex);
+    window->frame_start_ns = nu_get_time_ns();
+    return;
+  }
+  if(window->focused) {
+    glfwSwapBuffers(window->glfw_window);
+    uint64_t swap_ns = nu_get_time_ns() - work_end;
+    // Events are polled after the limiter's wait, so the next frame starts
+    // from the freshest input
+    uint64_t wait_ns = nu_limit_frame(window);
+    glfwPollEvents();
+    nu_record_frame(window, work_end, swap_ns, wait_ns);
+    return;
+  }
+  glfwWaitEvents();
+  // Time spent unfocused isn't a frame
+  window->frame_start_ns = nu_get_time_ns();
+}
+
+typedef struct {
+  nu_Window *window;
+  void (*render_fn)(nu_Window *window, void *user_data);
+  void *user_data;
+} nu_RenderThread;
+
+static void *nu_render_thread(void *arg) {
+  nu_RenderThread *render = arg;
+  glfwMakeContextCurrent(render->window->glfw_window);
+  render->render_fn(render->window, render->user_data);
+  glfwMakeContextCurrent(NULL);
+  render->window->input_thread = false;
+  // Wake the main thread out of glfwWaitEvents
+  glfwPostEmptyEvent();
+  return NULL;
+}
+
+bool nu_run_with_input_thread(nu_Window *window, void (*render_fn)(nu_Window *window, void *user_data), void *user_data) {
+  if(!window || !render_fn) return false;
+  if(!window->glfw_window) {
+    fprintf(stderr, "(nu_run_with_input_thread): Couldn't start the render thread, the window has no GLFW window to take events from.\n");
+    return false;
+  }
+  nu_RenderThread render = {window, render_fn, user_data};
+  window->input_thread = true;
+  // The context can only be current on one thread
+  glfwMakeContextCurrent(NULL);
+  pthread_t thread;
+  if(pthread_create(&thread, NULL, nu_render_thread, &render) != 0) {
+    fprintf(stderr, "(nu_run_with_input_thread): Couldn't start the render thread, pthread_create failed.\n");
+    window->input_thread = false;
+    glfwMakeContextCurrent(window->glfw_window);
+    return false;
+  }
+  while(window->input_thread) glfwWaitEvents();
+  pthread_join(thread, NULL);
+  glfwMakeContextCurrent(window->glfw_window);
+  return true;
+}
+
+// Block compression
+// BC1/BC3/BC4/BC5 encoders for 4x4 texel blocks. Colors are fit along the
+// block's principal axis then refined once by least squares, single
+// channels (BC3 alpha, BC4, BC5) span the channel's min and max. Matching
+// texels to palette entries is the hot loop and uses SSE2 where available
+#define NU_MAX_ENCODE_THREADS 16
+
+static long nu_cpu_count(void) {
+  long cores = 1;
+#ifdef _SC_NPROCESSORS_ONLN
+  cores = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  return cores > 0 ? cores : 1;
+}
+
+static size_t nu_block_bytes(nu_TextureFormat format) {
+  switch(format) {
+    case NU_TEXTURE_BC1: case NU_TEXTURE_BC4: return 8;
+    case NU_TEXTURE_BC3: case NU_TEXTURE_BC5: return 16;
+    default: return 0;
+  }
+}
+
+GLenum nu_texture_format_gl(nu_TextureFormat format) {
+  switch(format) {
+    case NU_TEXTURE_BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+    case NU_TEXTURE_BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    case NU_TEXTURE_BC4: return GL_COMPRESSED_RED_RGTC1;
+    case NU_TEXTURE_BC5: return GL_COMPRESSED_RG_RGTC2;
+    default: return GL_RGBA8;
+  }
+}
+
+// Maps a GL internal format back to a nu_TextureFormat, false if it has none
+static bool nu_texture_format_from_gl(GLenum gl_format, nu_TextureFormat *format) {
+  for(nu_TextureFormat f = NU_TEXTURE_RGBA8; f <= NU_TEXTURE_BC5; f++) {
+    if(nu_texture_format_gl(f) == gl_format) {
+      *format = f;
+      return true;
+    }
+  }
+  return false;
+}
+
+// S3TC is an extension on some drivers, RGTC is core since 3.0
+static bool nu_texture_format_supported(nu_TextureFormat format) {
+  if(format == NU_TEXTURE_BC1 || format == NU_TEXTURE_BC3) return GLEW_EXT_texture_compression_s3tc;
+  return true;
+}
+
+size_t nu_encoded_texture_size(nu_TextureFormat format, size_t width, size_t height) {
+  if(format == NU_TEXTURE_RGBA8) return width * height * 4;
+  return ((width + 3) / 4) * ((height + 3) / 4) * nu_block_bytes(format);
+}
+
+// Copies a 4x4 block of RGBA8 texels, edges repeat past the image
+static void nu_fetch_block(const uint8_t *rgba, size_t width, size_t height, size_t bx, size_t by, uint8_t block[64]) {
+  for(size_t y = 0; y < 4; y++) {
+    size_t sy = by * 4 + y < height ? by * 4 + y : height - 1;
+    for(size_t x = 0; x < 4; x++) {
+      size_t sx = bx * 4 + x < width ? bx * 4 + x : width - 1;
+      memcpy(block + (y * 4 + x) * 4, rgba + (sy * width + sx) * 4, 4);
+    }
+  }
+}
+
+static uint16_t nu_pack_565(const float color[3]) {
+  const float scale[3] = {31.0f / 255.0f, 63.0f / 255.0f, 31.0f / 255.0f};
+  int q[3];
+  for(size_t c = 0; c < 3; c++) {
+    float v = color[c] * scale[c] + 0.5f;
+    int max = c == 1 ? 63 : 31;
+    q[c] = v < 0.0f ? 0 : v > max ? max : (int)v;
+  }
+  return (uint16_t)((q[0] << 11) | (q[1] << 5) | q[2]);
+}
+
+static void nu_unpack_565(uint16_t packed, int color[3]) {
+  int r = packed >> 11, g = (packed >> 5) & 63, b = packed & 31;
+  color[0] = (r << 3) | (r >> 2);
+  color[1] = (g << 2) | (g >> 4);
+  color[2] = (b << 3) | (b >> 2);
+}
+
+// Picks the nearest of four palette colors for each texel of a block, by
+// squared RGB distance. Returns the block's summed squared error
+static uint32_t nu_match_colors(const uint8_t block[64], const int palette[4][3], uint8_t indices[16]) {
+  uint32_t error = 0;
+#ifdef NU_SSE2
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i rgb_mask = _mm_set1_epi32(0x00FFFFFF);
+  __m128i entries[4];
+  for(size_t i = 0; i < 4; i++) {
+    entries[i] = _mm_setr_epi16(palette[i][0], palette[i][1], palette[i][2], 0, palette[i][0], palette[i][1], palette[i][2], 0);
+  }
+  // Four texels at a time, widened to 16 bits per channel
+  for(size_t q = 0; q < 4; q++) {
+    __m128i texels = _mm_and_si128(_mm_loadu_si128((const __m128i *)(block + q * 16)), rgb_mask);
+    __m128i lo = _mm_unpacklo_epi8(texels, zero), hi = _mm_unpackhi_epi8(texels, zero);
+    __m128i best = _mm_set1_epi32(0x7FFFFFFF), best_index = zero;
+    for(int i = 0; i < 4; i++) {
+      __m128i dlo = _mm_sub_epi16(lo, entries[i]), dhi = _mm_sub_epi16(hi, entries[i]);
+      // r*r + g*g and b*b per texel, then summed across the pairs
+      __m128 slo = _mm_castsi128_ps(_mm_madd_epi16(dlo, dlo)), shi = _mm_castsi128_ps(_mm_madd_epi16(dhi, dhi));
+      __m128i dist = _mm_add_epi32(_mm_castps_si128(_mm_shuffle_ps(slo, shi, _MM_SHUFFLE(2, 0, 2, 0))),
+                                   _mm_castps_si128(_mm_shuffle_ps(slo, shi, _MM_SHUFFLE(3, 1, 3, 1))));
+      __m128i closer = _mm_cmplt_epi32(dist, best);
+      best = _mm_or_si128(_mm_and_si128(closer, dist), _mm_andnot_si128(closer, best));
+      best_index = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(i)), _mm_andnot_si128(closer, best_index));
+    }
+    int32_t dists[4], picked[4];
+    _mm_storeu_si128((__m128i *)dists, best);
+    _mm_storeu_si128((__m128i *)picked, best_index);
+    for(size_t t = 0; t < 4; t++) {
+      indices[q * 4 + t] = (uint8_t)picked[t];
+      error += (uint32_t)dists[t];
+    }
+  }
+#else
+  for(size_t t = 0; t < 16; t++) {
+    uint32_t best = UINT32_MAX;
+    for(uint8_t i = 0; i < 4; i++) {
+      uint32_t dist = 0;
+      for(size_t c = 0; c < 3; c++) {
+        int d = block[t * 4 + c] - palette[i][c];
+        dist += (uint32_t)(d * d);
+      }
+      if(dist < best) {
+        best = dist;
+        indices[t] = i;
+      }
+    }
+    error += best;
+  }
+#endif
+  return error;
+}
+
+// Quantizes a pair of endpoints, orders them for four color mode and
+// matches the block against their palette
+static uint32_t nu_fit_bc1_endpoints(const uint8_t block[64], const float ends[2][3], uint16_t packed[2], uint8_t indices[16]) {
+  packed[0] = nu_pack_565(ends[0]);
+  packed[1] = nu_pack_565(ends[1]);
+  if(packed[0] < packed[1]) {
+    uint16_t swap = packed[0];
+    packed[0] = packed[1];
+    packed[1] = swap;
+  }
+  int palette[4][3];
+  nu_unpack_565(packed[0], palette[0]);
+  nu_unpack_565(packed[1], palette[1]);
+  for(size_t c = 0; c < 3; c++) {
+    palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+    palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+  }
+  // Equal endpoints decode in three color mode, where only entry 0 is safe
+  if(packed[0] == packed[1]) {
+    memset(indices, 0, 16);
+    uint32_t error = 0;
+    for(size_t t = 0; t < 16; t++) {
+      for(size_t c = 0; c < 3; c++) {
+        int d = block[t * 4 + c] - palette[0][c];
+        error += (uint32_t)(d * d);
+      }
+    }
+    return error;
+  }
+  return nu_match_colors(block, palette, indices);
+}
+
+static void nu_encode_bc1_block(const uint8_t block[64], uint8_t *out) {
+  float mean[3] = {0};
+  for(size_t t = 0; t < 16; t++) {
+    for(size_t c = 0; c < 3; c++) mean[c] += block[t * 4 + c];
+  }
+  for(size_t c = 0; c < 3; c++) mean[c] /= 16.0f;
+  // Covariance, then the principal axis by power iteration
+  float cov[6] = {0};
+  for(size_t t = 0; t < 16; t++) {
+    float r = block[t * 4] - mean[0], g = block[t * 4 + 1] - mean[1], b = block[t * 4 + 2] - mean[2];
+    cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+    cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+  }
+  float axis[3] = {1.0f, 1.0f, 1.0f};
+  for(size_t i = 0; i < 4; i++) {
+    float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+    float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+    float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+    float m = fabsf(x) > fabsf(y) ? fabsf(x) : fabsf(y);
+    if(fabsf(z) > m) m = fabsf(z);
+    if(m < 1e-6f) break;
+    axis[0] = x / m; axis[1] = y / m; axis[2] = z / m;
+  }
+  // The extreme texels along the axis, inset a little to cut the error of
+  // the interpolated entries
+  float min_t = 0.0f, max_t = 0.0f;
+  for(size_t t = 0; t < 16; t++) {
+    float d = (block[t * 4] - mean[0]) * axis[0] + (block[t * 4 + 1] - mean[1]) * axis[1] + (block[t * 4 + 2] - mean[2]) * axis[2];
+    if(d < min_t) min_t = d;
+    if(d > max_t) max_t = d;
+  }
+  float len2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+  float inset = (max_t - min_t) / 16.0f;
+  float ends[2][3];
+  for(size_t c = 0; c < 3; c++) {
+    ends[0][c] = mean[c] + axis[c] * (max_t - inset) / len2;
+    ends[1][c] = mean[c] + axis[c] * (min_t + inset) / len2;
+  }
+  uint16_t packed[2];
+  uint8_t indices[16];
+  uint32_t error = nu_fit_bc1_endpoints(block, ends, packed, indices);
+
+  // Refit the endpoints to the chosen indices by least squares
+  if(error > 0 && packed[0] != packed[1]) {
+    static const float weights[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax[3] = {0}, bx[3] = {0};
+    for(size_t t = 0; t < 16; t++) {
+      float a = weights[indices[t]], b = 1.0f - a;
+      aa += a * a; ab += a * b; bb += b * b;
+      for(size_t c = 0; c < 3; c++) {
+        ax[c] += a * block[t * 4 + c];
+        bx[c] += b * block[t * 4 + c];
+      }
+    }
+    float det = aa * bb - ab * ab;
+    if(fabsf(det) > 1e-6f) {
+      float refit[2][3];
+      for(size_t c = 0; c < 3; c++) {
+        refit[0][c] = (bb * ax[c] - ab * bx[c]) / det;
+        refit[1][c] = (aa * bx[c] - ab * ax[c]) / det;
+      }
+      uint16_t refit_packed[2];
+      uint8_t refit_indices[16];
+      if(nu_fit_bc1_endpoints(block, refit, refit_packed, refit_indices) < error) {
+        memcpy(packed, refit_packed, sizeof(packed));
+        memcpy(indices, refit_indices, sizeof(indices));
+      }
+    }
+  }
+
+  out[0] = packed[0] & 0xFF;
+  out[1] = packed[0] >> 8;
+  out[2] = packed[1] & 0xFF;
+  out[3] = packed[1] >> 8;
+  for(size_t i = 0; i < 4; i++) {
+    out[4 + i] = (uint8_t)(indices[i * 4] | (indices[i * 4 + 1] << 2) | (indices[i * 4 + 2] << 4) | (indices[i * 4 + 3] << 6));
+  }
+}
+
+// Encodes one channel of a block as an 8 byte BC4 block, also used for BC3
+// alpha and both halves of BC5
+static void nu_encode_bc4_block(const uint8_t block[64], size_t channel, uint8_t *out) {
+  uint8_t min = 255, max = 0;
+  for(size_t t = 0; t < 16; t++) {
+    uint8_t v = block[t * 4 + channel];
+    if(v < min) min = v;
+    if(v > max) max = v;
+  }
+  // Eight entry mode: out[0] is max, out[1] min, 2 to 7 the steps between
+  out[0] = max;
+  out[1] = min;
+  memset(out + 2, 0, 6);
+  if(max == min) return;
+
+  // Position of each texel on the 0 to 7 ramp from min to max
+  int32_t steps[16];
+  float scale = 7.0f / (float)(max - min);
+#ifdef NU_SSE2
+  const __m128i channel_mask = _mm_set1_epi32(0xFF);
+  const __m128 offset = _mm_set1_ps((float)min), scales = _mm_set1_ps(scale);
+  for(size_t q = 0; q < 4; q++) {
+    __m128i texels = _mm_loadu_si128((const __m128i *)(block + q * 16));
+    __m128i values = _mm_and_si128(_mm_srl_epi32(texels, _mm_cvtsi32_si128((int)channel * 8)), channel_mask);
+    __m128 ramp = _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(values), offset), scales);
+    _mm_storeu_si128((__m128i *)(steps + q * 4), _mm_cvtps_epi32(ramp));
+  }
+#else
+  for(size_t t = 0; t < 16; t++) steps[t] = (int32_t)lrintf((block[t * 4 + channel] - min) * scale);
+#endif
+  // Ramp position to index: max is 0, min is 1, the rest count down from 7
+  static const uint8_t ramp_index[8] = {1, 7, 6, 5, 4, 3, 2, 0};
+  uint64_t bits = 0;
+  for(size_t t = 0; t < 16; t++) {
+    int32_t step = steps[t] < 0 ? 0 : steps[t] > 7 ? 7 : steps[t];
+    bits |= (uint64_t)ramp_index[step] << (t * 3);
+  }
+  for(size_t i = 0; i < 6; i++) out[2 + i] = (uint8_t)(bits >> (i * 8));
+}
+
+static void nu_encode_block(nu_TextureFormat format, const uint8_t block[64], uint8_t *out) {
+  switch(format) {
+    case NU_TEXTURE_BC1:
+      nu_encode_bc1_block(block, out);
+      break;
+    case NU_TEXTURE_BC3:
+      nu_encode_bc4_block(block, 3, out);
+      nu_encode_bc1_block(block, out + 8);
+      break;
+    case NU_TEXTURE_BC4:
+      nu_encode_bc4_block(block, 0, out);
+      break;
+    case NU_TEXTURE_BC5:
+      nu_encode_bc4_block(block, 0, out);
+      nu_encode_bc4_block(block, 1, out + 8);
+      break;
+    default:
+      break;
+  }
+}
+
+// A band of block rows for one encoding thread
+typedef struct {
+  nu_TextureFormat format;
+  const uint8_t *rgba;
+  size_t width, height;
+  size_t first_row, last_row;
+  uint8_t *out;
+} nu_BlockRows;
+
+static void *nu_encode_block_rows(void *arg) {
+  nu_BlockRows *rows = arg;
+  size_t blocks_x = (rows->width + 3) / 4, block_bytes = nu_block_bytes(rows->format);
+  uint8_t block[64];
+  for(size_t by = rows->first_row; by < rows->last_row; by++) {
+    uint8_t *out = rows->out + by * blocks_x * block_bytes;
+    for(size_t bx = 0; bx < blocks_x; bx++) {
+      nu_fetch_block(rows->rgba, rows->width, rows->height, bx, by, block);
+      nu_encode_block(rows->format, block, out + bx * block_bytes);
+    }
+  }
+  return NULL;
+}
+
+// Encodes on the calling thread only, or split over all cores when threaded
+static size_t nu_encode_image(nu_TextureFormat format, const uint8_t *rgba, size_t width, size_t height, uint8_t *out, bool threaded) {
+  size_t size = nu_encoded_texture_size(format, width, height);
+  if(format == NU_TEXTURE_RGBA8) {
+    memcpy(out, rgba, size);
+    return size;
+  }
+  size_t blocks_y = (height + 3) / 4;
+  // At least 8 rows of blocks per thread, so small images stay on this one
+  size_t num_bands = threaded ? (size_t)nu_cpu_count() : 1;
+  if(num_bands > NU_MAX_ENCODE_THREADS) num_bands = NU_MAX_ENCODE_THREADS;
+  if(num_bands > blocks_y / 8) num_bands = blocks_y / 8;
+  if(num_bands < 1) num_bands = 1;
+
+  nu_BlockRows bands[NU_MAX_ENCODE_THREADS];
+  pthread_t threads[NU_MAX_ENCODE_THREADS];
+  bool started[NU_MAX_ENCODE_THREADS] = {false};
+  for(size_t i = 0; i < num_bands; i++) {
+    bands[i] = (nu_BlockRows){format, rgba, width, height, blocks_y * i / num_bands, blocks_y * (i + 1) / num_bands, out};
+  }
+  // The calling thread takes band 0, and any band a thread couldn't start for
+  for(size_t i = 1; i < num_bands; i++) {
+    started[i] = pthread_create(&threads[i], NULL, nu_encode_block_rows, &bands[i]) == 0;
+  }
+  nu_encode_block_rows(&bands[0]);
+  for(size_t i = 1; i < num_bands; i++) {
+    if(started[i]) {
+      pthread_join(threads[i], NULL);
+    } else {
+      nu_encode_block_rows(&bands[i]);
+    }
+  }
+  return size;
+}
+
+size_t nu_encode_texture(nu_TextureFormat format, const uint8_t *rgba, size_t width, size_t height, uint8_t *out) {
+  if(!rgba || !out || width == 0 || height == 0) return 0;
+  if(format > NU_TEXTURE_BC5) {
+    fprintf(stderr, "(nu_encode_texture): Couldn't encode texture, unknown format %d.\n", (int)format);
+    return 0;
+  }
+  return nu_encode_image(format, rgba, width, height, out, true);
+}
+
+// Texture loading
+nu_Texture *nu_load_texture(const char *file_loc) {
+  return nu_load_texture_with_format(file_loc, NU_TEXTURE_RGBA8);
+}
+
+nu_Texture *nu_load_texture_with_format(const char *file_loc, nu_TextureFormat format) {
+  NU_PROFILE_FUNCTION();
+  if(!file_loc) return NULL;
+  size_t loc_len = strlen(file_loc);
+  if(loc_len > 4 && strcmp(file_loc + loc_len - 4, ".nut") == 0) return nu_load_nut(file_loc);
+  if(format > NU_TEXTURE_BC5) {
+    fprintf(stderr, "(nu_load_texture): Error loading texture \"%s\", unknown format %d.\n", file_loc, (int)format);
+    return NULL;
+  }
+  if(!nu_texture_format_supported(format)) {
+    fprintf(stderr, "(nu_load_texture): Texture format %d isn't supported by the driver, loading \"%s\" uncompressed.\n", (int)format, file_loc);
+    format = NU_TEXTURE_RGBA8;
+  }
+  // Load the image
+  int image_width, image_height, comp;
+  stbi_set_flip_vertically_on_load(1);
+  unsigned char *image = stbi_load(file_loc, &image_width, &image_height, &comp, STBI_rgb_alpha);
+
+  if (image == NULL) {
+    fprintf(stderr, "(nu_load_texture): Error loading texture \"%s\", stbi_load returned NULL.\n", file_loc);
+    return NULL;
+  }
+
+  // Encode it before touching GL, so a failure leaves nothing to clean up
+  uint8_t *encoded = NULL;
+  size_t encoded_size = nu_encoded_texture_size(format, image_width, image_height);
+  if(format != NU_TEXTURE_RGBA8) {
+    encoded = malloc(encoded_size);
+    if(!encoded) {
+      fprintf(stderr, "(nu_load_texture): Error loading texture \"%s\", allocating %zu bytes to encode it failed.\n", file_loc, encoded_size);
+      stbi_image_free(image);
+      return NULL;
+    }
+    nu_encode_image(format, image, image_width, image_height, encoded, true);
+  }
+
+  // Create and bind the texture
+  GLuint id;
+  glGenTextures(1, &id);
+  nu_state_bind_texture_for_upload(GL_TEXTURE_2D, id);
+
+  // Set parameters
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+  // Upload the loaded image to the texture
+  if(encoded) {
+    glCompressedTexImage2D(GL_TEXTURE_2D, 0, nu_texture_format_gl(format), image_width, image_height, 0, (GLsizei)encoded_size, encoded);
+    free(encoded);
+  } else {
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image_width, image_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
+  }
+
+  // Free image
+  stbi_image_free(image);
+
+  // Allocate and set nu_Texture*
+  nu_Texture *result = calloc(1, sizeof(nu_Texture));
+  if(!result) {
+    fprintf(stderr, "(nu_load_texture): Error loading texture \"%s\", calloc failed.\n", file_loc);
+    glDeleteTextures(1, &id);
+    nu_state_forget_texture(id);
+    return NULL;
+  }
+  result->id = id;
+  result->type = GL_TEXTURE_2D;
+  result->width = image_width;
+  result->height = image_height;
+  result->layers = 1;
+  result->levels = 1;
+  result->format = nu_texture_format_gl(format);
+  nu_count_new_texture(result);
+  return result;
+}
+
+// Parallel texture array decoding
+// Worker threads decode layers into one staging buffer while the GL thread
+// uploads each layer as soon as it's done
+#define NU_MAX_DECODE_THREADS 16
+
+typedef enum {
+  NU_LAYER_PENDING,
+  NU_LAYER_DECODED,
+  NU_LAYER_SKIPPED,
+  NU_LAYER_FAILED
+} nu_LayerStatus;
+
+typedef struct {
+  const char **paths;
+  size_t num_layers;
+  int width, height;
+  // Layers are encoded to format into staging, layer_size bytes each
+  nu_TextureFormat format;
+  size_t layer_size;
+  uint8_t *staging;
+  nu_LayerStatus *status;
+  // Layers in the order they finished decoding
+  size_t *finished;
+  size_t num_finished;
+  // Next layer for a worker to take, and whether to stop early
+  size_t next_layer;
+  bool abort;
+  pthread_mutex_t mutex;
+  pthread_cond_t layer_done;
+} nu_ArrayDecode;
+
+static void *nu_decode_layers(void *arg) {
+  nu_ArrayDecode *decode = arg;
+  stbi_set_flip_vertically_on_load_thread(1);
+  for(;;) {
+    pthread_mutex_lock(&decode->mutex);
+    size_t layer = decode->next_layer++;
+    bool stop = decode->abort || layer >= decode->num_layers;
+    pthread_mutex_unlock(&decode->mutex);
+    if(stop) return NULL;
+
+    int w, h, c;
+    unsigned char *image = stbi_load(decode->paths[layer], &w, &h, &c, STBI_rgb_alpha);
+    nu_LayerStatus status = NU_LAYER_DECODED;
+    if(!image) {
+      status = NU_LAYER_FAILED;
+    } else if(w != decode->width || h != decode->height) {
+      status = NU_LAYER_SKIPPED;
+    } else {
+      // Layers already run in parallel, so each is encoded on one thread
+      nu_encode_image(decode->format, image, w, h, decode->staging + layer * decode->layer_size, false);
+    }
+    if(image) stbi_image_free(image);
+
+    pthread_mutex_lock(&decode->mutex);
+    decode->status[layer] = status;
+    decode->finished[decode->num_finished++] = layer;
+    pthread_cond_signal(&decode->layer_done);
+    pthread_mutex_unlock(&decode->mutex);
+  }
+}
+
+static size_t nu_decode_thread_count(size_t num_layers) {
+  long cores = nu_cpu_count();
+  // With one core a worker would only compete with the GL thread
+  if(cores <= 1) return 0;
+  size_t threads = (size_t)cores;
+  if(threads > NU_MAX_DECODE_THREADS) threads = NU_MAX_DECODE_THREADS;
+  if(threads > num_layers) threads = num_layers;
+  return threads;
+}
+
+nu_Texture *nu_load_texture_array_paths(size_t num_textures, const char **paths) {
+  return nu_load_texture_array_with_format(num_textures, paths, NU_TEXTURE_RGBA8);
+}
+
+nu_Texture *nu_load_texture_array_with_format(size_t num_textures, const char **paths, nu_TextureFormat format) {
+  NU_PROFILE_FUNCTION();
+  if(num_textures == 0 || !paths) return NULL;
+  if(format > NU_TEXTURE_BC5) {
+    fprintf(stderr, "(nu_load_texture_array): Couldn't load texture array, unknown format %d.\n", (int)format);
+    return NULL;
+  }
+  if(!nu_texture_format_supported(format)) {
+    fprintf(stderr, "(nu_load_texture_array): Texture format %d isn't supported by the driver, loading uncompressed.\n", (int)format);
+    format = NU_TEXTURE_RGBA8;
+  }
+  for(size_t i = 0; i < num_textures; i++) {
+    if(!paths[i]) {
+      fprintf(stderr, "(nu_load_texture_array): Couldn't load texture array, path %zu is NULL.\n", i);
+      return NULL;
+    }
+  }
+
+  // The first image's header sets the size of every layer
+  nu_ArrayDecode decode = {.paths = paths, .num_layers = num_textures, .format = format};
+  int comp;
+  if(!stbi_info(paths[0], &decode.width, &decode.height, &comp)) {
+    fprintf(stderr, "(nu_load_texture_array): Failed to load first image %s\n", paths[0]);
+    return NULL;
+  }
+  size_t layer_size = nu_encoded_texture_size(format, decode.width, decode.height);
+  decode.layer_size = layer_size;
+  decode.staging = malloc(layer_size * num_textures);
+  decode.status = calloc(num_textures, sizeof(nu_LayerStatus));
+  decode.finished = calloc(num_textures, sizeof(size_t));
+  if(!decode.staging || !decode.status || !decode.finished) {
+    fprintf(stderr, "(nu_load_texture_array): Couldn't load texture array, allocating %zu bytes of staging failed.\n", layer_size * num_textures);
+    free(decode.staging);
+    free(decode.status);
+    free(decode.finished);
+    return NULL;
+  }
+  pthread_mutex_init(&decode.mutex, NULL);
+  pthread_cond_init(&decode.layer_done, NULL);
+  pthread_t threads[NU_MAX_DECODE_THREADS];
+  size_t num_threads = 0;
+  size_t wanted_threads = nu_decode_thread_count(num_textures);
+  for(size_t i = 0; i < wanted_threads; i++) {
+    if(pthread_create(&threads[num_threads], NULL, nu_decode_layers, &decode) == 0) num_threads++;
+  }
+
+  GLuint id;
+  glGenTextures(1, &id);
+  nu_state_bind_texture_for_upload(GL_TEXTURE_2D_ARRAY, id);
+
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+  GLenum gl_format = nu_texture_format_gl(format);
+  if(format == NU_TEXTURE_RGBA8) {
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, decode.width, decode.height, (GLsizei)num_textures, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  } else {
+    glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, 0, gl_format, decode.width, decode.height, (GLsizei)num_textures, 0, (GLsizei)(layer_size * num_textures), NULL);
+  }
+
+  // Upload layers in the order they finish. Without any threads, every
+  // layer is decoded here first
+  if(num_threads == 0) nu_decode_layers(&decode);
+  bool failed = false;
+  for(size_t uploaded = 0; uploaded < num_textures && !failed; uploaded++) {
+    pthread_mutex_lock(&decode.mutex);
+    while(decode.num_finished <= uploaded) pthread_cond_wait(&decode.layer_done, &decode.mutex);
+    size_t i = decode.finished[uploaded];
+    nu_LayerStatus status = decode.status[i];
+    pthread_mutex_unlock(&decode.mutex);
+
+    if(status == NU_LAYER_FAILED) {
+      fprintf(stderr, "(nu_load_texture_array): Failed to load image %s\n", paths[i]);
+      failed = true;
+    } else if(status == NU_LAYER_SKIPPED) {
+      fprintf(stderr, "(nu_load_texture_array): Image %s does not match size %dx%d, skipping.\n", paths[i], decode.width, decode.height);
+    } else if(format == NU_TEXTURE_RGBA8) {
+      glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, (GLint)i, decode.width, decode.height, 1, GL_RGBA, GL_UNSIGNED_BYTE, decode.staging + i * layer_size);
+    } else {
+      glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, (GLint)i, decode.width, decode.height, 1, gl_format, (GLsizei)layer_size, decode.staging + i * layer_size);
+    }
+  }
+
+  pthread_mutex_lock(&decode.mutex);
+  decode.abort = true;
+  pthread_mutex_unlock(&decode.mutex);
+  for(size_t i = 0; i < num_threads; i++) pthread_join(threads[i], NULL);
+  pthread_mutex_destroy(&decode.mutex);
+  pthread_cond_destroy(&decode.layer_done);
+  free(decode.staging);
+  free(decode.status);
+  free(decode.finished);
+  if(failed) {
+    glDeleteTextures(1, &id);
+    nu_state_forget_texture(id);
+    return NULL;
+  }
+
+  nu_Texture *result = calloc(1, sizeof(nu_Texture));
+  if(!result) {
+    fprintf(stderr, "(nu_load_texture_array): Couldn't load texture array, calloc failed.\n");
+    glDeleteTextures(1, &id);
+    nu_state_forget_texture(id);
+    return NULL;
+  }
+  result->id = id;
+  result->type = GL_TEXTURE_2D_ARRAY;
+  result->width = decode.width;
+  result->height = decode.height;
+  result->layers = num_textures;
+  result->levels = 1;
+  result->format = gl_format;
+  nu_count_new_texture(result);
+  return result;
+}
+
+nu_Texture *nu_load_texture_array(size_t num_textures, ...) {
+  if (num_textures == 0) return NULL;
+  const char **paths = calloc(num_textures, sizeof(const char *));
+  if(!paths) {
+    fprintf(stderr, "(nu_load_texture_array): Couldn't load texture array, calloc failed.\n");
+    return NULL;
+  }
+  va_list args;
+  va_start(args, num_textures);
+  for(size_t i = 0; i < num_textures; i++) {
+    paths[i] = va_arg(args, const char *);
+  }
+  va_end(args);
+  nu_Texture *result = nu_load_texture_array_paths(num_textures, paths);
+  free(paths);
+  return result;
+}
+
+// Texture containers
+// Bytes of one layer of a mip level, 0 for unsupported formats
+static size_t nu_nut_level_size(GLenum gl_format, size_t width, size_t height) {
+  nu_TextureFormat format;
+  if(!nu_texture_format_from_gl(gl_format, &format)) return 0;
+  return nu_encoded_texture_size(format, width, height);
+}
+
+static size_t nu_mip_size(size_t size, size_t level) {
+  size >>= level;
+  return size ? size : 1;
+}
+
+// Box filters an RGBA8 image down to half its size, odd edges repeat
+static void nu_downsample_rgba8(const uint8_t *src, size_t width, size_t height, uint8_t *dst) {
+  size_t dst_width = width > 1 ? width / 2 : 1, dst_height = height > 1 ? height / 2 : 1;
+  for(size_t y = 0; y < dst_height; y++) {
+    size_t y0 = y * 2, y1 = y0 + 1 < height ? y0 + 1 : y0;
+    for(size_t x = 0; x < dst_width; x++) {
+      size_t x0 = x * 2, x1 = x0 + 1 < width ? x0 + 1 : x0;
+      for(size_t c = 0; c < 4; c++) {
+        unsigned sum = src[(y0 * width + x0) * 4 + c] + src[(y0 * width + x1) * 4 + c] + src[(y1 * width + x0) * 4 + c] + src[(y1 * width + x1) * 4 + c];
+        dst[(y * dst_width + x) * 4 + c] = (uint8_t)((sum + 2) / 4);
+      }
+    }
+  }
+}
+
+bool nu_convert_texture(size_t num_images, const char **image_locs, const char *nut_loc, nu_TextureFormat format) {
+  if(num_images == 0 || !image_locs || !nut_loc) return false;
+  if(format > NU_TEXTURE_BC5) {
+    fprintf(stderr, "(nu_convert_texture): Couldn't convert texture, unknown format %d.\n", (int)format);
+    return false;
+  }
+  nu_NutHeader header = {.magic = {'N', 'U', 'T', 'X'}, .version = NU_NUT_VERSION, .format = nu_texture_format_gl(format)};
+  header.layers = num_images > 1 ? (uint32_t)num_images : 0;
+  int width = 0, height = 0, comp;
+  if(!image_locs[0] || !stbi_info(image_locs[0], &width, &height, &comp)) {
+    fprintf(stderr, "(nu_convert_texture): Couldn't convert texture, failed to load image %s.\n", image_locs[0] ? image_locs[0] : "(null)");
+    return false;
+  }
+  header.width = width;
+  header.height = height;
+  // Full chain down to 1x1
+  header.levels = 1;
+  while(header.levels < NU_NUT_MAX_LEVELS && (nu_mip_size(width, header.levels - 1) > 1 || nu_mip_size(height, header.levels - 1) > 1)) header.levels++;
+
+  nu_NutLevel levels[NU_NUT_MAX_LEVELS];
+  // The RGBA8 chain of one image, where each level is made and then encoded
+  size_t chain_offsets[NU_NUT_MAX_LEVELS];
+  size_t chain_size = 0;
+  size_t offset = sizeof(header) + header.levels * sizeof(nu_NutLevel);
+  for(uint32_t l = 0; l < header.levels; l++) {
+    // Keep each level 16 byte aligned in the file
+    offset = (offset + 15) & ~(size_t)15;
+    levels[l].offset = offset;
+    levels[l].size = nu_nut_level_size(header.format, nu_mip_size(width, l), nu_mip_size(height, l)) * num_images;
+    offset += levels[l].size;
+    chain_offsets[l] = chain_size;
+    chain_size += nu_mip_size(width, l) * nu_mip_size(height, l) * 4;
+  }
+  uint8_t *data = calloc(offset, 1);
+  uint8_t *chain = malloc(chain_size);
+  if(!data || !chain) {
+    fprintf(stderr, "(nu_convert_texture): Couldn't convert texture, allocation failed.\n");
+    free(data);
+    free(chain);
+    return false;
+  }
+  memcpy(data, &header, sizeof(header));
+  memcpy(data + sizeof(header), levels, header.levels * sizeof(nu_NutLevel));
+
+  stbi_set_flip_vertically_on_load(1);
+  bool converted = true;
+  for(size_t i = 0; i < num_images && converted; i++) {
+    int w, h;
+    unsigned char *image = image_locs[i] ? stbi_load(image_locs[i], &w, &h, &comp, STBI_rgb_alpha) : NULL;
+    if(!image || w != width || h != height) {
+      fprintf(stderr, "(nu_convert_texture): Couldn't convert texture, image %s %s.\n", image_locs[i] ? image_locs[i] : "(null)", image ? "doesn't match the first image's size" : "failed to load");
+      if(image) stbi_image_free(image);
+      converted = false;
+      break;
+    }
+    memcpy(chain, image, (size_t)width * height * 4);
+    stbi_image_free(image);
+    // Each level is made from the one above it, before either is encoded
+    for(uint32_t l = 1; l < header.levels; l++) {
+      nu_downsample_rgba8(chain + chain_offsets[l - 1], nu_mip_size(width, l - 1), nu_mip_size(height, l - 1), chain + chain_offsets[l]);
+    }
+    for(uint32_t l = 0; l < header.levels; l++) {
+      size_t level_width = nu_mip_size(width, l), level_height = nu_mip_size(height, l);
+      size_t layer_size = nu_nut_level_size(header.format, level_width, level_height);
+      nu_encode_image(format, chain + chain_offsets[l], level_width, level_height, data + levels[l].offset + i * layer_size, true);
+    }
+  }
+  free(chain);
+  if(converted) {
+    FILE *file = fopen(nut_loc, "wb");
+    if(!file) {
+      fprintf(stderr, "(nu_convert_texture): Couldn't write %s, fopen returned NULL.\n", nut_loc);
+      converted = false;
+    } else {
+      converted = fwrite(data, 1, offset, file) == offset;
+      if(fclose(file) != 0) converted = false;
+      if(!converted) {
+        fprintf(stderr, "(nu_convert_texture): Couldn't write %s, fwrite failed.\n", nut_loc);
+        remove(nut_loc);
+      }
+    }
+  }
+  free(data);
+  return converted;
+}
+
+// Maps a whole file read-only, or reads it in where mmap isn't available.
+// Returns NULL on failure
+static const uint8_t *nu_map_file(const char *file_loc, size_t *size) {
+#ifndef _WIN32
+  int fd = open(file_loc, O_RDONLY);
+  if(fd < 0) return NULL;
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return NULL;
+  }
+  void *mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping keeps the file open
+  close(fd);
+  if(mapped == MAP_FAILED) return NULL;
+  *size = st.st_size;
+  return mapped;
+#else
+  FILE *file = fopen(file_loc, "rb");
+  if(!file) return NULL;
+  fseek(file, 0, SEEK_END);
+  long file_len = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  uint8_t *data = file_len > 0 ? malloc(file_len) : NULL;
+  if(!data || fread(data, 1, file_len, file) != (size_t)file_len) {
+    free(data);
+    fclose(file);
+    return NULL;
+  }
+  fclose(file);
+  *size = file_len;
+  return data;
+#endif
+}
+
+static void nu_unmap_file(const uint8_t *data, size_t size) {
+#ifndef _WIN32
+  munmap((void *)data, size);
+#else
+  (void)size;
+  free((void *)data);
+#endif
+}
+
+nu_Texture *nu_load_nut(const char *file_loc) {
+  NU_PROFILE_FUNCTION();
+  if(!file_loc) return NULL;
+  size_t file_size = 0;
+  const uint8_t *file = nu_map_file(file_loc, &file_size);
+  if(!file) {
+    fprintf(stderr, "(nu_load_nut): Error loading texture \"%s\", couldn't map the file.\n", file_loc);
+    return NULL;
+  }
+  nu_NutHeader header;
+  bool valid = file_size >= sizeof(header);
+  if(valid) {
+    memcpy(&header, file, sizeof(header));
+    valid = memcmp(header.magic, "NUTX", 4) == 0 && header.version == NU_NUT_VERSION &&
+            header.levels > 0 && header.levels <= NU_NUT_MAX_LEVELS && header.width > 0 && header.height > 0 &&
+            nu_nut_level_size(header.format, 1, 1) > 0 && file_size >= sizeof(header) + header.levels * sizeof(nu_NutLevel);
+  }
+  nu_NutLevel levels[NU_NUT_MAX_LEVELS];
+  size_t layers = header.layers > 0 ? header.layers : 1;
+  for(uint32_t l = 0; valid && l < header.levels; l++) {
+    memcpy(&levels[l], file + sizeof(header) + l * sizeof(nu_NutLevel), sizeof(nu_NutLevel));
+    size_t expected = nu_nut_level_size(header.format, nu_mip_size(header.width, l), nu_mip_size(header.height, l)) * layers;
+    valid = levels[l].size == expected && levels[l].offset <= file_size && levels[l].size <= file_size - levels[l].offset;
+  }
+  if(!valid) {
+    fprintf(stderr, "(nu_load_nut): Error loading texture \"%s\", not a valid version %d nu texture container.\n", file_loc, NU_NUT_VERSION);
+    nu_unmap_file(file, file_size);
+    return NULL;
+  }
+
+  nu_TextureFormat format = NU_TEXTURE_RGBA8;
+  nu_texture_format_from_gl(header.format, &format);
+  if(!nu_texture_format_supported(format)) {
+    fprintf(stderr, "(nu_load_nut): Error loading texture \"%s\", its format isn't supported by the driver.\n", file_loc);
+    nu_unmap_file(file, file_size);
+    return NULL;
+  }
+  bool compressed = format != NU_TEXTURE_RGBA8;
+  GLenum target = header.layers > 0 ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+  GLuint id;
+  glGenTextures(1, &id);
+  nu_state_bind_texture_for_upload(target, id);
+  glTexParameteri(target, GL_TEXTURE_MIN_FILTER, header.levels > 1 ? GL_NEAREST_MIPMAP_LINEAR : GL_NEAREST);
+  glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, header.levels - 1);
+  // Levels go straight from the mapping to GL, with no copy in between
+  for(uint32_t l = 0; l < header.levels; l++) {
+    GLsizei w = nu_mip_size(header.width, l), h = nu_mip_size(header.height, l);
+    const void *texels = file + levels[l].offset;
+    if(compressed && target == GL_TEXTURE_2D_ARRAY) {
+      glCompressedTexImage3D(target, l, header.format, w, h, header.layers, 0, (GLsizei)levels[l].size, texels);
+    } else if(compressed) {
+      glCompressedTexImage2D(target, l, header.format, w, h, 0, (GLsizei)levels[l].size, texels);
+    } else if(target == GL_TEXTURE_2D_ARRAY) {
+      glTexImage3D(target, l, header.format, w, h, header.layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, texels);
+    } else {
+      glTexImage2D(target, l, header.format, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, texels);
+    }
+  }
+  nu_unmap_file(file, file_size);
+
+  nu_Texture *result = calloc(1, sizeof(nu_Texture));
+  if(!result) {
+    fprintf(stderr, "(nu_load_nut): Error loading texture \"%s\", calloc failed.\n", file_loc);
+    glDeleteTextures(1, &id);
+    nu_state_forget_texture(id);
+    return NULL;
+  }
+  result->id = id;
+  result->type = target;
+  result->width = header.width;
+  result->height = header.height;
+  result->layers = layers;
+  result->levels = header.levels;
+  result->format = header.format;
+  nu_count_new_texture(result);
+  return result;
+}
+
+// Texture atlases
+// Skyline bottom-left packing: each page keeps the top edge of everything
+// placed on it as a list of segments, and each image goes wherever its top
+// ends up lowest
+typedef struct {
+  size_t x, y, width;
+} nu_SkylineNode;
+
+typedef struct {
+  nu_SkylineNode *nodes;
+  size_t num_nodes;
+} nu_Skyline;
+
+typedef struct {
+  size_t index;
+  // Padded size, and where it went
+  size_t width, height;
+  size_t x, y, layer;
+} nu_AtlasEntry;
+
+// Tallest first, then widest, which keeps the skyline flat
+static int nu_compare_atlas_entries(const void *a, const void *b) {
+  const nu_AtlasEntry *x = a, *y = b;
+  if(x->height != y->height) return x->height < y->height ? 1 : -1;
+  if(x->width != y->width) return x->width < y->width ? 1 : -1;
+  return (x->index > y->index) - (x->index < y->index);
+}
+
+// Lowest y a width x height rect can rest at with its left edge on node i,
+// SIZE_MAX if it doesn't fit on the page there
+static size_t nu_skyline_fit(const nu_Skyline *skyline, size_t i, size_t width, size_t height, size_t page_size) {
+  if(skyline->nodes[i].x + width > page_size) return SIZE_MAX;
+  size_t y = 0, covered = 0;
+  // The nodes span the page, so ones to the right always cover the width
+  for(size_t j = i; covered < width; j++) {
+    if(skyline->nodes[j].y > y) y = skyline->nodes[j].y;
+    if(y + height > page_size) return SIZE_MAX;
+    covered += skyline->nodes[j].width;
+  }
+  return y;
+}
+
+// Places a rect at the best spot on a page, false if there isn't one
+static bool nu_skyline_place(nu_Skyline *skyline, size_t width, size_t height, size_t page_size, size_t *out_x, size_t *out_y) {
+  size_t best = SIZE_MAX, best_y = SIZE_MAX;
+  for(size_t i = 0; i < skyline->num_nodes; i++) {
+    size_t y = nu_skyline_fit(skyline, i, width, height, page_size);
+    if(y < best_y) {
+      best = i;
+      best_y = y;
+    }
+  }
+  if(best == SIZE_MAX) return false;
+  size_t x = skyline->nodes[best].x;
+
+  // The new segment replaces what it covers of the nodes after it
+  memmove(&skyline->nodes[best + 1], &skyline->nodes[best], (skyline->num_nodes - best) * sizeof(nu_SkylineNode));
+  skyline->nodes[best] = (nu_SkylineNode){x, best_y + height, width};
+  skyline->num_nodes++;
+  for(size_t j = best + 1; j < skyline->num_nodes;) {
+    nu_SkylineNode *node = &skyline->nodes[j];
+    if(node->x >= x + width) break;
+    size_t overlap = x + width - node->x;
+    if(node->width > overlap) {
+      node->x += overlap;
+      node->width -= overlap;
+      break;
+    }
+    memmove(node, node + 1, (skyline->num_nodes - j - 1) * sizeof(nu_SkylineNode));
+    skyline->num_nodes--;
+  }
+  // Merge neighbours at the same height
+  for(size_t j = 0; j + 1 < skyline->num_nodes;) {
+    if(skyline->nodes[j].y == skyline->nodes[j + 1].y) {
+      skyline->nodes[j].width += skyline->nodes[j + 1].width;
+      memmove(&skyline->nodes[j + 1], &skyline->nodes[j + 2], (skyline->num_nodes - j - 2) * sizeof(nu_SkylineNode));
+      skyline->num_nodes--;
+    } else {
+      j++;
+    }
+  }
+  *out_x = x;
+  *out_y = best_y;
+  return true;
+}
+
+// Copies an image into a page with padding texels around it, repeating
+// its edge texels
+static void nu_blit_padded(uint8_t *page, size_t page_size, const uint8_t *image, size_t width, size_t height, size_t x, size_t y, size_t padding) {
+  for(size_t py = 0; py < height + 2 * padding; py++) {
+    size_t sy = py < padding ? 0 : py - padding >= height ? height - 1 : py - padding;
+    const uint8_t *src = image + sy * width * 4;
+    uint8_t *row = page + ((y + py) * page_size + x) * 4;
+    for(size_t px = 0; px < padding; px++) {
+      memcpy(row + px * 4, src, 4);
+      memcpy(row + (padding + width + px) * 4, src + (width - 1) * 4, 4);
+    }
+    memcpy(row + padding * 4, src, width * 4);
+  }
+}
+
+nu_Atlas *nu_create_atlas(size_t num_images, const char **image_locs, size_t page_size, size_t padding, nu_TextureFormat format) {
+  NU_PROFILE_FUNCTION();
+  if(num_images == 0 || !image_locs || page_size == 0) return NULL;
+  if(format > NU_TEXTURE_BC5) {
+    fprintf(stderr, "(nu_create_atlas): Couldn't create atlas, unknown format %d.\n", (int)format);
+    return NULL;
+  }
+  if(!nu_texture_format_supported(format)) {
+    fprintf(stderr, "(nu_create_atlas): Texture format %d isn't supported by the driver, creating the atlas uncompressed.\n", (int)format);
+    format = NU_TEXTURE_RGBA8;
+  }
+  GLint max_size = 0, max_layers = 0;
+  glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+  glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+  if(page_size > (size_t)max_size) {
+    fprintf(stderr, "(nu_create_atlas): Couldn't create atlas, page size %zu is over GL_MAX_TEXTURE_SIZE %d.\n", page_size, max_size);
+    return NULL;
+  }
+
+  nu_Atlas *atlas = calloc(1, sizeof(nu_Atlas));
+  nu_AtlasEntry *entries = calloc(num_images, sizeof(nu_AtlasEntry));
+  nu_Skyline *pages = NULL;
+  size_t num_pages = 0;
+  uint8_t *page = NULL, *encoded = NULL;
+  GLuint id = 0;
+  bool failed = true;
+  if(!atlas || !entries || !(atlas->rects = calloc(num_images, sizeof(nu_AtlasRect)))) {
+    fprintf(stderr, "(nu_create_atlas): Couldn't create atlas, calloc failed.\n");
+    goto cleanup;
+  }
+  atlas->num_rects = num_images;
+
+  // Pack from the image headers, before decoding anything
+  for(size_t i = 0; i < num_images; i++) {
+    int w, h, comp;
+    if(!image_locs[i] || !stbi_info(image_locs[i], &w, &h, &comp)) {
+      fprintf(stderr, "(nu_create_atlas): Couldn't create atlas, failed to load image %s.\n", image_locs[i] ? image_locs[i] : "(null)");
+      goto cleanup;
+    }
+    entries[i] = (nu_AtlasEntry){.index = i, .width = w + 2 * padding, .height = h + 2 * padding};
+    if(entries[i].width > page_size || entries[i].height > page_size) {
+      fprintf(stderr, "(nu_create_atlas): Couldn't create atlas, image %s is %dx%d and doesn't fit a %zu page with %zu padding.\n", image_locs[i], w, h, page_size, padding);
+      goto cleanup;
+    }
+  }
+  qsort(entries, num_images, sizeof(nu_AtlasEntry), nu_compare_atlas_entries);
+  for(size_t i = 0; i < num_images; i++) {
+    nu_AtlasEntry *entry = &entries[i];
+    bool placed = false;
+    for(size_t p = 0; p < num_pages && !placed; p++) {
+      placed = nu_skyline_place(&pages[p], entry->width, entry->height, page_size, &entry->x, &entry->y);
+      entry->layer = p;
+    }
+    if(placed) continue;
+    // A fresh page. A skyline never has more nodes than images on it, plus one
+    nu_Skyline *grown = realloc(pages, (num_pages + 1) * sizeof(nu_Skyline));
+    if(!grown) {
+      fprintf(stderr, "(nu_create_atlas): Couldn't create atlas, realloc failed.\n");
+      goto cleanup;
+    }
+    pages = grown;
+    pages[num_pages].nodes = malloc((num_images + 2) * sizeof(nu_SkylineNode));
+    if(!pages[num_pages].nodes) {
+      fprintf(stderr, "(nu_create_atlas): Couldn't create atlas, malloc failed.\n");
+      goto cleanup;
+    }
+    pages[num_pages].nodes[0] = (nu_SkylineNode){0, 0, page_size};
+    pages[num_pages].num_nodes = 1;
+    entry->layer = num_pages++;
+    nu_skyline_place(&pages[entry->layer], entry->width, entry->height, page_size, &entry->x, &entry->y);
+  }
+  if(num_pages > (size_t)max_layers) {
+    fprintf(stderr, "(nu_create_atlas): Couldn't create atlas, %zu pages is over GL_MAX_ARRAY_TEXTURE_LAYERS %d.\n", num_pages, max_layers);
+    goto cleanup;
+  }
+
+  size_t page_bytes = page_size * page_size * 4;
+  size_t layer_size = nu_encoded_texture_size(format, page_size, page_size);
+  page = malloc(page_bytes);
+  encoded = format != NU_TEXTURE_RGBA8 ? malloc(layer_size) : NULL;
+  if(!page || (format != NU_TEXTURE_RGBA8 && !encoded)) {
+    fprintf(stderr, "(nu_create_atlas): Couldn't create atlas, allocating %zu bytes for a page failed.\n", page_bytes + layer_size);
+    goto cleanup;
+  }
+  glGenTextures(1, &id);
+  nu_state_bind_texture_for_upload(GL_TEXTURE_2D_ARRAY, id);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  GLenum gl_format = nu_texture_format_gl(format);
+  if(format == NU_TEXTURE_RGBA8) {
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, page_size, page_size, (GLsizei)num_pages, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  } else {
+    glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, 0, gl_format, page_size, page_size, (GLsizei)num_pages, 0, (GLsizei)(layer_size * num_pages), NULL);
+  }
+
+  // Fill, encode and upload a page at a time, so only one is ever in memory
+  stbi_set_flip_vertically_on_load(1);
+  for(size_t p = 0; p < num_pages; p++) {
+    memset(page, 0, page_bytes);
+    for(size_t i = 0; i < num_images; i++) {
+      nu_AtlasEntry *entry = &entries[i];
+      if(entry->layer != p) continue;
+      int w, h, comp;
+      const char *loc = image_locs[entry->index];
+      unsigned char *image = stbi_load(loc, &w, &h, &comp, STBI_rgb_alpha);
+      if(!image || (size_t)w + 2 * padding != entry->width || (size_t)h + 2 * padding != entry->height) {
+        fprintf(stderr, "(nu_create_atlas): Couldn't create atlas, image %s %s.\n", loc, image ? "changed size while loading" : "failed to load");
+        if(image) stbi_image_free(image);
+        goto cleanup;
+      }
+      nu_blit_padded(page, page_size, image, w, h, entry->x, entry->y, padding);
+      stbi_image_free(image);
+      atlas->rects[entry->index] = (nu_AtlasRect){
+        .u0 = (float)(entry->x + padding) / page_size,
+        .v0 = (float)(entry->y + padding) / page_size,
+        .u1 = (float)(entry->x + padding + w) / page_size,
+        .v1 = (float)(entry->y + padding + h) / page_size,
+        .layer = p,
+        .width = w,
+        .height = h
+      };
+    }
+    if(format == NU_TEXTURE_RGBA8) {
+      glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, (GLint)p, page_size, page_size, 1, GL_RGBA, GL_UNSIGNED_BYTE, page);
+    } else {
+      nu_encode_image(format, page, page_size, page_size, encoded, true);
+      glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, (GLint)p, page_size, page_size, 1, gl_format, (GLsizei)layer_size, encoded);
+    }
+  }
+
+  atlas->texture = calloc(1, sizeof(nu_Texture));
+  if(!atlas->texture) {
+    fprintf(stderr, "(nu_create_atlas): Couldn't create atlas, calloc failed.\n");
+    goto cleanup;
+  }
+  *atlas->texture = (nu_Texture){
+    .id = id,
+    .type = GL_TEXTURE_2D_ARRAY,
+    .width = page_size,
+    .height = page_size,
+    .layers = num_pages,
+    .levels = 1,
+    .format = gl_format
+  };
+  nu_count_new_texture(atlas->texture);
+  failed = false;
+
+cleanup:
+  for(size_t p = 0; p < num_pages; p++) free(pages[p].nodes);
+  free(pages);
+  free(entries);
+  free(page);
+  free(encoded);
+  if(failed) {
+    if(id) {
+      glDeleteTextures(1, &id);
+      nu_state_forget_texture(id);
+    }
+    if(atlas) free(atlas->rects);
+    free(atlas);
+    return NULL;
+  }
+  return atlas;
+}
+
+void nu_destroy_atlas(nu_Atlas **atlas) {
+  if(!atlas || !(*atlas)) return;
+  nu_destroy_texture(&(*atlas)->texture);
+  free((*atlas)->rects);
+  free(*atlas);
+  *atlas = NULL;
+}
+
+// Resource cache
+// Shared, reference counted textures, programs and mapped files. Entries
+// are found by the hash of their key, then compared in full
+typedef struct {
+  nu_ResourceType type;
+  char *key;
+  uint64_t hash;
+  nu_TextureFormat format;
+  size_t refs;
+  void *object;
+  // Mapped length, for files
+  size_t size;
+} nu_Resource;
+
+static nu_Resource *nu_resources = NULL;
+static size_t nu_num_resources = 0;
+static size_t nu_resources_alloced = 0;
+
+static nu_Resource *nu_find_resource(nu_ResourceType type, const char *key, nu_TextureFormat format) {
+  uint64_t hash = nu_hash_string(key);
+  for(size_t i = 0; i < nu_num_resources; i++) {
+    nu_Resource *resource = &nu_resources[i];
+    if(resource->hash == hash && resource->type == type && resource->format == format && strcmp(resource->key, key) == 0) return resource;
+  }
+  return NULL;
+}
+
+static nu_Resource *nu_find_resource_object(nu_ResourceType type, const void *object) {
+  for(size_t i = 0; i < nu_num_resources; i++) {
+    if(nu_resources[i].type == type && nu_resources[i].object == object) return &nu_resources[i];
+  }
+  return NULL;
+}
+
+// Adds a resource with one reference. Takes ownership of key, freeing it
+// on failure
+static bool nu_add_resource(nu_ResourceType type, char *key, nu_TextureFormat format, void *object, size_t size) {
+  if(nu_num_resources == nu_resources_alloced) {
+    size_t alloced = nu_resources_alloced ? nu_resources_alloced * 2 : 16;
+    nu_Resource *grown = realloc(nu_resources, alloced * sizeof(nu_Resource));
+    if(!grown) {
+      fprintf(stderr, "(nu_add_resource): Couldn't cache \"%s\", realloc failed.\n", key);
+      free(key);
+      return false;
+    }
+    nu_resources = grown;
+    nu_resources_alloced = alloced;
+  }
+  nu_resources[nu_num_resources++] = (nu_Resource){
+    .type = type,
+    .key = key,
+    .hash = nu_hash_string(key),
+    .format = format,
+    .refs = 1,
+    .object = object,
+    .size = size
+  };
+  return true;
+}
+
+static void nu_remove_resource(nu_Resource *resource) {
+  free(resource->key);
+  *resource = nu_resources[--nu_num_resources];
+}
+
+nu_Texture *nu_acquire_texture(const char *texture_loc, nu_TextureFormat format) {
+  if(!texture_loc) return NULL;
+  char *key = nu_canonical_path(texture_loc);
+  if(!key) {
+    fprintf(stderr, "(nu_acquire_texture): Couldn't load texture \"%s\", the file doesn't exist.\n", texture_loc);
+    return NULL;
+  }
+  nu_Resource *cached = nu_find_resource(NU_RESOURCE_TEXTURE, key, format);
+  if(cached) {
+    free(key);
+    cached->refs++;
+    return cached->object;
+  }
+  nu_Texture *texture = nu_load_texture_with_format(key, format);
+  if(!texture) {
+    free(key);
+    return NULL;
+  }
+  if(!nu_add_resource(NU_RESOURCE_TEXTURE, key, format, texture, 0)) {
+    nu_destroy_texture(&texture);
+    return NULL;
+  }
+  return texture;
+}
+
+nu_Program *nu_acquire_program(size_t num_shaders, ...) {
+  if(num_shaders == 0) return NULL;
+  va_list args;
+  va_start(args, num_shaders);
+  const char **shader_locs = nu_collect_shader_locs(num_shaders, args);
+  va_end(args);
+  if(!shader_locs) return NULL;
+
+  // The key is every canonical path in order, joined by '|'
+  char **canonical = calloc(num_shaders, sizeof(char *));
+  nu_StringBuilder key = {0};
+  nu_Program *program = NULL;
+  bool valid = canonical != NULL;
+  for(size_t i = 0; valid && i < num_shaders; i++) {
+    canonical[i] = shader_locs[i] ? nu_canonical_path(shader_locs[i]) : NULL;
+    if(!canonical[i]) {
+      fprintf(stderr, "(nu_acquire_program): Couldn't create shader program, shader file %s doesn't exist.\n", shader_locs[i] ? shader_locs[i] : "(null)");
+      valid = false;
+      break;
+    }
+    valid = (i == 0 || nu_string_append(&key, "|", 1)) && nu_string_append(&key, canonical[i], strlen(canonical[i]));
+  }
+  if(valid) {
+    nu_Resource *cached = nu_find_resource(NU_RESOURCE_PROGRAM, key.data, NU_TEXTURE_RGBA8);
+    if(cached) {
+      cached->refs++;
+      program = cached->object;
+    } else {
+      program = nu_build_program(num_shaders, (const char **)canonical);
+      if(program && nu_add_resource(NU_RESOURCE_PROGRAM, key.data, NU_TEXTURE_RGBA8, program, 0)) {
+        // The cache owns the key now
+        key.data = NULL;
+      } else if(program) {
+        key.data = NULL;
+        nu_destroy_program(&program);
+      }
+    }
+  }
+  for(size_t i = 0; canonical && i < num_shaders; i++) free(canonical[i]);
+  free(canonical);
+  free(key.data);
+  free(shader_locs);
+  return program;
+}
+
+const uint8_t *nu_acquire_file(const char *file_loc, size_t *size) {
+  if(!file_loc || !size) return NULL;
+  char *key = nu_canonical_path(file_loc);
+  if(!key) {
+    fprintf(stderr, "(nu_acquire_file): Couldn't read file %s, it doesn't exist.\n", file_loc);
+    return NULL;
+  }
+  nu_Resource *cached = nu_find_resource(NU_RESOURCE_FILE, key, NU_TEXTURE_RGBA8);
+  if(cached) {
+    free(key);
+    cached->refs++;
+    *size = cached->size;
+    return cached->object;
+  }
+  size_t file_size = 0;
+  const uint8_t *data = nu_map_file(key, &file_size);
+  if(!data) {
+    fprintf(stderr, "(nu_acquire_file): Couldn't read file %s, mapping it failed.\n", file_loc);
+    free(key);
     return NULL;
   }
-  // Generate VAO and VBO
-  out->stride = nu_define_layout(&out->VAO, &out->VBO, num_components, component_sizes, component_counts, component_types);
-  if(out->stride == 0) {
-    fprintf(stderr, "(nu_create_mesh): Couldn't create mesh, stride was 0.\n");
-    glDeleteVertexArrays(1, &out->VAO);
-    glDeleteBuffers(1, &out->VBO);
-    free(out);
+  if(!nu_add_resource(NU_RESOURCE_FILE, key, NU_TEXTURE_RGBA8, (void *)data, file_size)) {
+    nu_unmap_file(data, file_size);
     return NULL;
   }
-  out->builder_data = NULL;
-  out->builder_alloced = 0;
-  out->builder_added = 0;
-  out->last_send_size = 0;
-  out->render_mode = GL_TRIANGLES;
-  return out;
-} 
+  *size = file_size;
+  return data;
+}
 
-void nu_mesh_add_bytes(nu_Mesh *mesh, size_t num_bytes, void *src) {
-  if(!mesh || !src || num_bytes == 0) return;
-  if(!mesh->builder_data) {
-    mesh->builder_data = calloc(num_bytes, sizeof(uint8_t));
-    if(!mesh->builder_data) {
-      fprintf(stderr, "(nu_mesh_add_bytes): Error adding bytes to mesh, calloc failed.\n");
-      return;
-    }
-    mesh->builder_alloced = num_bytes;
+void nu_release_texture(nu_Texture **texture) {
+  if(!texture || !(*texture)) return;
+  nu_Resource *resource = nu_find_resource_object(NU_RESOURCE_TEXTURE, *texture);
+  if(!resource) {
+    fprintf(stderr, "(nu_release_texture): Couldn't release texture, it isn't from the resource cache.\n");
+    return;
   }
+  if(--resource->refs == 0) {
+    nu_destroy_texture(texture);
+    nu_remove_resource(resource);
+  }
+  *texture = NULL;
+}
 
-  // Resize buffer if too small
-  if(mesh->builder_added + num_bytes > mesh->builder_alloced) {
-    while(mesh->builder_added + num_bytes > mesh->builder_alloced) {
-      mesh->builder_alloced *= 2; 
-    }
-    uint8_t *new = calloc(mesh->builder_alloced, sizeof(uint8_t));
-    if(!new) {
-      fprintf(stderr, "(nu_mesh_add_bytes): Error adding bytes to mesh, reallocation failed.\n");
-      return;
-    }
-    memcpy(new, mesh->builder_data, mesh->builder_added);
-    free(mesh->builder_data);
-    mesh->builder_data = new;
+void nu_release_program(nu_Program **program) {
+  if(!program || !(*program)) return;
+  nu_Resource *resource = nu_find_resource_object(NU_RESOURCE_PROGRAM, *program);
+  if(!resource) {
+    fprintf(stderr, "(nu_release_program): Couldn't release program, it isn't from the resource cache.\n");
+    return;
+  }
+  if(--resource->refs == 0) {
+    nu_destroy_program(program);
+    nu_remove_resource(resource);
   }
+  *program = NULL;
+}
 
-  // Add bytes
-  memcpy(mesh->builder_data + mesh->builder_added, src, sizeof(uint8_t) * num_bytes); 
-  mesh->builder_added += num_bytes;
+void nu_release_file(const uint8_t **data) {
+  if(!data || !(*data)) return;
+  nu_Resource *resource = nu_find_resource_object(NU_RESOURCE_FILE, *data);
+  if(!resource) {
+    fprintf(stderr, "(nu_release_file): Couldn't release file, it isn't from the resource cache.\n");
+    return;
+  }
+  if(--resource->refs == 0) {
+    nu_unmap_file(resource->object, resource->size);
+    nu_remove_resource(resource);
+  }
+  *data = NULL;
 }
 
-void nu_destroy_mesh(nu_Mesh **mesh) {
-  if(!mesh || !(*mesh)) return;
-  if((*mesh)->builder_data) free((*mesh)->builder_data);
-  if((*mesh)->VAO) glDeleteVertexArrays(1, &(*mesh)->VAO);
-  if((*mesh)->VBO) glDeleteBuffers(1, &(*mesh)->VBO);
-  free(*mesh);
-  *mesh = NULL;
+size_t nu_texture_gpu_bytes(const nu_Texture *texture) {
+  if(!texture) return 0;
+  size_t bytes = 0;
+  for(size_t l = 0; l < texture->levels; l++) {
+    size_t width = nu_mip_size(texture->width, l), height = nu_mip_size(texture->height, l);
+    size_t level_size = nu_nut_level_size(texture->format, width, height);
+    // Anything unknown is counted as RGBA8
+    bytes += (level_size ? level_size : width * height * 4) * texture->layers;
+  }
+  return bytes;
 }
 
-void nu_free_mesh(nu_Mesh *mesh) {
-  if(!mesh) return;
-  if(mesh->builder_data) free(mesh->builder_data);
-  mesh->builder_data = NULL;
-  mesh->builder_added = 0;
-  mesh->builder_alloced = 0;
+// A linked program's binary size is the closest thing GL reports to the
+// memory it takes
+static size_t nu_program_gpu_bytes(nu_Program *program) {
+  if(program->pending || program->failed || !GLEW_ARB_get_program_binary) return 0;
+  GLint length = 0;
+  glGetProgramiv(program->shader_program, GL_PROGRAM_BINARY_LENGTH, &length);
+  return length > 0 ? (size_t)length : 0;
 }
 
-static void nu_bind_mesh(nu_Mesh *mesh) {
-  if(!mesh) return;
-  glBindVertexArray(mesh->VAO);
-  glBindBuffer(GL_ARRAY_BUFFER, mesh->VBO);
+size_t nu_get_resources(nu_ResourceInfo *out, size_t max_resources) {
+  for(size_t i = 0; out && i < nu_num_resources && i < max_resources; i++) {
+    nu_Resource *resource = &nu_resources[i];
+    out[i] = (nu_ResourceInfo){
+      .type = resource->type,
+      .key = resource->key,
+      .format = resource->format,
+      .refs = resource->refs
+    };
+    switch(resource->type) {
+      case NU_RESOURCE_TEXTURE: out[i].bytes = nu_texture_gpu_bytes(resource->object); break;
+      case NU_RESOURCE_PROGRAM: out[i].bytes = nu_program_gpu_bytes(resource->object); break;
+      case NU_RESOURCE_FILE: out[i].bytes = resource->size; break;
+    }
+  }
+  return nu_num_resources;
 }
 
-static void nu_unbind_mesh() {
-  glBindVertexArray(0);
-  glBindBuffer(GL_ARRAY_BUFFER, 0);
+void nu_bind_texture(nu_Texture *texture, size_t slot){
+  if(!texture) return;
+  nu_state_bind_texture(slot, texture->type, texture->id);
 }
 
-void nu_mesh_set_render_mode(nu_Mesh *mesh, GLenum render_mode) {
-  if(!mesh) return;
-  mesh->render_mode = render_mode;
+void nu_destroy_texture(nu_Texture **texture) {
+  if(!texture || !(*texture)) return;
+  if((*texture)->id) {
+    glDeleteTextures(1, &((*texture)->id));
+    nu_state_forget_texture((*texture)->id);
+    nu_count_objects(NU_GPU_TEXTURE, -1, -(int64_t)nu_texture_gpu_bytes(*texture));
+  }
+  free(*texture);
+  *texture = NULL;
 }
 
-void nu_send_mesh(nu_Mesh *mesh) {
-  if(!mesh) return;
-  if(!mesh->builder_data) return;
-  if(!mesh->VAO || !mesh->VBO) return;
-  mesh->last_send_size = mesh->builder_added;
-  nu_bind_mesh(mesh);
-  glBufferData(GL_ARRAY_BUFFER, mesh->builder_added, mesh->builder_data, GL_STATIC_DRAW);
-  nu_unbind_mesh();
+// Loader
+// Makes the loader's shared context current on the calling thread
+static bool nu_loader_make_current(nu_Loader *loader) {
+  if(loader->shared_window) {
+    glfwMakeContextCurrent(loader->shared_window);
+    return true;
+  }
+#ifdef NUGL_HEADLESS
+  return eglMakeCurrent(loader->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, loader->egl_context);
+#else
+  return false;
+#endif
 }
 
-void nu_render_mesh(nu_Mesh *mesh) {
-  if(!mesh) return;
-  if(mesh->last_send_size == 0) return;
-  nu_bind_mesh(mesh);  
-  glDrawArrays(mesh->render_mode, 0, mesh->last_send_size / mesh->stride);
-  nu_unbind_mesh();
+static void nu_loader_release_current(nu_Loader *loader) {
+  if(loader->shared_window) {
+    glfwMakeContextCurrent(NULL);
+    return;
+  }
+#ifdef NUGL_HEADLESS
+  eglMakeCurrent(loader->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+#endif
 }
 
-void nu_update_input(nu_Window *window) {
-  if(!window) return;
-  // Update previous input
-  for(size_t i = 0; i < KEY_COUNT; i++) {
-    window->last_keys[i] = window->keys[i];
-  } 
-  window->last_mouse_x = window->mouse_x;
-  window->last_mouse_y = window->mouse_y;
-  window->last_mouse_left = window->mouse_left;
-  window->last_mouse_right = window->mouse_right;
+// Waits until the frame's upload budget has room, false if quitting
+static bool nu_loader_wait_budget(nu_Loader *loader) {
+  pthread_mutex_lock(&loader->mutex);
+  while(!loader->quit && loader->frame_budget > 0 && loader->budget_left <= 0) {
+    pthread_cond_wait(&loader->wake, &loader->mutex);
+  }
+  bool quit = loader->quit;
+  pthread_mutex_unlock(&loader->mutex);
+  return !quit;
 }
 
-void nu_start_frame(nu_Window *window) {
-  if(!window || !window->glfw_window || !window->focused) return;
-  // Clear screen
-  glClearColor(0, 0, 0, 1);
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+static void nu_loader_spend_budget(nu_Loader *loader, size_t bytes) {
+  pthread_mutex_lock(&loader->mutex);
+  loader->budget_left -= (int64_t)bytes;
+  pthread_mutex_unlock(&loader->mutex);
 }
 
-void nu_end_frame(nu_Window *window) {
-  if(!window || !window->glfw_window) return;
-  if(window->focused) {
-    glfwSwapBuffers(window->glfw_window);
-    glfwPollEvents();
+// Decodes a texture, then uploads it through a pixel buffer object so the
+// copy into the texture happens on the GPU's timeline
+static void nu_loader_upload_texture(nu_Loader *loader, nu_LoadJob *job, GLuint pbo) {
+  int width, height, comp;
+  unsigned char *image = stbi_load(job->path, &width, &height, &comp, STBI_rgb_alpha);
+  if(!image) {
+    fprintf(stderr, "(nu_loader_load_texture): Error loading texture \"%s\", stbi_load returned NULL.\n", job->path);
+    job->failed = true;
     return;
   }
-  glfwWaitEvents();
+  size_t size = (size_t)width * height * 4;
+  if(!nu_loader_wait_budget(loader)) {
+    stbi_image_free(image);
+    job->failed = true;
+    return;
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+  // Orphan the last upload's store rather than wait for it to be read
+  glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+  void *staging = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  if(!staging) {
+    fprintf(stderr, "(nu_loader_load_texture): Error loading texture \"%s\", glMapBufferRange() returned NULL.\n", job->path);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    stbi_image_free(image);
+    job->failed = true;
+    return;
+  }
+  memcpy(staging, image, size);
+  glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+  stbi_image_free(image);
+
+  glGenTextures(1, &job->texture);
+  glBindTexture(GL_TEXTURE_2D, job->texture);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  job->width = width;
+  job->height = height;
+  nu_loader_spend_budget(loader, size);
 }
 
-// Texture loading
-nu_Texture *nu_load_texture(const char *file_loc) {
-  if(!file_loc) return NULL;
-  // Load the image
-  int image_width, image_height, comp;
-  stbi_set_flip_vertically_on_load(1);
-  unsigned char *image = stbi_load(file_loc, &image_width, &image_height, &comp, STBI_rgb_alpha);
+// Uploads a meshes builder data and indices. The VAO isn't shared between
+// contexts, so the buffers are written through GL_COPY_WRITE_BUFFER and the
+// render thread points the VAO at the EBO on publish
+static void nu_loader_upload_mesh(nu_Loader *loader, nu_LoadJob *job) {
+  nu_Mesh *mesh = job->mesh;
+  if(!nu_loader_wait_budget(loader)) {
+    job->failed = true;
+    return;
+  }
+  GLenum usage = nu_mesh_gl_usage(mesh);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, mesh->VBO);
+  glBufferData(GL_COPY_WRITE_BUFFER, mesh->builder_added, mesh->builder_data, usage);
+  size_t bytes = mesh->builder_added;
+  if(mesh->builder_indices_added > 0) {
+    size_t index_size;
+    uint16_t *short_indices;
+    void *data = nu_pack_indices(mesh, &job->index_type, &index_size, &short_indices);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, mesh->EBO);
+    glBufferData(GL_COPY_WRITE_BUFFER, mesh->builder_indices_added * index_size, data, usage);
+    free(short_indices);
+    bytes += mesh->builder_indices_added * index_size;
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  nu_loader_spend_budget(loader, bytes);
+}
 
-  if (image == NULL) {
-    fprintf(stderr, "(nu_load_texture): Error loading texture \"%s\", stbi_load returned NULL.\n", file_loc);
-    return NULL;
+static void *nu_loader_thread(void *arg) {
+  nu_Loader *loader = arg;
+  bool current = nu_loader_make_current(loader);
+  pthread_mutex_lock(&loader->mutex);
+  loader->context_ready = true;
+  loader->context_failed = !current;
+  pthread_cond_broadcast(&loader->wake);
+  pthread_mutex_unlock(&loader->mutex);
+  if(!current) return NULL;
+
+  stbi_set_flip_vertically_on_load_thread(1);
+  GLuint pbo;
+  glGenBuffers(1, &pbo);
+  for(;;) {
+    pthread_mutex_lock(&loader->mutex);
+    while(!loader->quit && !loader->queued) pthread_cond_wait(&loader->wake, &loader->mutex);
+    if(loader->quit) {
+      pthread_mutex_unlock(&loader->mutex);
+      break;
+    }
+    nu_LoadJob *job = loader->queued;
+    loader->queued = job->next;
+    if(!loader->queued) loader->queued_tail = NULL;
+    pthread_mutex_unlock(&loader->mutex);
+
+    if(job->type == NU_LOAD_TEXTURE) {
+      nu_loader_upload_texture(loader, job, pbo);
+    } else {
+      nu_loader_upload_mesh(loader, job);
+    }
+    if(!job->failed) {
+      // Flush so the fence reaches the GPU, other contexts can't flush it
+      job->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      glFlush();
+    }
+    pthread_mutex_lock(&loader->mutex);
+    job->next = loader->uploaded;
+    loader->uploaded = job;
+    pthread_mutex_unlock(&loader->mutex);
   }
+  glDeleteBuffers(1, &pbo);
+  glFinish();
+  nu_loader_release_current(loader);
+  return NULL;
+}
 
-  // Create and bind the texture
-  GLuint id;
-  glGenTextures(1, &id);
-  glBindTexture(GL_TEXTURE_2D, id);
+nu_Loader *nu_create_loader(nu_Window *window, size_t frame_budget) {
+  if(!window) return NULL;
+  nu_Loader *loader = calloc(1, sizeof(nu_Loader));
+  if(!loader) {
+    fprintf(stderr, "(nu_create_loader): Couldn't create loader, calloc failed.\n");
+    return NULL;
+  }
+  loader->frame_budget = frame_budget;
+  loader->budget_left = (int64_t)frame_budget;
+  // The shared context is created here, GLFW windows can only be created on
+  // the main thread
+  if(window->glfw_window) {
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    loader->shared_window = glfwCreateWindow(1, 1, "nuGL loader", NULL, window->glfw_window);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    if(!loader->shared_window) {
+      fprintf(stderr, "(nu_create_loader): Couldn't create loader, glfwCreateWindow() failed.\n");
+      free(loader);
+      return NULL;
+    }
+  } else if(window->headless) {
+#ifdef NUGL_HEADLESS
+    const EGLint context_attribs[] = {
+      EGL_CONTEXT_MAJOR_VERSION, 3,
+      EGL_CONTEXT_MINOR_VERSION, 3,
+      EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+      EGL_NONE
+    };
+    loader->egl_display = window->egl_display;
+    loader->egl_context = eglCreateContext(window->egl_display, window->egl_config, window->egl_context, context_attribs);
+    if(loader->egl_context == EGL_NO_CONTEXT) {
+      fprintf(stderr, "(nu_create_loader): Couldn't create loader, eglCreateContext() failed.\n");
+      free(loader);
+      return NULL;
+    }
+#endif
+  } else {
+    free(loader);
+    return NULL;
+  }
+  pthread_mutex_init(&loader->mutex, NULL);
+  pthread_cond_init(&loader->wake, NULL);
+  bool started = pthread_create(&loader->thread, NULL, nu_loader_thread, loader) == 0;
+  if(started) {
+    pthread_mutex_lock(&loader->mutex);
+    while(!loader->context_ready) pthread_cond_wait(&loader->wake, &loader->mutex);
+    pthread_mutex_unlock(&loader->mutex);
+    if(loader->context_failed) pthread_join(loader->thread, NULL);
+  }
+  if(!started || loader->context_failed) {
+    fprintf(stderr, "(nu_create_loader): Couldn't create loader, %s.\n", started ? "the shared context couldn't be made current" : "pthread_create failed");
+    pthread_mutex_destroy(&loader->mutex);
+    pthread_cond_destroy(&loader->wake);
+    if(loader->shared_window) glfwDestroyWindow(loader->shared_window);
+#ifdef NUGL_HEADLESS
+    if(loader->egl_context) eglDestroyContext(loader->egl_display, loader->egl_context);
+#endif
+    free(loader);
+    return NULL;
+  }
+  return loader;
+}
 
-  // Set parameters
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+static void nu_free_load_job(nu_LoadJob *job) {
+  if(job->fence) glDeleteSync(job->fence);
+  free(job->path);
+  free(job);
+}
 
-  // Upload the loaded image to the texture
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image_width, image_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
+// Frees a list of jobs, deleting the textures they made
+static void nu_drop_load_jobs(nu_LoadJob *job) {
+  while(job) {
+    nu_LoadJob *next = job->next;
+    if(job->texture) glDeleteTextures(1, &job->texture);
+    if(job->mesh) job->mesh->loading = false;
+    nu_free_load_job(job);
+    job = next;
+  }
+}
 
-  // Free image
-  stbi_image_free(image);
+void nu_destroy_loader(nu_Loader **loader) {
+  if(!loader || !(*loader)) return;
+  pthread_mutex_lock(&(*loader)->mutex);
+  (*loader)->quit = true;
+  pthread_cond_broadcast(&(*loader)->wake);
+  pthread_mutex_unlock(&(*loader)->mutex);
+  pthread_join((*loader)->thread, NULL);
+  nu_drop_load_jobs((*loader)->queued);
+  nu_drop_load_jobs((*loader)->uploaded);
+  nu_drop_load_jobs((*loader)->fenced);
+  pthread_mutex_destroy(&(*loader)->mutex);
+  pthread_cond_destroy(&(*loader)->wake);
+  if((*loader)->shared_window) glfwDestroyWindow((*loader)->shared_window);
+#ifdef NUGL_HEADLESS
+  if((*loader)->egl_context) eglDestroyContext((*loader)->egl_display, (*loader)->egl_context);
+#endif
+  free(*loader);
+  *loader = NULL;
+}
 
-  glBindTexture(GL_TEXTURE_2D, 0);
+static bool nu_loader_queue(nu_Loader *loader, nu_LoadJob *job) {
+  pthread_mutex_lock(&loader->mutex);
+  if(loader->queued_tail) {
+    loader->queued_tail->next = job;
+  } else {
+    loader->queued = job;
+  }
+  loader->queued_tail = job;
+  pthread_cond_broadcast(&loader->wake);
+  pthread_mutex_unlock(&loader->mutex);
+  loader->num_outstanding++;
+  return true;
+}
 
-  // Allocate and set nu_Texture*
-  nu_Texture *result = calloc(1, sizeof(nu_Texture));
-  if(!result) {
-    fprintf(stderr, "(nu_load_texture): Error loading texture \"%s\", calloc failed.\n", file_loc);
-    glDeleteTextures(1, &id);
-    return NULL;
+bool nu_loader_load_texture(nu_Loader *loader, const char *texture_loc, nu_Texture **out, nu_TextureLoadedFn callback, void *user_data) {
+  if(!loader || !texture_loc) return false;
+  nu_LoadJob *job = calloc(1, sizeof(nu_LoadJob));
+  if(job) job->path = strdup(texture_loc);
+  if(!job || !job->path) {
+    fprintf(stderr, "(nu_loader_load_texture): Couldn't queue texture \"%s\", allocation failed.\n", texture_loc);
+    free(job);
+    return false;
   }
-  result->id = id;
-  result->type = GL_TEXTURE_2D;
-  return result;
+  job->type = NU_LOAD_TEXTURE;
+  job->out = out;
+  job->texture_callback = callback;
+  job->user_data = user_data;
+  if(out) *out = NULL;
+  return nu_loader_queue(loader, job);
 }
 
-nu_Texture *nu_load_texture_array(size_t num_textures, ...) {
-  if (num_textures == 0) return NULL;
+bool nu_loader_send_mesh(nu_Loader *loader, nu_Mesh *mesh, nu_MeshLoadedFn callback, void *user_data) {
+  if(!loader || !mesh || !mesh->builder_data) return false;
+  if(mesh->usage == NU_MESH_STREAM || mesh->mapped_data || mesh->loading) {
+    fprintf(stderr, "(nu_loader_send_mesh): Couldn't queue mesh, it's streaming, mapped, or already loading.\n");
+    return false;
+  }
+  nu_LoadJob *job = calloc(1, sizeof(nu_LoadJob));
+  if(!job) {
+    fprintf(stderr, "(nu_loader_send_mesh): Couldn't queue mesh, calloc failed.\n");
+    return false;
+  }
+  job->type = NU_LOAD_MESH;
+  job->mesh = mesh;
+  job->mesh_callback = callback;
+  job->user_data = user_data;
+  // Buffer names are shared, so the EBO is made here where the VAO can be
+  // bound to take it
+  if(mesh->builder_indices_added > 0 && !mesh->EBO) {
+    glGenBuffers(1, &mesh->EBO);
+    nu_count_objects(NU_GPU_BUFFER, 1, 0);
+    nu_state_bind_vertex_array(mesh->VAO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->EBO);
+  }
+  mesh->loading = true;
+  return nu_loader_queue(loader, job);
+}
 
-  va_list args;
-  va_start(args, num_textures);
+// Hands a finished job to the render thread's side
+static void nu_loader_publish(nu_LoadJob *job) {
+  if(job->type == NU_LOAD_TEXTURE) {
+    nu_Texture *texture = NULL;
+    if(!job->failed) {
+      texture = calloc(1, sizeof(nu_Texture));
+      if(texture) {
+        texture->id = job->texture;
+        texture->type = GL_TEXTURE_2D;
+        texture->width = job->width;
+        texture->height = job->height;
+        texture->layers = 1;
+        texture->levels = 1;
+        texture->format = GL_RGBA8;
+        job->texture = 0;
+        nu_count_new_texture(texture);
+      } else {
+        fprintf(stderr, "(nu_loader_poll): Couldn't publish texture \"%s\", calloc failed.\n", job->path);
+        glDeleteTextures(1, &job->texture);
+        job->texture = 0;
+      }
+    }
+    if(job->out) *job->out = texture;
+    if(job->texture_callback) job->texture_callback(texture, job->user_data);
+    return;
+  }
+  nu_Mesh *mesh = job->mesh;
+  mesh->loading = false;
+  if(!job->failed) {
+    // The loader counts nothing itself, its uploads land in the frame they
+    // are published in
+    size_t index_size = job->index_type == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+    size_t index_alloced = mesh->builder_indices_added > 0 ? mesh->builder_indices_added * index_size : mesh->index_alloced;
+    nu_count_objects(NU_GPU_BUFFER, 0, (int64_t)mesh->builder_added - (int64_t)mesh->gpu_alloced + (int64_t)index_alloced - (int64_t)mesh->index_alloced);
+    nu_counters->buffer_upload_bytes += mesh->builder_added + (mesh->builder_indices_added > 0 ? index_alloced : 0);
+    mesh->index_alloced = index_alloced;
+    mesh->gpu_alloced = mesh->builder_added;
+    mesh->last_send_size = mesh->builder_added;
+    mesh->num_dirty_ranges = 0;
+    mesh->indices_dirty = false;
+    mesh->index_count = mesh->builder_indices_added;
+    if(mesh->index_count > 0) mesh->index_type = job->index_type;
+  }
+  if(job->mesh_callback) job->mesh_callback(job->failed ? NULL : mesh, job->user_data);
+}
 
-  stbi_set_flip_vertically_on_load(1);
+size_t nu_loader_poll(nu_Loader *loader) {
+  if(!loader) return 0;
+  pthread_mutex_lock(&loader->mutex);
+  loader->budget_left = (int64_t)loader->frame_budget;
+  pthread_cond_broadcast(&loader->wake);
+  nu_LoadJob *uploaded = loader->uploaded;
+  loader->uploaded = NULL;
+  pthread_mutex_unlock(&loader->mutex);
+  while(uploaded) {
+    nu_LoadJob *next = uploaded->next;
+    uploaded->next = loader->fenced;
+    loader->fenced = uploaded;
+    uploaded = next;
+  }
 
-  char *first_path = va_arg(args, char *);
-  int width, height, comp;
-  unsigned char *first_image = stbi_load(first_path, &width, &height, &comp, STBI_rgb_alpha);
-  if (!first_image) {
-    fprintf(stderr, "(nu_load_texture_array): Failed to load first image %s\n", first_path);
-    va_end(args);
-    return NULL;
+  // Publish every job whose fence has signalled, without waiting on any
+  size_t num_published = 0;
+  nu_LoadJob **link = &loader->fenced;
+  while(*link) {
+    nu_LoadJob *job = *link;
+    if(job->fence) {
+      GLenum res = glClientWaitSync(job->fence, 0, 0);
+      if(res != GL_ALREADY_SIGNALED && res != GL_CONDITION_SATISFIED) {
+        link = &job->next;
+        continue;
+      }
+    }
+    *link = job->next;
+    nu_loader_publish(job);
+    nu_free_load_job(job);
+    loader->num_outstanding--;
+    num_published++;
   }
+  return num_published;
+}
 
-  GLuint id;
-  glGenTextures(1, &id);
-  glBindTexture(GL_TEXTURE_2D_ARRAY, id);
+size_t nu_loader_pending(nu_Loader *loader) {
+  if(!loader) return 0;
+  return loader->num_outstanding;
+}
 
-  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+// Render queue
+nu_RenderQueue *nu_create_render_queue(void) {
+  nu_RenderQueue *queue = calloc(1, sizeof(nu_RenderQueue));
+  if(!queue) {
+    fprintf(stderr, "(nu_create_render_queue): Couldn't create render queue, calloc failed.\n");
+    return NULL;
+  }
+  return queue;
+}
 
-  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height, (GLsizei)num_textures, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-  glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, first_image);
+void nu_destroy_render_queue(nu_RenderQueue **queue) {
+  if(!queue || !(*queue)) return;
+  if((*queue)->commands) free((*queue)->commands);
+  if((*queue)->uniforms) free((*queue)->uniforms);
+  if((*queue)->uniform_data) free((*queue)->uniform_data);
+  free(*queue);
+  *queue = NULL;
+}
 
-  stbi_image_free(first_image);
+// Grows a queue array to hold at least required elements
+static bool nu_queue_grow(void **array, size_t *alloced, size_t required, size_t element_size) {
+  if(required <= *alloced) return true;
+  size_t new_alloced = *alloced ? *alloced : 64;
+  while(required > new_alloced) {
+    new_alloced *= 2;
+  }
+  void *new = realloc(*array, new_alloced * element_size);
+  if(!new) return false;
+  *array = new;
+  *alloced = new_alloced;
+  return true;
+}
 
-  for (size_t i = 1; i < num_textures; i++) {
-    char *path = va_arg(args, char *);
+void nu_queue_submit(nu_RenderQueue *queue, nu_Program *program, size_t num_textures, nu_Texture **textures, nu_Mesh *mesh, size_t num_uniforms, nu_UniformValue *uniforms) {
+  if(!queue || !program || !mesh) return;
+  nu_finish_program(program);
+  if(num_textures > NU_QUEUE_MAX_TEXTURES) {
+    fprintf(stderr, "(nu_queue_submit): Couldn't submit draw, %zu textures is more than NU_QUEUE_MAX_TEXTURES.\n", num_textures);
+    return;
+  }
+  if(!nu_queue_grow((void **)&queue->commands, &queue->commands_alloced, queue->num_commands + 1, sizeof(nu_DrawCommand)) ||
+     !nu_queue_grow((void **)&queue->uniforms, &queue->uniforms_alloced, queue->num_uniforms + num_uniforms, sizeof(nu_QueuedUniform))) {
+    fprintf(stderr, "(nu_queue_submit): Couldn't submit draw, realloc failed.\n");
+    return;
+  }
+  nu_DrawCommand *command = &queue->commands[queue->num_commands];
+  *command = (nu_DrawCommand) {
+    .sequence = queue->num_commands,
+    .program = program,
+    .mesh = mesh,
+    .num_textures = num_textures,
+    .first_uniform = queue->num_uniforms,
+    .num_uniforms = 0
+  };
+  // Textures are identified by a fold of their ids, so draws sharing a set
+  // of textures sort next to each other
+  uint32_t texture_key = 0;
+  for(size_t i = 0; i < num_textures; i++) {
+    command->textures[i] = textures[i];
+    uint32_t id = textures[i] ? textures[i]->id : 0;
+    texture_key = texture_key * 31 + id;
+  }
+  command->key = ((uint64_t)(program->shader_program & 0xFFFF) << 48) |
+                 ((uint64_t)(texture_key & 0xFFFFFF) << 24) |
+                 ((uint64_t)(mesh->VAO & 0xFFFFFF));
 
-    int w, h, c;
-    unsigned char *image = stbi_load(path, &w, &h, &c, STBI_rgb_alpha);
-    if (!image) {
-      fprintf(stderr, "(nu_load_texture_array): Failed to load image %s\n", path);
-      glDeleteTextures(1, &id);
-      va_end(args);
-      return NULL;
+  // Uniform values are copied, so callers can reuse their buffers
+  for(size_t i = 0; i < num_uniforms; i++) {
+    nu_Uniform *uniform = nu_get_uniform(program, uniforms[i].name);
+    if(!uniform || !uniforms[i].data) {
+      fprintf(stderr, "(nu_queue_submit): Skipping uniform \"%s\", uniform not registered in shader program.\n", uniforms[i].name ? uniforms[i].name : "(null)");
+      continue;
     }
-
-    if (w != width || h != height) {
-      fprintf(stderr, "(nu_load_texture_array): Image %s does not match size %dx%d, skipping.\n", path, width, height);
-      stbi_image_free(image);
+    size_t size = nu_uniform_value_size(uniform);
+    if(!nu_queue_grow((void **)&queue->uniform_data, &queue->uniform_data_alloced, queue->uniform_data_added + size, 1)) {
+      fprintf(stderr, "(nu_queue_submit): Skipping uniform \"%s\", realloc failed.\n", uniforms[i].name);
       continue;
     }
-    
-    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, (GLint)i, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, image);
-    stbi_image_free(image);
+    memcpy(queue->uniform_data + queue->uniform_data_added, uniforms[i].data, size);
+    queue->uniforms[queue->num_uniforms++] = (nu_QueuedUniform) {
+      .uniform_index = (size_t)(uniform - program->uniforms),
+      .data_offset = queue->uniform_data_added
+    };
+    queue->uniform_data_added += size;
+    command->num_uniforms++;
   }
-  va_end(args);
+  queue->num_commands++;
+}
 
-  nu_Texture *result = calloc(1, sizeof(nu_Texture));
-  if(!result) {
-    fprintf(stderr, "(nu_load_texture_array): Couldn't load texture array, calloc failed.\n");
-    glDeleteTextures(1, &id);
-    return NULL;
+static int nu_compare_draw_commands(const void *a, const void *b) {
+  const nu_DrawCommand *x = a, *y = b;
+  if(x->key != y->key) return x->key < y->key ? -1 : 1;
+  // Keep submission order between equal keys
+  return (x->sequence > y->sequence) - (x->sequence < y->sequence);
+}
+
+static bool nu_same_draw_state(nu_DrawCommand *a, nu_DrawCommand *b) {
+  if(a->program != b->program || a->mesh != b->mesh || a->num_textures != b->num_textures) return false;
+  for(size_t i = 0; i < a->num_textures; i++) {
+    if(a->textures[i] != b->textures[i]) return false;
   }
-  result->id = id;
-  result->type = GL_TEXTURE_2D_ARRAY;
-  return result;
+  return true;
 }
 
-void nu_bind_texture(nu_Texture *texture, size_t slot){
-  if(!texture) return;
-  glActiveTexture(GL_TEXTURE0 + slot);
-  glBindTexture(texture->type, texture->id);
+// Counts the binds the commands would cost drawn in submission order, each
+// draw binding its mesh like nu_render_mesh does
+static size_t nu_queue_unsorted_binds(nu_RenderQueue *queue) {
+  size_t binds = 0;
+  nu_Program *program = NULL;
+  nu_Texture *bound[NU_QUEUE_MAX_TEXTURES] = {0};
+  // Commands are still in submission order here
+  for(size_t i = 0; i < queue->num_commands; i++) {
+    nu_DrawCommand *command = &queue->commands[i];
+    if(command->program != program) binds++;
+    program = command->program;
+    for(size_t t = 0; t < command->num_textures; t++) {
+      if(command->textures[t] != bound[t]) binds++;
+      bound[t] = command->textures[t];
+    }
+    binds++;
+  }
+  return binds;
 }
 
-void nu_destroy_texture(nu_Texture **texture) {
-  if(!texture || !(*texture)) return;
-  if((*texture)->id) {
-    glDeleteTextures(1, &((*texture)->id));
+void nu_flush_render_queue(nu_RenderQueue *queue) {
+  NU_PROFILE_FUNCTION();
+  if(!queue) return;
+  nu_RenderQueueStats stats = {0};
+  stats.submitted = queue->num_commands;
+  size_t unsorted_binds = nu_queue_unsorted_binds(queue);
+  qsort(queue->commands, queue->num_commands, sizeof(nu_DrawCommand), nu_compare_draw_commands);
+
+  nu_Program *program = NULL;
+  nu_Mesh *mesh = NULL;
+  nu_Texture *bound[NU_QUEUE_MAX_TEXTURES] = {0};
+  for(size_t i = 0; i < queue->num_commands;) {
+    nu_DrawCommand *command = &queue->commands[i];
+    nu_Mesh *command_mesh = command->mesh;
+    if(command_mesh->last_send_size == 0 || command_mesh->mapped_data || command_mesh->loading) {
+      i++;
+      continue;
+    }
+    if(command->program != program) {
+      nu_use_program(command->program);
+      program = command->program;
+      stats.program_binds++;
+    }
+    for(size_t t = 0; t < command->num_textures; t++) {
+      if(command->textures[t] && command->textures[t] != bound[t]) {
+        nu_bind_texture(command->textures[t], t);
+        bound[t] = command->textures[t];
+        stats.texture_binds++;
+      }
+    }
+    if(command_mesh != mesh) {
+      nu_state_bind_vertex_array(command_mesh->VAO);
+      mesh = command_mesh;
+      stats.mesh_binds++;
+    }
+    for(size_t u = 0; u < command->num_uniforms; u++) {
+      nu_QueuedUniform *queued = &queue->uniforms[command->first_uniform + u];
+      nu_set_uniform_value(program, &program->uniforms[queued->uniform_index], queue->uniform_data + queued->data_offset);
+    }
+    // Following draws with the same state and no uniforms of their own would
+    // draw the exact same thing, so they're merged into one instanced draw.
+    // Meshes with instance data draw their own instances, so aren't merged
+    size_t run = 1;
+    if(!command_mesh->instance_VBO) {
+      while(i + run < queue->num_commands &&
+            queue->commands[i + run].num_uniforms == 0 &&
+            nu_same_draw_state(command, &queue->commands[i + run])) {
+        run++;
+      }
+    }
+    nu_draw_mesh(command_mesh, run > 1 ? run : 0);
+    stats.draw_calls++;
+    stats.merged_draws += run - 1;
+    i += run;
   }
-  free(*texture);
-  *texture = NULL;
+
+  size_t binds = stats.program_binds + stats.texture_binds + stats.mesh_binds;
+  stats.state_changes_saved = unsorted_binds > binds ? unsorted_binds - binds : 0;
+  queue->stats = stats;
+  queue->num_commands = 0;
+  queue->num_uniforms = 0;
+  queue->uniform_data_added = 0;
+}
+
+nu_RenderQueueStats nu_get_render_queue_stats(nu_RenderQueue *queue) {
+  if(!queue) return (nu_RenderQueueStats) {0};
+  return queue->stats;
 }
 
 // Input functions
 bool nu_get_key_state(nu_Window *window, int keycode) {
-  if(!window) return false;
-  return window->keys[keycode];
+  if(!window || keycode < 0 || keycode >= KEY_COUNT) return false;
+  nu_drain_input(window);
+  return (window->keys[keycode / 64] >> (keycode % 64)) & 1;
 }
 
 bool nu_get_key_pressed(nu_Window *window, int keycode) {
-  if(!window) return false;
-  return window->keys[keycode] && !window->last_keys[keycode];
+  if(!window || keycode < 0 || keycode >= KEY_COUNT) return false;
+  nu_drain_input(window);
+  return (window->key_downs[keycode / 64] >> (keycode % 64)) & 1;
+}
+
+const nu_InputEvent *nu_get_input_events(nu_Window *window, size_t *count) {
+  if(count) *count = 0;
+  if(!window || !count) return NULL;
+  nu_drain_input(window);
+  *count = window->num_frame_events;
+  return window->frame_events;
 }
 
 double nu_get_mouse_x(nu_Window *window) {
   if(!window) return -1;
+  nu_drain_input(window);
   return window->mouse_x;
 }
 
 double nu_get_mouse_y(nu_Window *window) {
   if(!window) return -1;
+  nu_drain_input(window);
   return window->mouse_y;
 }
 
@@ -11,73 +11,569 @@
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #define KEY_COUNT (GLFW_KEY_LAST + 1)
+// 64 bit words in a key bitset
+#define NU_KEY_WORDS ((KEY_COUNT + 63) / 64)
+// Events the input queue holds between reads, a power of 2
+#define NU_INPUT_QUEUE_SIZE 1024
+
+// Frames kept for nu_get_frame_stats
+#define NU_FRAME_HISTORY 256
+// Frame time histogram buckets, 2 ms wide, the last holds everything longer
+#define NU_FRAME_HISTOGRAM_BUCKETS 32
 
 // Structs
+typedef enum {
+  NU_GPU_BUFFER,
+  NU_GPU_TEXTURE,
+  NU_GPU_VERTEX_ARRAY,
+  NU_GPU_PROGRAM,
+  NU_GPU_OBJECT_TYPES
+} nu_GpuObjectType;
+
+typedef struct {
+  // This frame's, reset by nu_start_frame. Vertices count every instance
+  size_t draw_calls, vertices, instances;
+  size_t buffer_upload_bytes, texture_upload_bytes;
+  // Binds that reached GL, ones the state cache skipped aren't counted
+  size_t program_binds, vertex_array_binds, texture_binds;
+  size_t uniform_sets;
+  // GL objects nuGL has alive, and the bytes of buffer and texture storage
+  size_t live_objects[NU_GPU_OBJECT_TYPES];
+  size_t live_bytes[NU_GPU_OBJECT_TYPES];
+} nu_RenderCounters;
+
+// Where one frame's time went, in nanoseconds
+typedef struct {
+  // From the end of the last frame to the end of this one
+  uint64_t frame_ns;
+  // Before nu_end_frame, on the CPU
+  uint64_t cpu_ns;
+  // Blocked in the buffer swap, e.g. on vsync
+  uint64_t swap_ns;
+  // Held back by the frame limiter
+  uint64_t wait_ns;
+} nu_FrameTiming;
+
+typedef struct {
+  // Frames the stats cover, up to NU_FRAME_HISTORY
+  size_t frames;
+  double avg_ms, p50_ms, p99_ms, max_ms;
+  // Frames over the target frame time (or 1/60 s with no target) by 10%
+  size_t over_budget;
+  // Averages of each part of a frame
+  double cpu_ms, swap_ms, wait_ms;
+  size_t histogram[NU_FRAME_HISTOGRAM_BUCKETS];
+} nu_FrameStats;
+
+typedef enum {
+  NU_INPUT_KEY,
+  NU_INPUT_MOUSE_BUTTON,
+  NU_INPUT_CURSOR,
+  NU_INPUT_FOCUS
+} nu_InputEventType;
+
+typedef struct {
+  nu_InputEventType type;
+  // GLFW key or mouse button, GLFW_PRESS/GLFW_RELEASE/GLFW_REPEAT (or the
+  // focus state) and modifier bits
+  int code, action, mods;
+  // Cursor position, for NU_INPUT_CURSOR
+  double x, y;
+  // When GLFW delivered the event, see nu_get_time_ns
+  uint64_t time_ns;
+} nu_InputEvent;
+
+// Single producer, single consumer ring of input events. The GLFW callbacks
+// write, the thread reading input consumes, without locks
+typedef struct {
+  nu_InputEvent events[NU_INPUT_QUEUE_SIZE];
+  _Alignas(64) atomic_size_t head;
+  _Alignas(64) atomic_size_t tail;
+  // Events lost to a full queue
+  atomic_size_t dropped;
+} nu_InputQueue;
+
 typedef struct {
   GLFWwindow *glfw_window;
   size_t width;
   size_t height;
-  bool keys[KEY_COUNT];
-  bool last_keys[KEY_COUNT];
+  // Key state as bitsets, a bit per GLFW key. key_downs has every key
+  // pressed since the last nu_update_input, even ones already released
+  uint64_t keys[NU_KEY_WORDS];
+  uint64_t last_keys[NU_KEY_WORDS];
+  uint64_t key_downs[NU_KEY_WORDS];
   double mouse_x, mouse_y;
   double last_mouse_x, last_mouse_y;
   bool mouse_left, mouse_right;
   bool last_mouse_left, last_mouse_right;
-  bool focused;
+  atomic_bool focused;
+  nu_InputQueue input_queue;
+  // Events applied since the last nu_update_input, see nu_get_input_events
+  nu_InputEvent *frame_events;
+  size_t num_frame_events, frame_events_alloced;
+  // Set while nu_run_with_input_thread runs, rendering on another thread
+  atomic_bool input_thread;
+  pthread_mutex_t focus_mutex;
+  pthread_cond_t focus_changed;
+  // Frame pacing, see nu_set_target_fps. 0 target_frame_ns is uncapped
+  int swap_interval;
+  uint64_t target_frame_ns;
+  uint64_t next_frame_ns;
+  // How early the limiter stops sleeping and starts spinning, tracks how
+  // late sleeps wake
+  uint64_t spin_ns;
+  uint64_t frame_start_ns;
+  nu_FrameTiming frame_history[NU_FRAME_HISTORY];
+  size_t num_frames;
+  // Renderer counters for the frame in progress, and the ring of finished
+  // frames nu_log_render_counters keeps
+  nu_RenderCounters counters;
+  nu_RenderCounters *counter_log;
+  size_t counter_log_size, num_logged_frames;
+  // Headless mode: an offscreen EGL context rendering into an FBO instead of a
+  // GLFW window (glfw_window is NULL)
+  bool headless;
+  void *egl_display, *egl_context, *egl_config;
+  GLuint fbo, fbo_color, fbo_depth;
 } nu_Window;
 
 typedef struct {
   char *name;
+  uint64_t hash;
   GLint location;
   GLenum type;
+  // Number of array elements, 1 for non-arrays
+  GLint size;
+  // Last value set, NULL until the first set. Identical sets are skipped
+  void *value;
 } nu_Uniform;
 
 typedef struct {
   size_t num_uniforms;
+  size_t uniforms_alloced;
   nu_Uniform *uniforms;
+  // Open addressing table of uniform handles, keyed by name hash
+  int32_t *uniform_table;
+  size_t uniform_table_size;
   GLuint shader_program;
+  // Shader files the program was built from
+  size_t num_shaders;
+  char **shader_locs;
+  // Submitted to the driver but not checked yet, see nu_program_ready.
+  // pending_shaders is NULL when the program came from the program cache
+  bool pending, failed;
+  GLuint *pending_shaders;
+  uint64_t cache_key;
 } nu_Program;
 
 typedef struct {
   GLuint id;
   GLenum type;
+  // Size of mip level 0, and the number of array layers (1 for GL_TEXTURE_2D)
+  size_t width, height, layers;
+  size_t levels;
+  // GL internal format, e.g. GL_RGBA8 or GL_COMPRESSED_RED_RGTC1
+  GLenum format;
 } nu_Texture;
 
+// Formats textures can be encoded to on the CPU when loading
+typedef enum {
+  // Uncompressed, 4 bytes per texel
+  NU_TEXTURE_RGBA8,
+  // S3TC DXT1, opaque RGB in 8 bytes per 4x4 block
+  NU_TEXTURE_BC1,
+  // S3TC DXT5, RGBA in 16 bytes per 4x4 block
+  NU_TEXTURE_BC3,
+  // RGTC1, red only in 8 bytes per 4x4 block
+  NU_TEXTURE_BC4,
+  // RGTC2, red and green in 16 bytes per 4x4 block, e.g. for normal maps
+  NU_TEXTURE_BC5
+} nu_TextureFormat;
+
+// nu texture container (.nut): a nu_NutHeader, then a nu_NutLevel per mip
+// level, then each level's texels (every layer of a level together, rows
+// bottom to top), ready to upload as they are
+#define NU_NUT_VERSION 1
+#define NU_NUT_MAX_LEVELS 16
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  // GL internal format of the texels, GL_RGBA8 or one of the compressed
+  // formats nu_TextureFormat maps to
+  uint32_t format;
+  uint32_t width, height;
+  // 0 for a GL_TEXTURE_2D, else the GL_TEXTURE_2D_ARRAY layer count
+  uint32_t layers;
+  uint32_t levels;
+  uint32_t reserved;
+} nu_NutHeader;
+
+// Where a mip level's texels are, in bytes from the start of the file
+typedef struct {
+  uint64_t offset, size;
+} nu_NutLevel;
+
+// Where one image of an atlas went. UVs cover the image without its padding
+typedef struct {
+  float u0, v0, u1, v1;
+  // Array layer of the atlas page holding the image
+  size_t layer;
+  // Size in texels
+  size_t width, height;
+} nu_AtlasRect;
+
+// Images packed into pages of one GL_TEXTURE_2D_ARRAY, so any of them can be
+// drawn with a single bind. rects has an entry per image, in input order
+typedef struct {
+  nu_Texture *texture;
+  size_t num_rects;
+  nu_AtlasRect *rects;
+} nu_Atlas;
+
+typedef enum {
+  NU_RESOURCE_TEXTURE,
+  NU_RESOURCE_PROGRAM,
+  NU_RESOURCE_FILE
+} nu_ResourceType;
+
+// One entry of the resource cache, see nu_get_resources
+typedef struct {
+  nu_ResourceType type;
+  // Canonical path, or a program's canonical shader paths joined by '|'
+  const char *key;
+  // Texture format the texture was loaded with
+  nu_TextureFormat format;
+  size_t refs;
+  // Estimated GPU memory used, or bytes mapped for files
+  size_t bytes;
+} nu_ResourceInfo;
+
+// Program binary cache activity since startup
+typedef struct {
+  // Programs loaded from a cached binary
+  size_t hits;
+  // Programs compiled from source, because there was no usable binary
+  size_t misses;
+  // Cached binaries the driver refused to load, counted in misses too
+  size_t rejected;
+  // Binaries written to the cache
+  size_t stored;
+} nu_ProgramCacheStats;
+
+// One field of a uniform block, declared in the same order as in GLSL.
+// count is the array length, 0 or 1 for a single value
+typedef struct {
+  const char *name;
+  GLenum type;
+  GLint count;
+} nu_BlockField;
+
+// A field with its std140 placement in the block
+typedef struct {
+  char *name;
+  GLenum type;
+  GLint count;
+  size_t offset;
+  // Bytes between array elements, and between matrix columns
+  size_t array_stride, matrix_stride;
+} nu_BlockMember;
+
+#define NU_BLOCK_RING_SEGMENTS 3
+
+// A std140 uniform block shared by every program that declares a block of
+// the same name. Uploads go to the next of NU_BLOCK_RING_SEGMENTS ranges of
+// one UBO, guarded by fence syncs, so frames don't wait on each other
+typedef struct {
+  char *name;
+  GLuint binding;
+  size_t num_members;
+  nu_BlockMember *members;
+  // std140 size of the block, and of a ring segment after offset alignment
+  size_t size, segment_size;
+  // CPU-side copy of the block in std140 layout
+  uint8_t *data;
+  bool dirty;
+  GLuint UBO;
+  // Persistently mapped ring with ARB_buffer_storage, else NULL
+  uint8_t *ring_data;
+  size_t ring_index;
+  GLsync ring_fences[NU_BLOCK_RING_SEGMENTS];
+} nu_UniformBlock;
+
+// How often a meshes contents change, chosen when the mesh is created
+typedef enum {
+  // Built once and drawn many times (GL_STATIC_DRAW)
+  NU_MESH_STATIC,
+  // Rebuilt often: each send orphans the old store so it never waits on draws
+  // still using it
+  NU_MESH_DYNAMIC,
+  // Rebuilt every frame: a persistently mapped ring of NU_MESH_RING_SEGMENTS
+  // segments, guarded by fence syncs. Needs ARB_buffer_storage, falls back
+  // to NU_MESH_DYNAMIC without it
+  NU_MESH_STREAM
+} nu_MeshUsage;
+
+#define NU_MESH_RING_SEGMENTS 3
+// Dirty ranges tracked per mesh before the closest ones get merged
+#define NU_MESH_MAX_DIRTY_RANGES 64
+
+// A byte range [start, end) of a meshes builder_data
+typedef struct {
+  size_t start, end;
+} nu_MeshRange;
+
+// One vertex attribute of a meshes layout: count values of type, each size
+// bytes. The packed GL_(UNSIGNED_)INT_2_10_10_10_REV types take count 4 and
+// 4 bytes in all. Integer types reach the shader as ints (ivec/uvec) unless
+// normalized, which maps signed types onto [-1, 1] and unsigned onto [0, 1]
+// floats
+typedef struct {
+  size_t size;
+  size_t count;
+  GLenum type;
+  bool normalized;
+} nu_MeshComponent;
+
 typedef struct {
   // CPU-side mesh building
   uint8_t *builder_data;
   size_t builder_alloced;
   size_t builder_added;
+  // Mapped building: while mapped_data is set, vertices are written straight
+  // into the VBO instead of builder_data
+  uint8_t *mapped_data;
+  size_t mapped_alloced;
+  size_t mapped_added;
+  // Ranges of builder_data changed since the last send, sorted and
+  // non-overlapping. Static meshes only upload these
+  nu_MeshRange dirty_ranges[NU_MESH_MAX_DIRTY_RANGES];
+  size_t num_dirty_ranges;
+  // CPU-side indices, from nu_mesh_add_indices or nu_mesh_weld
+  uint32_t *builder_indices;
+  size_t builder_indices_alloced;
+  size_t builder_indices_added;
+  bool indices_dirty;
+  // Vertex layout, kept so the VAO can be pointed at a replaced VBO
+  size_t num_components;
+  nu_MeshComponent *components;
   // OpenGL rendering information
+  nu_MeshUsage usage;
   size_t stride;
   size_t last_send_size;
+  size_t gpu_alloced;
+  // First vertex drawn, the current ring segment for streaming meshes
+  size_t draw_first;
   GLuint VAO, VBO;
   GLenum render_mode;
+  // Element buffer, drawn with glDrawElements when index_count > 0.
+  // index_type is GL_UNSIGNED_SHORT when every index fits, else GL_UNSIGNED_INT
+  GLuint EBO;
+  GLenum index_type;
+  size_t index_count;
+  // Size of the EBO's store
+  size_t index_alloced;
+  // Per-instance attributes, read from instance_VBO once per instance. They
+  // use the attribute locations after the vertex layout's
+  size_t num_instance_components;
+  nu_MeshComponent *instance_components;
+  size_t instance_stride;
+  size_t instance_alloced;
+  size_t instance_count;
+  GLuint instance_VBO;
+  // Being uploaded by a nu_Loader, the mesh can't be changed or drawn
+  bool loading;
+  // Streaming ring, the whole VBO stays mapped at ring_data
+  uint8_t *ring_data;
+  size_t ring_segment_size;
+  size_t ring_index;
+  GLsync ring_fences[NU_MESH_RING_SEGMENTS];
 } nu_Mesh;
 
+// Called on the render thread when a loader has published a texture or
+// mesh, texture is NULL if loading failed
+typedef void (*nu_TextureLoadedFn)(nu_Texture *texture, void *user_data);
+typedef void (*nu_MeshLoadedFn)(nu_Mesh *mesh, void *user_data);
+
+typedef enum {
+  NU_LOAD_TEXTURE,
+  NU_LOAD_MESH
+} nu_LoadType;
+
+typedef struct nu_LoadJob {
+  nu_LoadType type;
+  char *path;
+  nu_Texture **out;
+  nu_TextureLoadedFn texture_callback;
+  nu_Mesh *mesh;
+  nu_MeshLoadedFn mesh_callback;
+  void *user_data;
+  // Filled in by the loader thread
+  GLuint texture;
+  GLsizei width, height;
+  GLenum index_type;
+  GLsync fence;
+  bool failed;
+  struct nu_LoadJob *next;
+} nu_LoadJob;
+
+// A thread with its own GL context, shared with a window's, that uploads
+// textures and meshes in the background
+typedef struct {
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t wake;
+  bool quit;
+  // Jobs waiting for the loader thread, and jobs it has uploaded that wait
+  // for nu_loader_poll to see their fence signal
+  nu_LoadJob *queued, *queued_tail;
+  nu_LoadJob *uploaded;
+  // Only touched by the render thread
+  nu_LoadJob *fenced;
+  size_t num_outstanding;
+  // Bytes the loader thread may still upload this frame, refilled to
+  // frame_budget by nu_loader_poll. A frame_budget of 0 means no limit
+  size_t frame_budget;
+  int64_t budget_left;
+  // The shared context: a hidden GLFW window, or an EGL context
+  GLFWwindow *shared_window;
+  void *egl_display, *egl_context;
+  bool context_ready, context_failed;
+} nu_Loader;
+
+// Textures a single queued draw can bind, to slots 0 to NU_QUEUE_MAX_TEXTURES - 1
+#define NU_QUEUE_MAX_TEXTURES 4
+
+// A uniform value for a queued draw, data is copied on submit
+typedef struct {
+  const char *name;
+  void *data;
+} nu_UniformValue;
+
+typedef struct {
+  size_t uniform_index;
+  size_t data_offset;
+} nu_QueuedUniform;
+
+typedef struct {
+  // Sort key: program (16 bits) | textures (24 bits) | mesh VAO (24 bits)
+  uint64_t key;
+  size_t sequence;
+  nu_Program *program;
+  nu_Mesh *mesh;
+  nu_Texture *textures[NU_QUEUE_MAX_TEXTURES];
+  size_t num_textures;
+  size_t first_uniform, num_uniforms;
+} nu_DrawCommand;
+
+// What the last flush of a render queue did
+typedef struct {
+  size_t submitted;
+  size_t draw_calls;
+  // Draws merged into the previous one's instanced draw
+  size_t merged_draws;
+  size_t program_binds, texture_binds, mesh_binds;
+  // Binds saved compared to drawing in submission order without batching
+  size_t state_changes_saved;
+} nu_RenderQueueStats;
+
+typedef struct {
+  nu_DrawCommand *commands;
+  size_t num_commands, commands_alloced;
+  nu_QueuedUniform *uniforms;
+  size_t num_uniforms, uniforms_alloced;
+  uint8_t *uniform_data;
+  size_t uniform_data_added, uniform_data_alloced;
+  nu_RenderQueueStats stats;
+} nu_RenderQueue;
+
 // Function prototypes
 
 // -- WINDOWS --
 // Initialise GLFW and create a window with a given width, height, and title. If fullscreen is
 // true, the window will be fullscreen
 nu_Window *nu_create_window(size_t width, size_t height, const char *title, bool fullscreen);
+// Create a headless window: an offscreen OpenGL 3.3 core context (EGL
+// surfaceless, e.g. Mesa llvmpipe) rendering into an FBO of the given size.
+// Requires nuGL.c to be compiled with NUGL_HEADLESS defined and linked with EGL
+nu_Window *nu_create_headless_window(size_t width, size_t height);
 // Destroy a window and terminate GLFW
 void nu_destroy_window(nu_Window **window);
+// Read the window's framebuffer into out, as width * height RGBA8 pixels
+void nu_read_pixels(nu_Window *window, void *out);
 
 // -- SHADER PROGRAMS --
 // Create a shader program from a number of shaders, and a list of const char
-// *'s of their source file locations
+// *'s of their source file locations. Every active uniform is registered
+// automatically. Shader files can #include "file" relative to themselves,
+// and expanded sources are cached in memory, shared between programs
 nu_Program *nu_create_program(size_t num_shaders, ...);
+// Same as nu_create_program, but returns as soon as every shader is
+// submitted to the driver, without waiting for compiling or linking. With
+// KHR_parallel_shader_compile the driver compiles on its own threads. Using
+// the program before nu_program_ready returns true waits for it. Returns
+// NULL if a shader file couldn't be read
+nu_Program *nu_create_program_async(size_t num_shaders, ...);
+// Whether an async program has finished compiling and linking, successfully
+// or not. Never blocks when KHR_parallel_shader_compile is supported
+bool nu_program_ready(nu_Program *program);
+// Whether a program failed to compile or link, waiting for it if needed.
+// A failed program can only be destroyed
+bool nu_program_failed(nu_Program *program);
 // Destroy a shader program
 void nu_destroy_program(nu_Program **program);
+// Cache linked program binaries in an existing directory, so later launches
+// skip compiling. Binaries are keyed by the shader sources and stages, and
+// the driver vendor, renderer and version. Rejected binaries fall back to
+// compiling from source. NULL disables the cache
+void nu_set_program_cache_dir(const char *dir);
+// Get the program cache's hit and miss counts
+nu_ProgramCacheStats nu_get_program_cache_stats(void);
+// Watch shader files, and the files they include, for changes (inotify on
+// Linux, modification times elsewhere)
+void nu_enable_shader_reload(bool enable);
+// Recompile every program that depends on a shader file changed since the
+// last poll, in place. A program that fails to compile keeps its old GL
+// program. Returns the number of programs reloaded. Call once a frame
+size_t nu_poll_shader_reload(void);
+// Free the cached shader sources, they're read again when next needed
+void nu_clear_shader_sources(void);
 // Use a shader program
 void nu_use_program(nu_Program *program);
-// Add a uniform of a name and a type to a programs list of uniforms
+// Add a uniform of a name and a type to a programs list of uniforms. Active
+// uniforms are registered by nu_create_program, so this is only needed for
+// ones it can't see
 void nu_register_uniform(nu_Program *program, const char *name, GLenum type);
-// Set a registered uniform from a pointer to the data
+// Set a registered uniform from a pointer to the data. Arrays are set whole,
+// from every element. Makes the program current, even when the set is
+// skipped for having the same value as last time
 void nu_set_uniform(nu_Program *program, const char *uniform_name, void *data);
+// Get a handle to a registered uniform, for setting without a name lookup.
+// Returns -1 if the uniform isn't registered. Handles stay valid across
+// shader reloads, which also set every uniform's last value again
+int nu_get_uniform_handle(nu_Program *program, const char *name);
+// Set a uniform from its handle, see nu_set_uniform
+void nu_set_uniform_handle(nu_Program *program, int handle, void *data);
+
+// -- UNIFORM BLOCKS --
+// Create a uniform block of a name from its fields, laid out with std140
+// rules. It gets its own binding point, and is bound to every program (now
+// or later) that declares a uniform block of the same name with
+// layout(std140). Returns NULL on failure
+nu_UniformBlock *nu_create_uniform_block(const char *name, size_t num_fields, const nu_BlockField *fields);
+// Frees a uniform block and deletes its UBO
+void nu_destroy_uniform_block(nu_UniformBlock **block);
+// Set a field of a block from tightly packed data, like nu_set_uniform. The
+// block is uploaded once, before the next draw
+void nu_set_block_field(nu_UniformBlock *block, const char *field_name, const void *data);
+// Upload a block now if any field changed since its last upload. Draws do
+// this for every changed block automatically
+void nu_upload_uniform_block(nu_UniformBlock *block);
 
 // -- MESHES --
 // Create a mesh with a defined VAO and VBO layout. For example, for this
@@ -94,11 +590,62 @@ void nu_set_uniform(nu_Program *program, const char *uniform_name, void *data);
 // component_types should be {GL_FLOAT, GL_FLOAT, GL_INT} (float[], float[],
 //                                                        int)
 nu_Mesh *nu_create_mesh(size_t num_components, size_t *component_sizes, size_t *component_counts, GLenum *component_types); 
+// Same as nu_create_mesh, but with a usage other than NU_MESH_STATIC
+nu_Mesh *nu_create_mesh_with_usage(nu_MeshUsage usage, size_t num_components, size_t *component_sizes, size_t *component_counts, GLenum *component_types);
+// Same as nu_create_mesh_with_usage, with the layout as nu_MeshComponents so
+// components can be normalized, e.g. {sizeof(GLubyte), 4, GL_UNSIGNED_BYTE,
+// true} for a color
+nu_Mesh *nu_create_mesh_with_layout(nu_MeshUsage usage, size_t num_components, const nu_MeshComponent *components);
+// Converts num_vertices vertices of count floats each, packed together in
+// in, to an attribute of type (GL_HALF_FLOAT, a packed type or an integer
+// type) written out_stride bytes apart in out (0 for packed together).
+// Normalized conversion is the inverse of how a normalized component is
+// read, otherwise values are rounded. Values outside what type holds are
+// clamped. Returns false for types it can't convert to
+bool nu_quantize_vertices(GLenum type, bool normalized, size_t count, size_t num_vertices, const float *in, void *out, size_t out_stride);
 // Frees all resources of a mesh, deletes OpenGL buffers
 void nu_destroy_mesh(nu_Mesh **mesh);
 // Adds a number of bytes to the meshes builder from a pointer to those bytes
 void nu_mesh_add_bytes(nu_Mesh *mesh, size_t num_bytes, void *src);
-// Sends a mesh to the GPU through its VAO and VBO
+// Makes sure the meshes builder can hold at least num_bytes in total without
+// reallocating. Returns false if allocation failed
+bool nu_mesh_reserve(nu_Mesh *mesh, size_t num_bytes);
+// Appends num_vertices uninitialised vertices to the mesh and returns a
+// pointer to them (num_vertices * stride bytes) for the caller to fill in, or
+// NULL on failure. The pointer is only valid until the next append
+void *nu_mesh_emit_vertices(nu_Mesh *mesh, size_t num_vertices);
+// Starts building the mesh directly in GPU memory: the VBO is resized to hold
+// max_vertices and mapped, and nu_mesh_add_bytes/nu_mesh_emit_vertices write
+// into it instead of the CPU-side builder. Returns false if mapping failed
+bool nu_mesh_begin_mapped(nu_Mesh *mesh, size_t max_vertices);
+// Unmaps the VBO, after which the mapped vertices can be rendered. This
+// replaces nu_send_mesh for mapped building
+void nu_mesh_end_mapped(nu_Mesh *mesh);
+// Overwrites num_bytes of the meshes builder at offset, which must already
+// have been added. Only changed ranges are re-uploaded by nu_send_mesh
+void nu_mesh_write_bytes(nu_Mesh *mesh, size_t offset, size_t num_bytes, void *src);
+// Returns a pointer to num_bytes of the meshes builder at offset, for in-place
+// edits, and marks them as changed. NULL if the range hasn't been added
+void *nu_mesh_patch(nu_Mesh *mesh, size_t offset, size_t num_bytes);
+// Marks a range of the builder as changed, for edits made through builder_data
+void nu_mesh_mark_dirty(nu_Mesh *mesh, size_t offset, size_t num_bytes);
+// Adds a number of vertex indices to the mesh. Once a mesh has indices it is
+// drawn with glDrawElements
+void nu_mesh_add_indices(nu_Mesh *mesh, size_t num_indices, const uint32_t *indices);
+// Merges vertices whose bytes are identical, building (or remapping) the
+// meshes indices so only unique vertices are kept. Returns false on failure,
+// including an index past the last vertex, leaving the mesh unchanged
+bool nu_mesh_weld(nu_Mesh *mesh);
+// Reorders an indexed GL_TRIANGLES meshes triangles to make better use of the
+// GPU's post-transform vertex cache (Forsyth's algorithm)
+void nu_mesh_optimize_vertex_cache(nu_Mesh *mesh);
+// Reorders an indexed meshes vertices into the order the indices first use
+// them, so vertex fetches read memory linearly. Unused vertices are dropped.
+// A mesh with an index past the last vertex is left unchanged
+void nu_mesh_optimize_vertex_fetch(nu_Mesh *mesh);
+// Sends a mesh to the GPU through its VAO and VBO. Static meshes only upload
+// the ranges changed since the last send, and grow their GPU buffer
+// geometrically
 void nu_send_mesh(nu_Mesh *mesh); 
 // Frees all CPU-side resources of the mesh, keeps VAO and VBO, deletes CPU
 // side buffer
@@ -107,6 +654,18 @@ void nu_send_mesh(nu_Mesh *mesh);
 void nu_free_mesh(nu_Mesh *mesh);
 // Renders a mesh, if it has been sent
 void nu_render_mesh(nu_Mesh *mesh);
+// Declares per-instance attributes for a mesh, in the same form as
+// nu_create_mesh's layout. Their locations follow the vertex attributes, and
+// components with a count over 4 (e.g. a mat4 as 16 floats) take one location
+// per 4 values. Returns false on failure
+bool nu_mesh_set_instance_layout(nu_Mesh *mesh, size_t num_components, size_t *component_sizes, size_t *component_counts, GLenum *component_types);
+// Same as nu_mesh_set_instance_layout, with the layout as nu_MeshComponents
+bool nu_mesh_set_instance_components(nu_Mesh *mesh, size_t num_components, const nu_MeshComponent *components);
+// Uploads per-instance data for num_instances instances (num_instances *
+// instance_stride bytes). Orphans the old store, so it is cheap every frame
+void nu_mesh_set_instances(nu_Mesh *mesh, size_t num_instances, void *data);
+// Renders count instances of a mesh in one draw call
+void nu_render_mesh_instanced(nu_Mesh *mesh, size_t count);
 // Sets the rendering mode used when drawing the meshes VAO and VBO
 // Default mode: GL_TRIANGLES
 void nu_mesh_set_render_mode(nu_Mesh *mesh, GLenum render_mode);
@@ -114,28 +673,194 @@ void nu_mesh_set_render_mode(nu_Mesh *mesh, GLenum render_mode);
 // -- TEXTURES --
 // Load a texture using its file location
 nu_Texture *nu_load_texture(const char *texture_loc);
+// Same as nu_load_texture, but block compresses the image to format on the
+// CPU first. Falls back to NU_TEXTURE_RGBA8 if the driver lacks the format
+nu_Texture *nu_load_texture_with_format(const char *texture_loc, nu_TextureFormat format);
 // Load a 2d texture array using a number of textures, and a list of file
-// locations
+// locations. Layers are decoded in parallel on worker threads
 nu_Texture *nu_load_texture_array(size_t num_textures, ...);
+// Same as nu_load_texture_array, from an array of num_textures file locations
+nu_Texture *nu_load_texture_array_paths(size_t num_textures, const char **paths);
+// Same as nu_load_texture_array_paths, with each layer encoded to format on
+// the decoding threads
+nu_Texture *nu_load_texture_array_with_format(size_t num_textures, const char **paths, nu_TextureFormat format);
+// Bytes an RGBA8 image of width x height takes once encoded to format
+size_t nu_encoded_texture_size(nu_TextureFormat format, size_t width, size_t height);
+// Encode an RGBA8 image to format, spreading rows of blocks over all cores.
+// out must hold nu_encoded_texture_size bytes. Returns the bytes written
+size_t nu_encode_texture(nu_TextureFormat format, const uint8_t *rgba, size_t width, size_t height, uint8_t *out);
+// GL internal format of a nu_TextureFormat
+GLenum nu_texture_format_gl(nu_TextureFormat format);
+// Load a nu texture container (.nut) made by nu_convert_texture. The file
+// is memory mapped and every mip level uploaded straight from it.
+// nu_load_texture also loads .nut files through this
+nu_Texture *nu_load_nut(const char *file_loc);
+// Convert images to a nu texture container with a full mip chain, flipped
+// for OpenGL. One image makes a GL_TEXTURE_2D, more make a
+// GL_TEXTURE_2D_ARRAY with a layer per image, all the same size. Every
+// level is encoded to format. Returns false on failure
+bool nu_convert_texture(size_t num_images, const char **image_locs, const char *nut_loc, nu_TextureFormat format);
 // Destroys all of a texture's resources
 void nu_destroy_texture(nu_Texture **texture);
 // Binds a texture to a specific texture slot
 void nu_bind_texture(nu_Texture *texture, size_t slot);
 
+// -- ATLASES --
+// Pack images of any size into as few page_size x page_size pages as the
+// skyline packer manages, one array layer per page, encoded to format.
+// Each image gets padding texels of its own edges repeated around it so
+// filtering doesn't bleed between neighbours
+nu_Atlas *nu_create_atlas(size_t num_images, const char **image_locs, size_t page_size, size_t padding, nu_TextureFormat format);
+// Destroys an atlas and its texture
+void nu_destroy_atlas(nu_Atlas **atlas);
+
+// -- RESOURCE CACHE --
+// Load a texture through the cache. Every spelling of a path and format
+// shares one nu_Texture, loaded on first use. Release it with
+// nu_release_texture, never nu_destroy_texture
+nu_Texture *nu_acquire_texture(const char *texture_loc, nu_TextureFormat format);
+// Create a program through the cache, keyed by the ordered list of shader
+// files. Release it with nu_release_program, never nu_destroy_program
+nu_Program *nu_acquire_program(size_t num_shaders, ...);
+// Map a file through the cache, read-only. size is set to its length
+const uint8_t *nu_acquire_file(const char *file_loc, size_t *size);
+// Drop a reference, freeing the resource with the last one
+void nu_release_texture(nu_Texture **texture);
+void nu_release_program(nu_Program **program);
+void nu_release_file(const uint8_t **data);
+// Fill out with up to max_resources cached resources, returns how many are
+// cached. Keys stay valid until their resource is freed
+size_t nu_get_resources(nu_ResourceInfo *out, size_t max_resources);
+// Estimated GPU memory of a texture, over every level and layer
+size_t nu_texture_gpu_bytes(const nu_Texture *texture);
+
+// -- LOADER --
+// Create a loader thread with a GL context shared with window's. Each frame
+// it uploads at most frame_budget bytes, 0 for no limit. Returns NULL if the
+// shared context couldn't be created
+nu_Loader *nu_create_loader(nu_Window *window, size_t frame_budget);
+// Stop a loader thread. Jobs that haven't been published are dropped without
+// their callbacks being called
+void nu_destroy_loader(nu_Loader **loader);
+// Decode and upload a texture on the loader thread. When it's ready, *out
+// (if not NULL) is set to it and callback (if not NULL) is called, from
+// nu_loader_poll. Returns false if the job couldn't be queued
+bool nu_loader_load_texture(nu_Loader *loader, const char *texture_loc, nu_Texture **out, nu_TextureLoadedFn callback, void *user_data);
+// Upload a static or dynamic meshes builder data and indices on the loader
+// thread, like nu_send_mesh. Until callback is called, or mesh->loading is
+// false, functions that change, free or destroy the mesh refuse to and print
+// an error. Returns false if the job couldn't be queued
+bool nu_loader_send_mesh(nu_Loader *loader, nu_Mesh *mesh, nu_MeshLoadedFn callback, void *user_data);
+// Publish uploads whose fences have signalled and refill the upload budget.
+// Call once a frame from the render thread. Returns the number published
+size_t nu_loader_poll(nu_Loader *loader);
+// Number of jobs queued or uploading and not yet published
+size_t nu_loader_pending(nu_Loader *loader);
+
+// -- RENDER QUEUE --
+// Create an empty render queue
+nu_RenderQueue *nu_create_render_queue(void);
+// Destroy a render queue
+void nu_destroy_render_queue(nu_RenderQueue **queue);
+// Queue a draw of a mesh with a program, textures bound to slots 0 to
+// num_textures - 1, and uniform values set just before the draw
+void nu_queue_submit(nu_RenderQueue *queue, nu_Program *program, size_t num_textures, nu_Texture **textures, nu_Mesh *mesh, size_t num_uniforms, nu_UniformValue *uniforms);
+// Sort the queued draws to minimise program, texture and mesh changes, draw
+// them, and empty the queue. Consecutive draws with the same state and no
+// uniforms are merged into one instanced draw. Draws of meshes that are
+// unsent, mapped or still loading are dropped
+void nu_flush_render_queue(nu_RenderQueue *queue);
+// Get the stats of the last flush
+nu_RenderQueueStats nu_get_render_queue_stats(nu_RenderQueue *queue);
+
+// -- STATE --
+// nuGL keeps a shadow copy of the programs, VAOs, buffers and textures it
+// binds, and skips binds that wouldn't change anything. Call this after
+// binding any of those yourself, so the next nuGL bind isn't skipped
+void nu_reset_state_cache(void);
+
 // -- RENDERING --
-// Clears the screen
+// Clears the screen (or the FBO of a headless window), and applies queued
+// input events to the window
 void nu_start_frame(nu_Window *window);
-// Swaps buffers, polls events
+// Swaps buffers, polls events. Headless windows just flush
 void nu_end_frame(nu_Window *window);
 
+// -- PROFILER --
+// With NUGL_PROFILE defined (for nuGL.c and the code using these), zones
+// record CPU time and, through GL_TIMESTAMP queries read back
+// NU_PROFILE_FRAMES frames later, GPU time. nuGL's own loading, upload and
+// draw functions are zones already. Without NUGL_PROFILE every macro is
+// empty. Zone names must outlive the profile, e.g. string literals
+#define NU_PROFILE_FRAMES 4
+#define NU_PROFILE_CONCAT_(a, b) a##b
+#define NU_PROFILE_CONCAT(a, b) NU_PROFILE_CONCAT_(a, b)
+#ifdef NUGL_PROFILE
+int nu_profile_begin(const char *name);
+void nu_profile_end(void);
+void nu_profile_scope_end(int *scope);
+#define NU_PROFILE_BEGIN(name) nu_profile_begin(name)
+#define NU_PROFILE_END() nu_profile_end()
+// A zone until the end of the enclosing block. Needs GCC or Clang's cleanup
+// attribute, and is empty elsewhere
+#if defined(__GNUC__) || defined(__clang__)
+#define NU_PROFILE_SCOPE(name) __attribute__((cleanup(nu_profile_scope_end))) int NU_PROFILE_CONCAT(nu_profile_scope_, __LINE__) = nu_profile_begin(name)
+#else
+#define NU_PROFILE_SCOPE(name)
+#endif
+#else
+#define NU_PROFILE_BEGIN(name) ((void)0)
+#define NU_PROFILE_END() ((void)0)
+#define NU_PROFILE_SCOPE(name)
+#endif
+#define NU_PROFILE_FUNCTION() NU_PROFILE_SCOPE(__func__)
+// Write every recorded zone as Chrome trace event JSON (chrome://tracing or
+// Perfetto), CPU and GPU on separate tracks. Returns false on failure, or
+// when nuGL.c was built without NUGL_PROFILE
+bool nu_export_profile(const char *json_loc);
+
+// -- FRAME PACING --
+// Set how many display refreshes a buffer swap waits for: 0 disables vsync,
+// 1 syncs to every refresh and -1 allows late swaps to tear where supported
+void nu_set_swap_interval(nu_Window *window, int interval);
+// Cap the frame rate. nu_end_frame sleeps, then spins for the last stretch,
+// until the next frame is due. 0 removes the cap
+void nu_set_target_fps(nu_Window *window, double fps);
+// Frame times over the last NU_FRAME_HISTORY focused frames
+nu_FrameStats nu_get_frame_stats(nu_Window *window);
+
+// -- RENDERER COUNTERS --
+// The counters of the frame in progress on the window, with the live object
+// totals as they are now. Counting goes to whichever window last started a
+// frame
+nu_RenderCounters nu_get_render_counters(nu_Window *window);
+// Keep each finished frame's counters in a ring of the last num_frames. 0
+// stops logging and frees the ring
+bool nu_log_render_counters(nu_Window *window, size_t num_frames);
+// Write the logged frames as CSV, oldest first
+bool nu_export_render_counters(nu_Window *window, const char *csv_loc);
+
 // -- INPUT --
 // Updates the last input variables to be the current, should be run at the end
 // of every frame
 void nu_update_input(nu_Window *window);
 // Gets if a key is currently pressed
 bool nu_get_key_state(nu_Window *window, int keycode);
-// Gets if a key was pressed down this frame
+// Gets if a key was pressed down this frame, including keys pressed and
+// released again before the frame ended
 bool nu_get_key_pressed(nu_Window *window, int keycode);
+// Every input event since the last nu_update_input, oldest first, with
+// count set to how many. Valid until the next nu_update_input
+const nu_InputEvent *nu_get_input_events(nu_Window *window, size_t *count);
+// Monotonic time in nanoseconds, the clock input events are stamped with
+uint64_t nu_get_time_ns(void);
+// Run render_fn on a new thread with the window's context current on it,
+// while the calling thread (which must be the main thread, as GLFW only
+// takes events there) does nothing but wait for events. Events are then
+// queued and stamped as they arrive, however long a frame takes, and
+// nu_end_frame on the render thread only presents. Returns false if the
+// thread couldn't start, else once render_fn returns
+bool nu_run_with_input_thread(nu_Window *window, void (*render_fn)(nu_Window *window, void *user_data), void *user_data);
 // Cursor position functions:
 // Current position
 double nu_get_mouse_x(nu_Window *window); 
@@ -0,0 +1,34 @@
+// nutconv: converts images to a nu texture container (.nut)
+// One image makes a 2D texture, several make a texture array with a layer
+// per image. Every mip level is generated, encoded and stored pre-flipped,
+// so nu_load_texture only has to map and upload it.
+//
+// Build with `make nutconv`. Run:
+//   ./nutconv [-f rgba8|bc1|bc3|bc4|bc5] out.nut image.png [more images...]
+#include "nuGL.h"
+
+int main(int argc, char **argv) {
+  static const char *format_names[] = {"rgba8", "bc1", "bc3", "bc4", "bc5"};
+  nu_TextureFormat format = NU_TEXTURE_RGBA8;
+  int first = 1;
+  if(argc > 2 && strcmp(argv[1], "-f") == 0) {
+    bool found = false;
+    for(size_t i = 0; i < sizeof(format_names) / sizeof(format_names[0]); i++) {
+      if(strcmp(argv[2], format_names[i]) == 0) {
+        format = (nu_TextureFormat)i;
+        found = true;
+      }
+    }
+    if(!found) {
+      fprintf(stderr, "Unknown format %s\n", argv[2]);
+      return 1;
+    }
+    first = 3;
+  }
+  if(argc - first < 2) {
+    fprintf(stderr, "Usage: %s [-f rgba8|bc1|bc3|bc4|bc5] out.nut image [more images...]\n", argv[0]);
+    return 1;
+  }
+  if(!nu_convert_texture((size_t)(argc - first - 1), (const char **)(argv + first + 1), argv[first], format)) return 1;
+  return 0;
+}